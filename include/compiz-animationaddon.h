@@ -1,7 +1,7 @@
 #ifndef _COMPIZ_ANIMATIONADDON_H
 #define _COMPIZ_ANIMATIONADDON_H
 
-#define ANIMATIONADDON_ABIVERSION 20081023
+#define ANIMATIONADDON_ABIVERSION 20261018
 
 
 // Polygon tesselation type: Rectangular, Hexagonal
@@ -150,6 +150,8 @@ typedef struct _ParticleSystem
     int color_cache_count;
     GLfloat *dcolors_cache;
     int dcolors_cache_count;
+
+    int particles_capacity;	// # of particles allocated
 } ParticleSystem;
 
 // Window properties for particle or polygon based animation effects
@@ -180,6 +182,11 @@ typedef struct _AnimAddonFunctions {
     void (*initParticles) (int numParticles,
 			   ParticleSystem * ps);
     void (*finiParticles) (ParticleSystem * ps);
+    // Called from postPaintWindowFunc. While an untransformed output is
+    // painted, the particles may be queued and drawn later with the
+    // output transform, unless the animation uses aw->com->transform.
+    // Effects must not change the GL matrix before calling it, but set
+    // aw->com->transform and usingTransform instead.
     void (*drawParticleSystems) (CompWindow *w);
     UpdateBBProc	particlesUpdateBB;
     void (*particlesCleanup) (CompWindow * w);
@@ -208,6 +215,36 @@ typedef struct _AnimAddonFunctions {
     tessellateProc	tessellateIntoRectangles;
     tessellateProc	tessellateIntoHexagons;
     tessellateProc	tessellateIntoGlass;
+
+    // Batch entry points (since ABI version 20261018), to share engine
+    // work across all windows of a screen
+
+    // Steps the polygons of every window animated with the given effect,
+    // returns the number of windows stepped
+    int (*polygonsAnimStepAll) (CompScreen *s,
+				AnimEffect effect,
+				float time);
+    // Draws the particle systems of all windows for an output
+    // with one draw call per texture and blend mode. Windows whose
+    // effect has drawParticleSystems as postPaintWindowFunc are
+    // skipped, they are drawn with their window.
+    void (*drawAllParticleSystems) (CompScreen *s,
+				    const CompTransform *transform,
+				    CompOutput *output);
+    // Pre-allocates particle systems for nWindows windows
+    Bool (*preallocEngineData) (CompScreen *s,
+				int nWindows,
+				int numPs,
+				int numParticles);
+    // Sets up the particle systems of a window, from the
+    // pre-allocated ones if possible. Initialize them with
+    // reinitParticles to keep their buffers.
+    ParticleSystem * (*allocParticleSystems) (CompWindow *w,
+					      int numPs);
+    // Like initParticles, but reuses the buffers of a system that was
+    // zeroed, finished or set up before
+    void (*reinitParticles) (int numParticles,
+			     ParticleSystem * ps);
 } AnimAddonFunctions;
 
 typedef void (*AnimStepPolygonProc) (CompWindow *w,
@@ -0,0 +1,263 @@
+/*
+ * Shadow of the GL state touched by the paint hooks of some plugins
+ *
+ * compiz-glstate.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _COMPIZ_GLSTATE_H
+#define _COMPIZ_GLSTATE_H
+
+/*
+ * Querying GL state with glIsEnabled or glGet* can stall the pipeline,
+ * so plugins keep a CompGLState per screen and read the state from it.
+ * A value is known once it was queried, set through one of the setters
+ * below or assumed by the plugin; setters skip changes to the value
+ * that is already known.
+ *
+ * Core and other plugins change GL state behind our back, so a plugin
+ * has to call glStateInvalidate whenever control comes back from code
+ * it does not own, usually at the start of a paint hook and after
+ * calling the wrapped function. glStateAssume records a value that is
+ * known from the paint conventions of core without a query.
+ *
+ * Building with GLSTATE_DEBUG (configure --enable-glstate-debug) checks
+ * every value read from or skipped by the shadow against real GL state.
+ */
+
+typedef enum
+{
+    GLStateCullFace = 0,
+    GLStateBlend,
+    GLStateNormalArray,
+    GLStateClipPlane0,
+    GLStateClipPlane1,
+    GLStateClipPlane2,
+    GLStateClipPlane3,
+    GLStateNum
+} GLStateCap;
+
+typedef struct _CompGLState
+{
+    unsigned int known;
+    unsigned int enabled;
+
+    Bool   cullFaceModeKnown;
+    GLenum cullFaceMode;
+} CompGLState;
+
+static inline int
+glStateCapIndex (GLenum cap)
+{
+    switch (cap) {
+    case GL_CULL_FACE:
+	return GLStateCullFace;
+    case GL_BLEND:
+	return GLStateBlend;
+    case GL_NORMAL_ARRAY:
+	return GLStateNormalArray;
+    case GL_CLIP_PLANE0:
+	return GLStateClipPlane0;
+    case GL_CLIP_PLANE1:
+	return GLStateClipPlane1;
+    case GL_CLIP_PLANE2:
+	return GLStateClipPlane2;
+    case GL_CLIP_PLANE3:
+	return GLStateClipPlane3;
+    default:
+	break;
+    }
+
+    return -1;
+}
+
+static inline void
+glStateInvalidate (CompGLState *state)
+{
+    state->known             = 0;
+    state->cullFaceModeKnown = FALSE;
+}
+
+#ifdef GLSTATE_DEBUG
+#include <stdio.h>
+
+static inline void
+glStateCheck (const char *what,
+	      int        shadow,
+	      int        real)
+{
+    if (shadow != real)
+	compLogMessage ("glstate", CompLogLevelWarn,
+			"Shadowed %s is 0x%x, but GL has 0x%x",
+			what, shadow, real);
+}
+
+static inline void
+glStateCheckCap (GLenum cap,
+		 Bool   enabled)
+{
+    char what[32];
+
+    snprintf (what, sizeof (what), "enable 0x%x", cap);
+    glStateCheck (what, enabled, glIsEnabled (cap));
+}
+#else
+#define glStateCheck(what, shadow, real)
+#define glStateCheckCap(cap, enabled)
+#endif
+
+static inline Bool
+glStateIsEnabled (CompGLState *state,
+		  GLenum      cap)
+{
+    int i = glStateCapIndex (cap);
+
+    if (i < 0)
+	return glIsEnabled (cap);
+
+    if (state->known & (1 << i))
+    {
+	glStateCheckCap (cap, (state->enabled & (1 << i)) != 0);
+	return (state->enabled & (1 << i)) != 0;
+    }
+
+    state->known |= (1 << i);
+
+    if (glIsEnabled (cap))
+    {
+	state->enabled |= (1 << i);
+	return TRUE;
+    }
+
+    state->enabled &= ~(1 << i);
+    return FALSE;
+}
+
+static inline void
+glStateAssume (CompGLState *state,
+	       GLenum      cap,
+	       Bool        enabled)
+{
+    int i = glStateCapIndex (cap);
+
+    if (i < 0)
+	return;
+
+    glStateCheckCap (cap, enabled);
+
+    state->known |= (1 << i);
+
+    if (enabled)
+	state->enabled |= (1 << i);
+    else
+	state->enabled &= ~(1 << i);
+}
+
+static inline void
+glStateSet (CompGLState *state,
+	    GLenum      cap,
+	    Bool        enabled)
+{
+    int i = glStateCapIndex (cap);
+
+    if (i >= 0 && (state->known & (1 << i)) &&
+	((state->enabled & (1 << i)) != 0) == enabled)
+    {
+	glStateCheckCap (cap, enabled);
+	return;
+    }
+
+    if (cap == GL_NORMAL_ARRAY)
+    {
+	if (enabled)
+	    glEnableClientState (cap);
+	else
+	    glDisableClientState (cap);
+    }
+    else
+    {
+	if (enabled)
+	    glEnable (cap);
+	else
+	    glDisable (cap);
+    }
+
+    if (i >= 0)
+    {
+	state->known |= (1 << i);
+
+	if (enabled)
+	    state->enabled |= (1 << i);
+	else
+	    state->enabled &= ~(1 << i);
+    }
+}
+
+static inline void
+glStateEnable (CompGLState *state,
+	       GLenum      cap)
+{
+    glStateSet (state, cap, TRUE);
+}
+
+static inline void
+glStateDisable (CompGLState *state,
+		GLenum      cap)
+{
+    glStateSet (state, cap, FALSE);
+}
+
+static inline GLenum
+glStateGetCullFace (CompGLState *state)
+{
+    GLint mode;
+
+    if (state->cullFaceModeKnown)
+    {
+#ifdef GLSTATE_DEBUG
+	glGetIntegerv (GL_CULL_FACE_MODE, &mode);
+	glStateCheck ("cull face mode", state->cullFaceMode, mode);
+#endif
+	return state->cullFaceMode;
+    }
+
+    glGetIntegerv (GL_CULL_FACE_MODE, &mode);
+
+    state->cullFaceModeKnown = TRUE;
+    state->cullFaceMode      = mode;
+
+    return mode;
+}
+
+static inline void
+glStateCullFace (CompGLState *state,
+		 GLenum      mode)
+{
+    if (state->cullFaceModeKnown && state->cullFaceMode == mode)
+    {
+#ifdef GLSTATE_DEBUG
+	GLint real;
+
+	glGetIntegerv (GL_CULL_FACE_MODE, &real);
+	glStateCheck ("cull face mode", mode, real);
+#endif
+	return;
+    }
+
+    glCullFace (mode);
+
+    state->cullFaceModeKnown = TRUE;
+    state->cullFaceMode      = mode;
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Renderbuffer functions for plugins rendering into framebuffer objects
+ *
+ * compiz-renderbuffer.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _COMPIZ_RENDERBUFFER_H
+#define _COMPIZ_RENDERBUFFER_H
+
+#include <string.h>
+
+/*
+ * Core loads the EXT_framebuffer_object functions for color attachments
+ * only. Plugins that paint depth tested geometry into a framebuffer
+ * object also need a depth buffer, so they look up the renderbuffer
+ * functions themselves with renderbufferProcsInit.
+ */
+
+typedef void (*CompGenRenderbuffersProc) (GLsizei n,
+					  GLuint  *renderbuffers);
+typedef void (*CompDeleteRenderbuffersProc) (GLsizei      n,
+					     const GLuint *renderbuffers);
+typedef void (*CompBindRenderbufferProc) (GLenum target,
+					  GLuint renderbuffer);
+typedef void (*CompRenderbufferStorageProc) (GLenum  target,
+					     GLenum  internalformat,
+					     GLsizei width,
+					     GLsizei height);
+typedef void (*CompFramebufferRenderbufferProc) (GLenum target,
+						 GLenum attachment,
+						 GLenum renderbuffertarget,
+						 GLuint renderbuffer);
+
+typedef struct _CompRenderbufferProcs
+{
+    CompGenRenderbuffersProc        genRenderbuffers;
+    CompDeleteRenderbuffersProc     deleteRenderbuffers;
+    CompBindRenderbufferProc        bindRenderbuffer;
+    CompRenderbufferStorageProc     renderbufferStorage;
+    CompFramebufferRenderbufferProc framebufferRenderbuffer;
+
+    /* packed depth and stencil where available, depth only otherwise */
+    GLenum depthFormat;
+} CompRenderbufferProcs;
+
+/*
+ * Look up the renderbuffer functions, returns FALSE if any of them is
+ * missing. Does nothing if they are loaded already.
+ */
+static inline Bool
+renderbufferProcsInit (CompScreen            *s,
+		       CompRenderbufferProcs *rb)
+{
+    const char *extensions;
+
+    if (rb->genRenderbuffers)
+	return TRUE;
+
+    rb->genRenderbuffers = (CompGenRenderbuffersProc)
+	(*s->getProcAddress) ((GLubyte *) "glGenRenderbuffersEXT");
+    rb->deleteRenderbuffers = (CompDeleteRenderbuffersProc)
+	(*s->getProcAddress) ((GLubyte *) "glDeleteRenderbuffersEXT");
+    rb->bindRenderbuffer = (CompBindRenderbufferProc)
+	(*s->getProcAddress) ((GLubyte *) "glBindRenderbufferEXT");
+    rb->renderbufferStorage = (CompRenderbufferStorageProc)
+	(*s->getProcAddress) ((GLubyte *) "glRenderbufferStorageEXT");
+    rb->framebufferRenderbuffer = (CompFramebufferRenderbufferProc)
+	(*s->getProcAddress) ((GLubyte *) "glFramebufferRenderbufferEXT");
+
+    if (!rb->genRenderbuffers || !rb->deleteRenderbuffers ||
+	!rb->bindRenderbuffer || !rb->renderbufferStorage ||
+	!rb->framebufferRenderbuffer)
+    {
+	rb->genRenderbuffers = NULL;
+	return FALSE;
+    }
+
+    extensions = (const char *) glGetString (GL_EXTENSIONS);
+    if (extensions && strstr (extensions, "GL_EXT_packed_depth_stencil"))
+	rb->depthFormat = GL_DEPTH24_STENCIL8_EXT;
+    else
+	rb->depthFormat = GL_DEPTH_COMPONENT24;
+
+    return TRUE;
+}
+
+/*
+ * Size the depth renderbuffer and attach it to the bound framebuffer
+ * object, as stencil buffer too if it has a packed format
+ */
+static inline void
+renderbufferAttachDepth (CompRenderbufferProcs *rb,
+			 GLuint                renderbuffer,
+			 int                   width,
+			 int                   height)
+{
+    (*rb->bindRenderbuffer) (GL_RENDERBUFFER_EXT, renderbuffer);
+    (*rb->renderbufferStorage) (GL_RENDERBUFFER_EXT, rb->depthFormat,
+				width, height);
+    (*rb->bindRenderbuffer) (GL_RENDERBUFFER_EXT, 0);
+
+    (*rb->framebufferRenderbuffer) (GL_FRAMEBUFFER_EXT,
+				    GL_DEPTH_ATTACHMENT_EXT,
+				    GL_RENDERBUFFER_EXT, renderbuffer);
+    if (rb->depthFormat == GL_DEPTH24_STENCIL8_EXT)
+	(*rb->framebufferRenderbuffer) (GL_FRAMEBUFFER_EXT,
+					GL_STENCIL_ATTACHMENT_EXT,
+					GL_RENDERBUFFER_EXT, renderbuffer);
+}
+
+#endif
@@ -43,12 +43,19 @@
 
 #define PI 3.14159265359f
 
+/* 4 sides and 4 bevels made of 2 quads each */
+#define DEPTH_NVERTEX ((4 + 4 * 2) * 4)
+
 static int displayPrivateIndex;
 static int cubeDisplayPrivateIndex = -1;
 
 typedef struct _tdDisplay
 {
     int screenPrivateIndex;
+
+    HandleEventProc            handleEvent;
+    MatchPropertyChangedProc   matchPropertyChanged;
+    MatchExpHandlerChangedProc matchExpHandlerChanged;
 } tdDisplay;
 
 typedef struct _tdWindow
@@ -57,6 +64,14 @@ typedef struct _tdWindow
     Bool ftb;
 
     float depth;
+
+    /* window relative sides and bevels, z selects the front (0)
+       or back (1) face */
+    GLfloat depthVertices[DEPTH_NVERTEX * 3];
+    int     nDepthVertices;
+    int     depthWidth, depthHeight;
+    int     depthBevel;
+    int     depthBevelMask;
 } tdWindow;
 
 typedef struct _tdScreen
@@ -72,6 +87,8 @@ typedef struct _tdScreen
     CubePaintViewportProc     paintViewport;
     CubeShouldPaintViewportProc shouldPaintViewport;
 
+    WindowStateChangeNotifyProc windowStateChangeNotify;
+
     Bool  active;
     Bool  painting3D;
     float currentScale;
@@ -80,9 +97,13 @@ typedef struct _tdScreen
     float maxDepth;
     Bool  damage;
 
+    /* window depths need to be recomputed from the stacking order */
+    Bool depthDirty;
+
     Bool withDepth;
 
     CompTransform bTransform;
+    CompTransform depthTransform;
 } tdScreen;
 
 #define GET_TD_DISPLAY(d)       \
@@ -124,12 +145,36 @@ windowIs3D (CompWindow *w)
     return TRUE;
 }
 
+static void
+tdUpdateWindowDepths (CompScreen *s)
+{
+    CompWindow *w;
+
+    TD_SCREEN (s);
+
+    tds->maxDepth = 0;
+    for (w = s->windows; w; w = w->next)
+    {
+	TD_WINDOW (w);
+	tdw->is3D = FALSE;
+	tdw->depth = 0;
+
+	if (!windowIs3D (w))
+	    continue;
+
+	tdw->is3D = TRUE;
+	tds->maxDepth++;
+	tdw->depth = tds->maxDepth;
+    }
+
+    tds->depthDirty = FALSE;
+}
+
 static void
 tdPreparePaintScreen (CompScreen *s,
 		      int        msSinceLastPaint)
 {
-    CompWindow *w;
-    Bool       active;
+    Bool active;
 
     TD_SCREEN (s);
     CUBE_SCREEN (s);
@@ -145,20 +190,8 @@ tdPreparePaintScreen (CompScreen *s,
 	
 	(*cs->getRotation) (s, &x, &x, &progress);
 
-	tds->maxDepth = 0;
-	for (w = s->windows; w; w = w->next)
-	{
-	    TD_WINDOW (w);
-	    tdw->is3D = FALSE;
-	    tdw->depth = 0;
-
-	    if (!windowIs3D (w))
-		continue;
-
-	    tdw->is3D = TRUE;
-	    tds->maxDepth++;
-	    tdw->depth = tds->maxDepth;
-	}
+	if (tds->depthDirty)
+	    tdUpdateWindowDepths (s);
 
 	minScale =  MAX (minScale, 1.0 - (tds->maxDepth * maxDiv));
 	tds->basicScale = 1.0 - ((1.0 - minScale) * progress);
@@ -190,30 +223,174 @@ static Bool tdPaintWindow (CompWindow              *w,
 
 #define DOBEVEL(corner) (tdGetBevel##corner (s) ? bevel : 0)
 
-#define ADDQUAD(x1,y1,x2,y2)                                      \
-	point.x = x1; point.y = y1;                               \
-	matrixMultiplyVector (&tPoint, &point, transform);        \
-	glVertex4fv (tPoint.v);                                   \
-	point.x = x2; point.y = y2;                               \
-	matrixMultiplyVector (&tPoint, &point, transform);        \
-	glVertex4fv (tPoint.v);                                   \
-	matrixMultiplyVector (&tPoint, &point, &tds->bTransform); \
-	glVertex4fv (tPoint.v);                                   \
-	point.x = x1; point.y = y1;                               \
-	matrixMultiplyVector (&tPoint, &point, &tds->bTransform); \
-	glVertex4fv (tPoint.v);                                   \
-
-#define ADDBEVELQUAD(x1,y1,x2,y2,m1,m2)             \
-	point.x = x1; point.y = y1;                 \
-	matrixMultiplyVector (&tPoint, &point, m1); \
-	glVertex4fv (tPoint.v);                     \
-	matrixMultiplyVector (&tPoint, &point, m2); \
-	glVertex4fv (tPoint.v);                     \
-	point.x = x2; point.y = y2;                 \
-	matrixMultiplyVector (&tPoint, &point, m2); \
-	glVertex4fv (tPoint.v);                     \
-	matrixMultiplyVector (&tPoint, &point, m1); \
-	glVertex4fv (tPoint.v);                     \
+#define BEVEL_TOPLEFT     (1 << 0)
+#define BEVEL_TOPRIGHT    (1 << 1)
+#define BEVEL_BOTTOMLEFT  (1 << 2)
+#define BEVEL_BOTTOMRIGHT (1 << 3)
+
+static GLfloat *
+tdAddVertex (GLfloat *v,
+	     float   x,
+	     float   y,
+	     float   back)
+{
+    *v++ = x;
+    *v++ = y;
+    *v++ = back;
+
+    return v;
+}
+
+static GLfloat *
+tdAddQuad (GLfloat *v,
+	   float   x1,
+	   float   y1,
+	   float   x2,
+	   float   y2)
+{
+    v = tdAddVertex (v, x1, y1, 0.0f);
+    v = tdAddVertex (v, x2, y2, 0.0f);
+    v = tdAddVertex (v, x2, y2, 1.0f);
+    v = tdAddVertex (v, x1, y1, 1.0f);
+
+    return v;
+}
+
+static GLfloat *
+tdAddBevelQuad (GLfloat *v,
+		float   x1,
+		float   y1,
+		float   x2,
+		float   y2,
+		float   back1,
+		float   back2)
+{
+    v = tdAddVertex (v, x1, y1, back1);
+    v = tdAddVertex (v, x1, y1, back2);
+    v = tdAddVertex (v, x2, y2, back2);
+    v = tdAddVertex (v, x2, y2, back1);
+
+    return v;
+}
+
+/*
+ * Build the sides and bevels of a window in window space, they only
+ * change with the window size and the bevel options
+ */
+static void
+tdUpdateDepthGeometry (CompWindow *w,
+		       int        ww,
+		       int        wh)
+{
+    CompScreen *s = w->screen;
+    GLfloat    *v;
+    int        bevel, bevelMask = 0;
+
+    TD_WINDOW (w);
+
+    bevel = tdGetBevel (s);
+
+    if (tdGetBevelTopleft (s))
+	bevelMask |= BEVEL_TOPLEFT;
+    if (tdGetBevelTopright (s))
+	bevelMask |= BEVEL_TOPRIGHT;
+    if (tdGetBevelBottomleft (s))
+	bevelMask |= BEVEL_BOTTOMLEFT;
+    if (tdGetBevelBottomright (s))
+	bevelMask |= BEVEL_BOTTOMRIGHT;
+
+    if (tdw->nDepthVertices && tdw->depthWidth == ww &&
+	tdw->depthHeight == wh && tdw->depthBevel == bevel &&
+	tdw->depthBevelMask == bevelMask)
+	return;
+
+    v = tdw->depthVertices;
+
+    /* Top */
+    v = tdAddQuad (v, ww - DOBEVEL (Topleft), 0.01,
+		   DOBEVEL (Topright), 0.01);
+
+    /* Bottom */
+    v = tdAddQuad (v, DOBEVEL (Bottomleft), wh - 0.01,
+		   ww - DOBEVEL (Bottomright), wh - 0.01);
+
+    /* Left */
+    v = tdAddQuad (v, 0.01, DOBEVEL (Topleft),
+		   0.01, wh - DOBEVEL (Bottomleft));
+
+    /* Right */
+    v = tdAddQuad (v, ww - 0.01, wh - DOBEVEL (Topright),
+		   ww - 0.01, DOBEVEL (Bottomright));
+
+    /* Top left bevel */
+    if (bevelMask & BEVEL_TOPLEFT)
+    {
+	v = tdAddBevelQuad (v, bevel / 2.0f, bevel - bevel / 1.2f,
+			    0, bevel, 1.0f, 0.0f);
+	v = tdAddBevelQuad (v, bevel / 2.0f, bevel - bevel / 1.2f,
+			    bevel, 0, 0.0f, 1.0f);
+    }
+
+    /* Bottom left bevel */
+    if (bevelMask & BEVEL_BOTTOMLEFT)
+    {
+	v = tdAddBevelQuad (v, bevel / 2.0f, wh - bevel + bevel / 1.2f,
+			    0, wh - bevel, 0.0f, 1.0f);
+	v = tdAddBevelQuad (v, bevel / 2.0f, wh - bevel + bevel / 1.2f,
+			    bevel, wh, 1.0f, 0.0f);
+    }
+
+    /* Bottom right bevel */
+    if (bevelMask & BEVEL_BOTTOMRIGHT)
+    {
+	v = tdAddBevelQuad (v, ww - bevel / 2.0f, wh - bevel + bevel / 1.2f,
+			    ww - bevel, wh, 0.0f, 1.0f);
+	v = tdAddBevelQuad (v, ww - bevel / 2.0f, wh - bevel + bevel / 1.2f,
+			    ww, wh - bevel, 1.0f, 0.0f);
+    }
+
+    /* Top right bevel */
+    if (bevelMask & BEVEL_TOPRIGHT)
+    {
+	v = tdAddBevelQuad (v, ww - bevel, 0,
+			    ww - bevel / 2.0f, bevel - bevel / 1.2f,
+			    0.0f, 1.0f);
+	v = tdAddBevelQuad (v, ww, bevel,
+			    ww - bevel / 2.0f, bevel - bevel / 1.2f,
+			    1.0f, 0.0f);
+    }
+
+    tdw->nDepthVertices = (v - tdw->depthVertices) / 3;
+    tdw->depthWidth     = ww;
+    tdw->depthHeight    = wh;
+    tdw->depthBevel     = bevel;
+    tdw->depthBevelMask = bevelMask;
+}
+
+/*
+ * The back face transform only differs from the front one by the
+ * scale applied in tdApplyScreenTransform, which is a uniform scale
+ * by ratio about the origin of the screen space transform. In
+ * homogeneous coordinates that is a constant offset of the back
+ * vertices, so a single matrix can move the vertices with z = 1 to
+ * the back face and the GPU applies both transforms.
+ */
+static void
+tdSetDepthTransform (CompScreen          *s,
+		     const CompTransform *screenSpace,
+		     float               ratio)
+{
+    float f = (ratio - 1.0f) / ratio;
+
+    TD_SCREEN (s);
+
+    matrixGetIdentity (&tds->depthTransform);
+
+    tds->depthTransform.m[8]  = f * screenSpace->m[12] / screenSpace->m[0];
+    tds->depthTransform.m[9]  = f * screenSpace->m[13] / screenSpace->m[5];
+    tds->depthTransform.m[10] = f * screenSpace->m[14] / screenSpace->m[10];
+    tds->depthTransform.m[11] = (1.0f / ratio) - 1.0f;
+}
 
 static Bool
 tdPaintWindowWithDepth (CompWindow              *w,
@@ -224,9 +401,8 @@ tdPaintWindowWithDepth (CompWindow              *w,
 {
     Bool           status;
     int            wx, wy, ww, wh;
-    int            bevel, cull, cullInv, temp;
+    int            cull, cullInv, temp;
     CompScreen     *s = w->screen;
-    CompVector     point, tPoint;
     unsigned short *c;
 
     TD_SCREEN (s);
@@ -239,8 +415,6 @@ tdPaintWindowWithDepth (CompWindow              *w,
     ww = w->width + w->input.left + w->input.right;
     wh = w->height + w->input.top + w->input.bottom;
 
-    bevel = tdGetBevel (s);
-
     glGetIntegerv (GL_CULL_FACE_MODE, &cull);
     cullInv = (cull == GL_BACK)? GL_FRONT : GL_BACK;
 
@@ -248,9 +422,13 @@ tdPaintWindowWithDepth (CompWindow              *w,
 	((cs->paintOrder == FTB && tdw->ftb) ||
 	(cs->paintOrder == BTF && !tdw->ftb)))
     {
+	tdUpdateDepthGeometry (w, ww, wh);
+
 	/* Paint window depth. */
 	glPushMatrix ();
-	glLoadIdentity ();
+	glLoadMatrixf (transform->m);
+	glMultMatrixf (tds->depthTransform.m);
+	glTranslatef (wx, wy, 0.0f);
 
 	if (cs->paintOrder == BTF)
 	    glCullFace (cullInv);
@@ -267,85 +445,10 @@ tdPaintWindowWithDepth (CompWindow              *w,
 	temp /= 0xffff;
 	glColor4us (c[0], c[1], c[2], temp);
 
-	point.z = 0.0f;
-	point.w = 1.0f;
-
-	glBegin (GL_QUADS);
-
-	/* Top */
-	ADDQUAD (wx + ww - DOBEVEL (Topleft), wy + 0.01,
-		 wx + DOBEVEL (Topright), wy + 0.01);
-
-	/* Bottom */
-	ADDQUAD (wx + DOBEVEL (Bottomleft), wy + wh - 0.01,
-		 wx + ww - DOBEVEL (Bottomright), wy + wh - 0.01);
-
-	/* Left */
-	ADDQUAD (wx + 0.01, wy + DOBEVEL (Topleft),
-		 wx + 0.01, wy + wh - DOBEVEL (Bottomleft));
-
-	/* Right */
-	ADDQUAD (wx + ww - 0.01, wy + wh - DOBEVEL (Topright),
-		 wx + ww - 0.01, wy + DOBEVEL (Bottomright));
-
-	/* Top left bevel */
-	if (tdGetBevelTopleft (s))
-	{
-	    ADDBEVELQUAD (wx + bevel / 2.0f,
-			  wy + bevel - bevel / 1.2f,
-			  wx, wy + bevel,
-			  &tds->bTransform, transform);
-
-	    ADDBEVELQUAD (wx + bevel / 2.0f,
-			  wy + bevel - bevel / 1.2f,
-			  wx + bevel, wy,
-			  transform, &tds->bTransform);
-
-	}
-
-	/* Bottom left bevel */
-	if (tdGetBevelBottomleft (s))
-	{
-	    ADDBEVELQUAD (wx + bevel / 2.0f,
-			  wy + wh - bevel + bevel / 1.2f,
-			  wx, wy + wh - bevel,
-			  transform, &tds->bTransform);
-
-	    ADDBEVELQUAD (wx + bevel / 2.0f,
-			  wy + wh - bevel + bevel / 1.2f,
-			  wx + bevel, wy + wh,
-			  &tds->bTransform, transform);
-	}
-
-	/* Bottom right bevel */
-	if (tdGetBevelBottomright (s))
-	{
-	    ADDBEVELQUAD (wx + ww - bevel / 2.0f,
-			  wy + wh - bevel + bevel / 1.2f,
-			  wx + ww - bevel, wy + wh,
-			  transform, &tds->bTransform);
-
-	    ADDBEVELQUAD (wx + ww - bevel / 2.0f,
-			  wy + wh - bevel + bevel / 1.2f,
-			  wx + ww, wy + wh - bevel,
-			  &tds->bTransform, transform);
-
-	}
-
-	/* Top right bevel */
-	if (tdGetBevelTopright (s))
-	{
-	    ADDBEVELQUAD (wx + ww - bevel, wy,
-			  wx + ww - bevel / 2.0f,
-			  wy + bevel - bevel / 1.2f,
-			  transform, &tds->bTransform);
-
-	    ADDBEVELQUAD (wx + ww, wy + bevel,
-			  wx + ww - bevel / 2.0f,
-			  wy + bevel - bevel / 1.2f,
-			  &tds->bTransform, transform);
-	}
-	glEnd ();
+	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer (3, GL_FLOAT, 0, tdw->depthVertices);
+	glDrawArrays (GL_QUADS, 0, tdw->nDepthVertices);
+	glEnableClientState (GL_TEXTURE_COORD_ARRAY);
 
 	glColor4usv (defaultColor);
 	glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -440,7 +543,7 @@ tdPaintViewport (CompScreen              *s,
 	CompWindow    *w;
 	tdWindow      *tdw;
 	CompWalker    walk;
-	float         wDepth = 0.0;
+	float         wDepth = 0.0, depthRatio = 1.0;
 	float         pointZ = cs->invert * cs->distance;
 	int           offX, offY;
 	unsigned int  newMask;
@@ -511,6 +614,9 @@ tdPaintViewport (CompScreen              *s,
 
 		if (wDepth != 0.0)
 		{
+		    depthRatio = (tds->currentScale + wDepth) /
+				 tds->currentScale;
+
 		    tds->currentScale += wDepth;
 		    tds->bTransform   = *transform;
 		    (*s->applyScreenTransform) (s, sAttrib, output,
@@ -536,6 +642,8 @@ tdPaintViewport (CompScreen              *s,
 		    matrixMultiply (&mTransform, &mTransform,
 				    &screenSpaceOffset);
 
+		    tdSetDepthTransform (s, &screenSpaceOffset, depthRatio);
+
 		    newMask |= PAINT_WINDOW_WITH_OFFSET_MASK;
 		}
 		else
@@ -544,6 +652,8 @@ tdPaintViewport (CompScreen              *s,
 			matrixMultiply (&tds->bTransform, &tds->bTransform,
 					&screenSpace);
 		    matrixMultiply (&mTransform, &mTransform, &screenSpace);
+
+		    tdSetDepthTransform (s, &screenSpace, depthRatio);
 		}
 
 		glLoadMatrixf (mTransform.m);
@@ -673,6 +783,101 @@ tdDonePaintScreen (CompScreen *s)
     WRAP (tds, s, donePaintScreen, tdDonePaintScreen);
 }
 
+static void
+tdHandleEvent (CompDisplay *d,
+	       XEvent      *event)
+{
+    CompScreen *s;
+
+    TD_DISPLAY (d);
+
+    UNWRAP (tdd, d, handleEvent);
+    (*d->handleEvent) (d, event);
+    WRAP (tdd, d, handleEvent, tdHandleEvent);
+
+    /* stacking order and mapping changes are only known after core
+       handled the event */
+    switch (event->type) {
+    case MapNotify:
+    case UnmapNotify:
+    case ConfigureNotify:
+    case DestroyNotify:
+    case ReparentNotify:
+	for (s = d->screens; s; s = s->next)
+	{
+	    TD_SCREEN (s);
+	    tds->depthDirty = TRUE;
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+static void
+tdMatchPropertyChanged (CompDisplay *d,
+			CompWindow  *w)
+{
+    TD_DISPLAY (d);
+    TD_SCREEN (w->screen);
+
+    tds->depthDirty = TRUE;
+
+    UNWRAP (tdd, d, matchPropertyChanged);
+    (*d->matchPropertyChanged) (d, w);
+    WRAP (tdd, d, matchPropertyChanged, tdMatchPropertyChanged);
+}
+
+static void
+tdMatchExpHandlerChanged (CompDisplay *d)
+{
+    CompScreen *s;
+
+    TD_DISPLAY (d);
+
+    UNWRAP (tdd, d, matchExpHandlerChanged);
+    (*d->matchExpHandlerChanged) (d);
+    WRAP (tdd, d, matchExpHandlerChanged, tdMatchExpHandlerChanged);
+
+    for (s = d->screens; s; s = s->next)
+    {
+	TD_SCREEN (s);
+	tds->depthDirty = TRUE;
+    }
+}
+
+static void
+tdWindowStateChangeNotify (CompWindow   *w,
+			   unsigned int lastState)
+{
+    CompScreen *s = w->screen;
+
+    TD_SCREEN (s);
+
+    tds->depthDirty = TRUE;
+
+    UNWRAP (tds, s, windowStateChangeNotify);
+    (*s->windowStateChangeNotify) (w, lastState);
+    WRAP (tds, s, windowStateChangeNotify, tdWindowStateChangeNotify);
+}
+
+static void
+tdScreenOptionChanged (CompScreen      *s,
+		       CompOption      *opt,
+		       TdScreenOptions num)
+{
+    TD_SCREEN (s);
+
+    switch (num) {
+    case TdScreenOptionWindowMatch:
+	tds->depthDirty = TRUE;
+	damageScreen (s);
+	break;
+    default:
+	break;
+    }
+}
+
 static Bool
 tdInitDisplay (CompPlugin  *p,
 	       CompDisplay *d)
@@ -699,6 +904,10 @@ tdInitDisplay (CompPlugin  *p,
 	return FALSE;
     }
 
+    WRAP (tdd, d, handleEvent, tdHandleEvent);
+    WRAP (tdd, d, matchPropertyChanged, tdMatchPropertyChanged);
+    WRAP (tdd, d, matchExpHandlerChanged, tdMatchExpHandlerChanged);
+
     d->base.privates[displayPrivateIndex].ptr = tdd;
 
     return TRUE;
@@ -710,6 +919,10 @@ tdFiniDisplay (CompPlugin  *p,
 {
     TD_DISPLAY (d);
 
+    UNWRAP (tdd, d, handleEvent);
+    UNWRAP (tdd, d, matchPropertyChanged);
+    UNWRAP (tdd, d, matchExpHandlerChanged);
+
     freeScreenPrivateIndex (d, tdd->screenPrivateIndex);
 
     free (tdd);
@@ -740,9 +953,13 @@ tdInitScreen (CompPlugin *p,
 
     tds->active     = FALSE;
     tds->painting3D = FALSE;
+    tds->maxDepth   = 0;
+    tds->depthDirty = TRUE;
 
     s->base.privates[tdd->screenPrivateIndex].ptr = tds;
 
+    tdSetWindowMatchNotify (s, tdScreenOptionChanged);
+
     WRAP (tds, s, paintWindow, tdPaintWindow);
     WRAP (tds, s, paintOutput, tdPaintOutput);
     WRAP (tds, s, donePaintScreen, tdDonePaintScreen);
@@ -750,6 +967,7 @@ tdInitScreen (CompPlugin *p,
     WRAP (tds, s, applyScreenTransform, tdApplyScreenTransform);
     WRAP (tds, cs, paintViewport, tdPaintViewport);
     WRAP (tds, cs, shouldPaintViewport, tdShouldPaintViewport);
+    WRAP (tds, s, windowStateChangeNotify, tdWindowStateChangeNotify);
 
     return TRUE;
 }
@@ -768,6 +986,7 @@ tdFiniScreen (CompPlugin *p,
     UNWRAP (tds, s, applyScreenTransform);
     UNWRAP (tds, cs, paintViewport);
     UNWRAP (tds, cs, shouldPaintViewport);
+    UNWRAP (tds, s, windowStateChangeNotify);
 
     freeWindowPrivateIndex (s, tds->windowPrivateIndex);
 	
@@ -789,8 +1008,12 @@ tdInitWindow (CompPlugin *p,
     tdw->is3D  = FALSE;
     tdw->depth = 0.0f;
 
+    tdw->nDepthVertices = 0;
+
     w->base.privates[tds->windowPrivateIndex].ptr = tdw;
 
+    tds->depthDirty = TRUE;
+
     return TRUE;
 }
 
@@ -798,8 +1021,11 @@ static void
 tdFiniWindow (CompPlugin *p,
 	      CompWindow *w)
 {
+    TD_SCREEN (w->screen);
     TD_WINDOW (w);
 
+    tds->depthDirty = TRUE;
+
     free (tdw);
 }
 
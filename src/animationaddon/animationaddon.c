@@ -205,9 +205,69 @@ AnimAddonFunctions animAddonFunctions =
     .freePolygonObjects			= freePolygonObjects,
     .tessellateIntoRectangles		= tessellateIntoRectangles,
     .tessellateIntoHexagons		= tessellateIntoHexagons,
-    .tessellateIntoGlass                = tessellateIntoGlass
+    .tessellateIntoGlass                = tessellateIntoGlass,
+
+    .polygonsAnimStepAll		= polygonsAnimStepAll,
+    .drawAllParticleSystems		= drawAllParticleSystems,
+    .preallocEngineData			= preallocEngineData,
+    .allocParticleSystems		= allocParticleSystems,
+    .reinitParticles			= reinitParticles
 };
 
+static Bool
+animAddonPaintOutput (CompScreen              *s,
+		      const ScreenPaintAttrib *sAttrib,
+		      const CompTransform     *transform,
+		      Region                  region,
+		      CompOutput              *output,
+		      unsigned int            mask)
+{
+    Bool status;
+    Bool batch;
+
+    ANIMADDON_SCREEN (s);
+
+    // Particles are batched in screen space for the whole output,
+    // which is only possible when the output itself is not transformed
+    batch = !as->batchParticles && !(mask & PAINT_SCREEN_TRANSFORMED_MASK);
+    if (batch)
+	particlesBeginBatch (s, transform, output);
+
+    UNWRAP (as, s, paintOutput);
+    status = (*s->paintOutput) (s, sAttrib, transform, region, output, mask);
+    WRAP (as, s, paintOutput, animAddonPaintOutput);
+
+    if (batch)
+	particlesEndBatch (s);
+
+    return status;
+}
+
+static Bool
+animAddonPaintWindow (CompWindow              *w,
+		      const WindowPaintAttrib *attrib,
+		      const CompTransform     *transform,
+		      Region                  region,
+		      unsigned int            mask)
+{
+    Bool status;
+    CompWindow *oldBatchWindow;
+    CompScreen *s = w->screen;
+
+    ANIMADDON_SCREEN (s);
+
+    oldBatchWindow = as->batchWindow;
+    as->batchWindow = particlesPrePaintWindow (w, transform, mask) ? w : NULL;
+
+    UNWRAP (as, s, paintWindow);
+    status = (*s->paintWindow) (w, attrib, transform, region, mask);
+    WRAP (as, s, paintWindow, animAddonPaintWindow);
+
+    as->batchWindow = oldBatchWindow;
+
+    return status;
+}
+
 static const CompMetadataOptionInfo animAddonScreenOptionInfo[] = {
     // Misc. settings
     { "time_step_intense", "int", "<min>1</min>", 0, 0 },
@@ -537,12 +597,17 @@ static Bool animInitScreen(CompPlugin * p, CompScreen * s)
 
     as->output = &s->fullscreenOutput;
 
+    glStateInvalidate (&as->glState);
+
     animExtensionPluginInfo.effectOptions = &as->opt[NUM_NONEFFECT_OPTIONS];
 
     ad->animBaseFunctions->addExtension (s, &animExtensionPluginInfo);
 
     s->base.privates[ad->screenPrivateIndex].ptr = as;
 
+    WRAP (as, s, paintOutput, animAddonPaintOutput);
+    WRAP (as, s, paintWindow, animAddonPaintWindow);
+
     return TRUE;
 }
 
@@ -553,6 +618,13 @@ static void animFiniScreen(CompPlugin * p, CompScreen * s)
 
     ad->animBaseFunctions->removeExtension (s, &animExtensionPluginInfo);
 
+    UNWRAP (as, s, paintOutput);
+    UNWRAP (as, s, paintWindow);
+
+    particlesFiniBatches (s);
+    particlesFiniPool (s);
+    freeGlassTemplates (s);
+
     freeWindowPrivateIndex(s, as->windowPrivateIndex);
 
     compFiniScreenOptions (s, as->opt, ANIMADDON_SCREEN_OPTION_NUM);
@@ -6,6 +6,7 @@
 #include <compiz-core.h>
 #include <compiz-animation.h>
 #include "compiz-animationaddon.h"
+#include "compiz-glstate.h"
 
 extern int animDisplayPrivateIndex;
 extern CompMetadata animMetadata;
@@ -130,12 +131,68 @@ typedef struct _AnimAddonDisplay
     CompOption opt[ANIMADDON_DISPLAY_OPTION_NUM];
 } AnimAddonDisplay;
 
+// Particles of all windows that share a texture and blend mode,
+// queued in screen space to be drawn together
+typedef struct _ParticleBatch
+{
+    GLuint tex;
+    GLuint blendMode;
+
+    int nQuads;			// # of queued particle quads
+    int quadCapacity;
+    GLfloat *vertices;
+    GLfloat *colors;
+
+    int nDarkenQuads;		// # of queued background darkening quads
+    int darkenQuadCapacity;
+    GLfloat *darkenVertices;
+    GLfloat *darkenColors;
+} ParticleBatch;
+
+// Normalized glass fracture pattern, see tessellateIntoGlass
+typedef struct _GlassTemplate
+{
+    int spokeMultiplier;	// 0 if this cache slot is unused
+    GLfloat *spokeEnds;		// Spoke end points in [-1, 1] window coords
+    GLfloat *spokeJitter;	// Max. random shift of each spoke end point
+} GlassTemplate;
+
+#define GLASS_TEMPLATE_CACHE_SIZE 4
+
 typedef struct _AnimAddonScreen
 {
     int windowPrivateIndex;
 
     CompOutput *output;
 
+    PaintOutputProc paintOutput;
+    PaintWindowProc paintWindow;
+
+    GLuint fireTex;		// Fire particle texture shared by all windows
+
+    // for cross-window particle batching
+    Bool batchParticles;	// whether particles can be batched in this paint
+    CompTransform batchTransform;
+    CompWindow *batchWindow;	// window whose particles are to be queued
+    Bool batchPending;		// whether any particles are queued
+    Box batchBox;		// bounding box of queued particles
+    ParticleBatch *batches;
+    int nBatches;
+    GLfloat *batchCoords;	// texture coords shared by all batches
+    int batchCoordsCount;
+
+    // Pre-allocated particle systems (see preallocEngineData)
+    ParticleSystem **psPool;
+    int psPoolSize;		// # of arrays in the pool
+    int psPoolCapacity;		// # of arrays the pool keeps at most
+    int psPoolNumPs;		// # of particle systems in each array
+
+    // for glass tessellation
+    GlassTemplate glassTemplates[GLASS_TEMPLATE_CACHE_SIZE];
+    int nextGlassTemplate;	// cache slot to be replaced next
+
+    CompGLState glState;	// shadowed GL state for polygon drawing
+
     CompOption opt[ANIMADDON_SCREEN_OPTION_NUM];
 } AnimAddonScreen;
 
@@ -275,6 +332,10 @@ void
 initParticles (int numParticles,
 	       ParticleSystem * ps);
 
+void
+reinitParticles (int numParticles,
+		 ParticleSystem * ps);
+
 void
 drawParticles (CompWindow * w,
 	       ParticleSystem * ps);
@@ -301,6 +362,46 @@ Bool
 particlesPrePrepPaintScreen (CompWindow * w,
 			     int msSinceLastPaint);
 
+GLuint
+particlesGetFireTexture (CompScreen *s);
+
+void
+particlesBeginBatch (CompScreen *s,
+		     const CompTransform *transform,
+		     CompOutput *output);
+
+void
+particlesEndBatch (CompScreen *s);
+
+void
+particlesFlushBatches (CompScreen *s);
+
+Bool
+particlesPrePaintWindow (CompWindow *w,
+			 const CompTransform *transform,
+			 unsigned int mask);
+
+void
+particlesFiniBatches (CompScreen *s);
+
+ParticleSystem *
+allocParticleSystems (CompWindow *w,
+		      int numPs);
+
+Bool
+preallocEngineData (CompScreen *s,
+		    int nWindows,
+		    int numPs,
+		    int numParticles);
+
+void
+particlesFiniPool (CompScreen *s);
+
+void
+drawAllParticleSystems (CompScreen *s,
+			const CompTransform *transform,
+			CompOutput *output);
+
 /* polygon.c */
 
 Bool
@@ -321,6 +422,9 @@ tessellateIntoGlass (CompWindow * w,
 		     int tier_num,
 		     float thickness);
 
+void
+freeGlassTemplates (CompScreen *s);
+
 void
 polygonsStoreClips (CompWindow * w,
 		    int nClip, BoxPtr pClip,
@@ -360,6 +464,11 @@ void
 polygonsAnimStep (CompWindow *w,
 		  float time);
 
+int
+polygonsAnimStepAll (CompScreen *s,
+		     AnimEffect effect,
+		     float time);
+
 Bool
 polygonsPrePreparePaintScreen (CompWindow *w,
 			       int msSinceLastPaint);
@@ -35,7 +35,6 @@
  */
 
 #include "animationaddon.h"
-#include "animation_tex.h"
 
 // =====================  Effect: Beam Up  =========================
 
@@ -47,35 +46,20 @@ fxBeamUpInit (CompWindow * w)
 
     ad->animBaseFunctions->defaultAnimInit (w);
 
-    if (!aw->eng.numPs)
+    if (!allocParticleSystems (w, 1))
     {
-	aw->eng.ps = calloc(1, sizeof(ParticleSystem));
-	if (!aw->eng.ps)
-	{
-	    ad->animBaseFunctions->postAnimationCleanup (w);
-	    return FALSE;
-	}
-
-	aw->eng.numPs = 1;
+	ad->animBaseFunctions->postAnimationCleanup (w);
+	return FALSE;
     }
 
     int particles = WIN_W(w);
 
-    initParticles(particles, &aw->eng.ps[0]);
+    reinitParticles(particles, &aw->eng.ps[0]);
     aw->eng.ps[0].slowdown = animGetF (w, ANIMADDON_SCREEN_OPTION_BEAMUP_SLOWDOWN);
     aw->eng.ps[0].darken = 0.5;
     aw->eng.ps[0].blendMode = GL_ONE;
 
-    if (!aw->eng.ps[0].tex)
-	glGenTextures(1, &aw->eng.ps[0].tex);
-    glBindTexture(GL_TEXTURE_2D, aw->eng.ps[0].tex);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 32, 0,
-		 GL_RGBA, GL_UNSIGNED_BYTE, fireTex);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    aw->eng.ps[0].tex = particlesGetFireTexture (w->screen);
 
     return TRUE;
 }
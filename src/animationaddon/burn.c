@@ -35,7 +35,6 @@
  */
 
 #include "animationaddon.h"
-#include "animation_tex.h"
 
 // =====================  Effect: Burn  =========================
 
@@ -45,21 +44,15 @@ fxBurnInit (CompWindow * w)
     ANIMADDON_DISPLAY (w->screen->display);
     ANIMADDON_WINDOW (w);
 
-    if (!aw->eng.numPs)
+    if (!allocParticleSystems (w, 2))
     {
-	aw->eng.ps = calloc(2, sizeof(ParticleSystem));
-	if (!aw->eng.ps)
-	{
-	    ad->animBaseFunctions->postAnimationCleanup (w);
-	    return FALSE;
-	}
-
-	aw->eng.numPs = 2;
+	ad->animBaseFunctions->postAnimationCleanup (w);
+	return FALSE;
     }
-    initParticles (animGetI (w, ANIMADDON_SCREEN_OPTION_FIRE_PARTICLES)/
-		   10, &aw->eng.ps[0]);
-    initParticles (animGetI (w, ANIMADDON_SCREEN_OPTION_FIRE_PARTICLES),
-		   &aw->eng.ps[1]);
+    reinitParticles (animGetI (w, ANIMADDON_SCREEN_OPTION_FIRE_PARTICLES)/
+		     10, &aw->eng.ps[0]);
+    reinitParticles (animGetI (w, ANIMADDON_SCREEN_OPTION_FIRE_PARTICLES),
+		     &aw->eng.ps[1]);
     aw->eng.ps[1].slowdown = animGetF (w, ANIMADDON_SCREEN_OPTION_FIRE_SLOWDOWN);
     aw->eng.ps[1].darken = 0.5;
     aw->eng.ps[1].blendMode = GL_ONE;
@@ -69,27 +62,9 @@ fxBurnInit (CompWindow * w)
     aw->eng.ps[0].darken = 0.0;
     aw->eng.ps[0].blendMode = GL_ONE_MINUS_SRC_ALPHA;
 
-    if (!aw->eng.ps[0].tex)
-	glGenTextures(1, &aw->eng.ps[0].tex);
-    glBindTexture(GL_TEXTURE_2D, aw->eng.ps[0].tex);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 32, 0,
-		 GL_RGBA, GL_UNSIGNED_BYTE, fireTex);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    if (!aw->eng.ps[1].tex)
-	glGenTextures(1, &aw->eng.ps[1].tex);
-    glBindTexture(GL_TEXTURE_2D, aw->eng.ps[1].tex);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    aw->eng.ps[0].tex = particlesGetFireTexture (w->screen);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 32, 0,
-		 GL_RGBA, GL_UNSIGNED_BYTE, fireTex);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    aw->eng.ps[1].tex = particlesGetFireTexture (w->screen);
 
     aw->animFireDirection = ad->animBaseFunctions->getActualAnimDirection
 	(w, animGetI (w, ANIMADDON_SCREEN_OPTION_FIRE_DIRECTION), FALSE);
@@ -34,17 +34,17 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <limits.h>
+
 #include "animationaddon.h"
+#include "animation_tex.h"
 
 void initParticles(int numParticles, ParticleSystem * ps)
 {
     if (ps->particles)
 	free(ps->particles);
-    ps->particles = (Particle *) malloc (numParticles * sizeof (Particle));
-    ps->tex = 0;
-    ps->numParticles = numParticles;
-    ps->slowdown = 1;
-    ps->active = FALSE;
+    ps->particles = NULL;
+    ps->particles_capacity = 0;
 
     // Initialize cache
     ps->vertices_cache = NULL;
@@ -56,78 +56,46 @@ void initParticles(int numParticles, ParticleSystem * ps)
     ps->coords_cache_count = 0;
     ps->dcolors_cache_count = 0;
 
-    Particle *part = ps->particles;
-    int i;
-    for (i = 0; i < numParticles; i++, part++)
-	part->life = 0.0f;
+    reinitParticles (numParticles, ps);
 }
 
-void drawParticles (CompWindow * w, ParticleSystem * ps)
+// Like initParticles, but keeps the particle and vertex buffers of a
+// previous (or pre-allocated) run if they are big enough. ps has to be
+// zeroed, finished with finiParticles or set up before.
+void reinitParticles(int numParticles, ParticleSystem * ps)
 {
-    CompScreen *s = w->screen;
-
-    glPushMatrix();
-    if (w)
-	glTranslated(WIN_X(w) - ps->x, WIN_Y(w) - ps->y, 0);
-
-    glEnable(GL_BLEND);
-    if (ps->tex)
-    {
-	glBindTexture(GL_TEXTURE_2D, ps->tex);
-	glEnable(GL_TEXTURE_2D);
-    }
-    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-
-    /* Check that the cache is big enough */
-    if (ps->numParticles > ps->vertex_cache_count)
+    if (!ps->particles || ps->particles_capacity < numParticles)
     {
-	ps->vertices_cache =
-	    realloc(ps->vertices_cache,
-		    ps->numParticles * 4 * 3 * sizeof(GLfloat));
-	ps->vertex_cache_count = ps->numParticles;
-    }
-
-    if (ps->numParticles > ps->coords_cache_count)
-    {
-	ps->coords_cache =
-	    realloc(ps->coords_cache,
-		    ps->numParticles * 4 * 2 * sizeof(GLfloat));
-	ps->coords_cache_count = ps->numParticles;
-    }
-
-    if (ps->numParticles > ps->color_cache_count)
-    {
-	ps->colors_cache =
-	    realloc(ps->colors_cache,
-		    ps->numParticles * 4 * 4 * sizeof(GLfloat));
-	ps->color_cache_count = ps->numParticles;
-    }
-
-    if (ps->darken > 0)
-    {
-	if (ps->dcolors_cache_count < ps->numParticles)
-	{
-	    ps->dcolors_cache =
-		realloc(ps->dcolors_cache,
-			ps->numParticles * 4 * 4 * sizeof(GLfloat));
-	    ps->dcolors_cache_count = ps->numParticles;
-	}
+	if (ps->particles)
+	    free(ps->particles);
+	ps->particles = (Particle *) malloc (numParticles * sizeof (Particle));
+	ps->particles_capacity = numParticles;
     }
+    ps->tex = 0;
+    ps->numParticles = numParticles;
+    ps->slowdown = 1;
+    ps->active = FALSE;
 
-    GLfloat *dcolors = ps->dcolors_cache;
-    GLfloat *vertices = ps->vertices_cache;
-    GLfloat *coords = ps->coords_cache;
-    GLfloat *colors = ps->colors_cache;
+    Particle *part = ps->particles;
+    int i;
+    for (i = 0; i < numParticles; i++, part++)
+	part->life = 0.0f;
+}
 
-    int cornersSize = sizeof (GLfloat) * 8;
+// Fills the quad arrays for the live particles of ps, offset by (dx, dy).
+// dcolors may be NULL to skip the darkening colors, bounds may be NULL.
+// Returns the number of quads written.
+static int
+particlesGenQuads (ParticleSystem *ps,
+		   float dx,
+		   float dy,
+		   GLfloat *vertices,
+		   GLfloat *colors,
+		   GLfloat *dcolors,
+		   Box *bounds)
+{
     int colorSize = sizeof (GLfloat) * 4;
-
-    GLfloat cornerCoords[8] = {0.0, 0.0,
-			       0.0, 1.0,
-			       1.0, 1.0,
-			       1.0, 0.0};
-
-    int numActive = 0;
+    int numQuads = 0;
 
     Particle *part = ps->particles;
     int i;
@@ -135,7 +103,7 @@ void drawParticles (CompWindow * w, ParticleSystem * ps)
     {
 	if (part->life > 0.0f)
 	{
-	    numActive += 4;
+	    numQuads++;
 
 	    float w = part->width / 2;
 	    float h = part->height / 2;
@@ -143,28 +111,29 @@ void drawParticles (CompWindow * w, ParticleSystem * ps)
 	    w += (w * part->w_mod) * part->life;
 	    h += (h * part->h_mod) * part->life;
 
-	    vertices[0] = part->x - w;
-	    vertices[1] = part->y - h;
+	    float x1 = part->x + dx - w;
+	    float x2 = part->x + dx + w;
+	    float y1 = part->y + dy - h;
+	    float y2 = part->y + dy + h;
+
+	    vertices[0] = x1;
+	    vertices[1] = y1;
 	    vertices[2] = part->z;
 
-	    vertices[3] = part->x - w;
-	    vertices[4] = part->y + h;
+	    vertices[3] = x1;
+	    vertices[4] = y2;
 	    vertices[5] = part->z;
 
-	    vertices[6] = part->x + w;
-	    vertices[7] = part->y + h;
+	    vertices[6] = x2;
+	    vertices[7] = y2;
 	    vertices[8] = part->z;
 
-	    vertices[9] = part->x + w;
-	    vertices[10] = part->y - h;
+	    vertices[9] = x2;
+	    vertices[10] = y1;
 	    vertices[11] = part->z;
 
 	    vertices += 12;
 
-	    memcpy (coords, cornerCoords, cornersSize);
-
-	    coords += 8;
-
 	    colors[0] = part->r;
 	    colors[1] = part->g;
 	    colors[2] = part->b;
@@ -175,7 +144,7 @@ void drawParticles (CompWindow * w, ParticleSystem * ps)
 
 	    colors += 16;
 
-	    if (ps->darken > 0)
+	    if (dcolors)
 	    {
 		dcolors[0] = part->r;
 		dcolors[1] = part->g;
@@ -187,9 +156,103 @@ void drawParticles (CompWindow * w, ParticleSystem * ps)
 
 		dcolors += 16;
 	    }
+
+	    if (bounds)
+	    {
+		bounds->x1 = MIN (bounds->x1, floor (x1));
+		bounds->y1 = MIN (bounds->y1, floor (y1));
+		bounds->x2 = MAX (bounds->x2, ceil (x2));
+		bounds->y2 = MAX (bounds->y2, ceil (y2));
+	    }
 	}
     }
 
+    return numQuads;
+}
+
+// Makes sure coords holds the (constant) texture coordinates
+// for at least numQuads particle quads
+static void
+particlesEnsureCoords (GLfloat **coords,
+		       int *coordsCount,
+		       int numQuads)
+{
+    static const GLfloat cornerCoords[8] = {0.0, 0.0,
+					    0.0, 1.0,
+					    1.0, 1.0,
+					    1.0, 0.0};
+    int i;
+
+    if (numQuads <= *coordsCount)
+	return;
+
+    *coords = realloc (*coords, numQuads * 4 * 2 * sizeof (GLfloat));
+    for (i = *coordsCount; i < numQuads; i++)
+	memcpy (*coords + i * 8, cornerCoords, sizeof (cornerCoords));
+    *coordsCount = numQuads;
+}
+
+// Grows the vertex caches of ps to its particle count,
+// including the darkening colors if darken is set
+static void
+particlesEnsureCaches (ParticleSystem * ps, Bool darken)
+{
+    if (ps->numParticles > ps->vertex_cache_count)
+    {
+	ps->vertices_cache =
+	    realloc(ps->vertices_cache,
+		    ps->numParticles * 4 * 3 * sizeof(GLfloat));
+	ps->vertex_cache_count = ps->numParticles;
+    }
+
+    particlesEnsureCoords (&ps->coords_cache, &ps->coords_cache_count,
+			   ps->numParticles);
+
+    if (ps->numParticles > ps->color_cache_count)
+    {
+	ps->colors_cache =
+	    realloc(ps->colors_cache,
+		    ps->numParticles * 4 * 4 * sizeof(GLfloat));
+	ps->color_cache_count = ps->numParticles;
+    }
+
+    if (darken)
+    {
+	if (ps->dcolors_cache_count < ps->numParticles)
+	{
+	    ps->dcolors_cache =
+		realloc(ps->dcolors_cache,
+			ps->numParticles * 4 * 4 * sizeof(GLfloat));
+	    ps->dcolors_cache_count = ps->numParticles;
+	}
+    }
+}
+
+void drawParticles (CompWindow * w, ParticleSystem * ps)
+{
+    CompScreen *s = w->screen;
+
+    glPushMatrix();
+    if (w)
+	glTranslated(WIN_X(w) - ps->x, WIN_Y(w) - ps->y, 0);
+
+    glEnable(GL_BLEND);
+    if (ps->tex)
+    {
+	glBindTexture(GL_TEXTURE_2D, ps->tex);
+	glEnable(GL_TEXTURE_2D);
+    }
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    particlesEnsureCaches (ps, ps->darken > 0);
+
+    int numActive = 4 * particlesGenQuads (ps, 0, 0,
+					   ps->vertices_cache,
+					   ps->colors_cache,
+					   ps->darken > 0 ?
+					   ps->dcolors_cache : NULL,
+					   NULL);
+
     glEnableClientState(GL_COLOR_ARRAY);
 
     glTexCoordPointer(2, GL_FLOAT, 2 * sizeof(GLfloat), ps->coords_cache);
@@ -219,17 +282,338 @@ void drawParticles (CompWindow * w, ParticleSystem * ps)
     glDisable(GL_BLEND);
 }
 
+// =====================  Cross-window particle batching  =================
+//
+// While an untransformed output is painted, the particle systems of all
+// animating windows are not drawn right after their window, but appended
+// (already translated to screen space) to one batch per texture and blend
+// mode. The batches are drawn with a single state setup after the windows
+// have been painted, or earlier, right before a window that overlaps the
+// queued particles is painted, so stacking order is kept where it matters.
+
+static ParticleBatch *
+particlesGetBatch (AnimAddonScreen *as,
+		   GLuint tex,
+		   GLuint blendMode)
+{
+    ParticleBatch *batch;
+    int i;
+
+    for (i = 0; i < as->nBatches; i++)
+    {
+	batch = &as->batches[i];
+	if (batch->tex == tex && batch->blendMode == blendMode)
+	    return batch;
+    }
+
+    batch = realloc (as->batches, (as->nBatches + 1) * sizeof (ParticleBatch));
+    if (!batch)
+	return NULL;
+
+    as->batches = batch;
+    batch = &as->batches[as->nBatches++];
+    memset (batch, 0, sizeof (ParticleBatch));
+    batch->tex = tex;
+    batch->blendMode = blendMode;
+
+    return batch;
+}
+
+static Bool
+particlesEnsureBatchSpace (GLfloat **vertices,
+			   GLfloat **colors,
+			   int *capacity,
+			   int numQuads)
+{
+    GLfloat *newVertices, *newColors;
+
+    if (numQuads <= *capacity)
+	return TRUE;
+
+    numQuads = MAX (numQuads, *capacity * 2);
+
+    newVertices = realloc (*vertices, numQuads * 4 * 3 * sizeof (GLfloat));
+    if (!newVertices)
+	return FALSE;
+    *vertices = newVertices;
+
+    newColors = realloc (*colors, numQuads * 4 * 4 * sizeof (GLfloat));
+    if (!newColors)
+	return FALSE;
+    *colors = newColors;
+
+    *capacity = numQuads;
+
+    return TRUE;
+}
+
+// Appends the particles of ps to the screen batch for its texture and
+// blend mode. Returns FALSE if they could not be queued.
+static Bool
+particlesQueue (CompWindow * w, ParticleSystem * ps)
+{
+    ParticleBatch *batch;
+    Box bounds;
+    int nQuads;
+    Bool darken = (ps->darken > 0);
+
+    ANIMADDON_SCREEN (w->screen);
+
+    batch = particlesGetBatch (as, ps->tex, ps->blendMode);
+    if (!batch)
+	return FALSE;
+
+    if (!particlesEnsureBatchSpace (&batch->vertices, &batch->colors,
+				    &batch->quadCapacity,
+				    batch->nQuads + ps->numParticles))
+	return FALSE;
+
+    if (darken &&
+	!particlesEnsureBatchSpace (&batch->darkenVertices,
+				    &batch->darkenColors,
+				    &batch->darkenQuadCapacity,
+				    batch->nDarkenQuads + ps->numParticles))
+	return FALSE;
+
+    bounds.x1 = bounds.y1 = SHRT_MAX;
+    bounds.x2 = bounds.y2 = SHRT_MIN;
+
+    nQuads = particlesGenQuads (ps, WIN_X (w) - ps->x, WIN_Y (w) - ps->y,
+				batch->vertices + batch->nQuads * 12,
+				batch->colors + batch->nQuads * 16,
+				darken ?
+				batch->darkenColors +
+				batch->nDarkenQuads * 16 : NULL,
+				&bounds);
+    if (!nQuads)
+	return TRUE;
+
+    if (darken)
+    {
+	memcpy (batch->darkenVertices + batch->nDarkenQuads * 12,
+		batch->vertices + batch->nQuads * 12,
+		nQuads * 12 * sizeof (GLfloat));
+	batch->nDarkenQuads += nQuads;
+    }
+    batch->nQuads += nQuads;
+
+    if (as->batchPending)
+    {
+	as->batchBox.x1 = MIN (as->batchBox.x1, bounds.x1);
+	as->batchBox.y1 = MIN (as->batchBox.y1, bounds.y1);
+	as->batchBox.x2 = MAX (as->batchBox.x2, bounds.x2);
+	as->batchBox.y2 = MAX (as->batchBox.y2, bounds.y2);
+    }
+    else
+    {
+	as->batchBox = bounds;
+	as->batchPending = TRUE;
+    }
+
+    return TRUE;
+}
+
+void
+particlesFlushBatches (CompScreen *s)
+{
+    int i, maxQuads = 0;
+
+    ANIMADDON_SCREEN (s);
+
+    if (!as->batchPending)
+	return;
+
+    as->batchPending = FALSE;
+
+    for (i = 0; i < as->nBatches; i++)
+	maxQuads = MAX (maxQuads, MAX (as->batches[i].nQuads,
+				       as->batches[i].nDarkenQuads));
+
+    particlesEnsureCoords (&as->batchCoords, &as->batchCoordsCount, maxQuads);
+
+    glPushMatrix ();
+    glLoadMatrixf (as->batchTransform.m);
+
+    glEnable (GL_BLEND);
+    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glEnableClientState (GL_COLOR_ARRAY);
+
+    glTexCoordPointer (2, GL_FLOAT, 2 * sizeof (GLfloat), as->batchCoords);
+
+    for (i = 0; i < as->nBatches; i++)
+    {
+	ParticleBatch *batch = &as->batches[i];
+
+	if (!batch->nQuads)
+	    continue;
+
+	if (batch->tex)
+	{
+	    glBindTexture (GL_TEXTURE_2D, batch->tex);
+	    glEnable (GL_TEXTURE_2D);
+	}
+	else
+	    glDisable (GL_TEXTURE_2D);
+
+	// darken the background
+	if (batch->nDarkenQuads)
+	{
+	    glBlendFunc (GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	    glVertexPointer (3, GL_FLOAT, 3 * sizeof (GLfloat),
+			     batch->darkenVertices);
+	    glColorPointer (4, GL_FLOAT, 4 * sizeof (GLfloat),
+			    batch->darkenColors);
+	    glDrawArrays (GL_QUADS, 0, batch->nDarkenQuads * 4);
+	}
+
+	// draw particles
+	glBlendFunc (GL_SRC_ALPHA, batch->blendMode);
+	glVertexPointer (3, GL_FLOAT, 3 * sizeof (GLfloat), batch->vertices);
+	glColorPointer (4, GL_FLOAT, 4 * sizeof (GLfloat), batch->colors);
+	glDrawArrays (GL_QUADS, 0, batch->nQuads * 4);
+
+	batch->nQuads = 0;
+	batch->nDarkenQuads = 0;
+    }
+
+    glDisableClientState (GL_COLOR_ARRAY);
+
+    glPopMatrix ();
+    glColor4usv (defaultColor);
+    screenTexEnvMode (s, GL_REPLACE);
+    glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable (GL_TEXTURE_2D);
+    glDisable (GL_BLEND);
+}
+
+void
+particlesBeginBatch (CompScreen *s,
+		     const CompTransform *transform,
+		     CompOutput *output)
+{
+    ANIMADDON_SCREEN (s);
+
+    as->batchTransform = *transform;
+    transformToScreenSpace (s, output, -DEFAULT_Z_CAMERA, &as->batchTransform);
+
+    as->batchParticles = TRUE;
+}
+
+void
+particlesEndBatch (CompScreen *s)
+{
+    ANIMADDON_SCREEN (s);
+
+    particlesFlushBatches (s);
+
+    as->batchParticles = FALSE;
+}
+
+// Called before w is painted. Flushes queued particles that w would
+// otherwise cover and returns whether the particles of w can be queued
+// instead of being drawn right away.
+Bool
+particlesPrePaintWindow (CompWindow *w,
+			 const CompTransform *transform,
+			 unsigned int mask)
+{
+    ANIMADDON_SCREEN (w->screen);
+
+    if (!as->batchParticles ||
+	(mask & PAINT_WINDOW_OCCLUSION_DETECTION_MASK))
+	return FALSE;
+
+    if (as->batchPending &&
+	WIN_X (w) < as->batchBox.x2 &&
+	WIN_X (w) + WIN_W (w) > as->batchBox.x1 &&
+	WIN_Y (w) < as->batchBox.y2 &&
+	WIN_Y (w) + WIN_H (w) > as->batchBox.y1)
+	particlesFlushBatches (w->screen);
+
+    // Only windows painted with the plain output transform share
+    // the batch coordinate space
+    return (!(mask & PAINT_WINDOW_TRANSFORMED_MASK) &&
+	    memcmp (transform->m, as->batchTransform.m,
+		    sizeof (as->batchTransform.m)) == 0);
+}
+
+void
+particlesFiniBatches (CompScreen *s)
+{
+    int i;
+
+    ANIMADDON_SCREEN (s);
+
+    for (i = 0; i < as->nBatches; i++)
+    {
+	ParticleBatch *batch = &as->batches[i];
+
+	if (batch->vertices)
+	    free (batch->vertices);
+	if (batch->colors)
+	    free (batch->colors);
+	if (batch->darkenVertices)
+	    free (batch->darkenVertices);
+	if (batch->darkenColors)
+	    free (batch->darkenColors);
+    }
+    if (as->batches)
+	free (as->batches);
+    as->batches = NULL;
+    as->nBatches = 0;
+
+    if (as->batchCoords)
+	free (as->batchCoords);
+    as->batchCoords = NULL;
+    as->batchCoordsCount = 0;
+
+    if (as->fireTex)
+	glDeleteTextures (1, &as->fireTex);
+    as->fireTex = 0;
+}
+
+// The fire particle texture is shared by all windows of a screen,
+// so that their particles end up in the same batch
+GLuint
+particlesGetFireTexture (CompScreen *s)
+{
+    ANIMADDON_SCREEN (s);
+
+    if (as->fireTex)
+	return as->fireTex;
+
+    glGenTextures (1, &as->fireTex);
+    glBindTexture (GL_TEXTURE_2D, as->fireTex);
+
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, 32, 32, 0,
+		  GL_RGBA, GL_UNSIGNED_BYTE, fireTex);
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    return as->fireTex;
+}
+
 void drawParticleSystems (CompWindow * w)
 {
+    ANIMADDON_SCREEN (w->screen);
     ANIMADDON_WINDOW (w);
 
     if (aw->eng.numPs && !WINDOW_INVISIBLE(w))
     {
 	int i = 0;
 
+	// Effects with their own transform draw the particles under the
+	// window transform, not under the one the batch is drawn with
+	Bool batch = (as->batchWindow == w && !aw->com->usingTransform);
+
 	for (i = 0; i < aw->eng.numPs; i++)
 	{
-	    if (aw->eng.ps[i].active)
+	    if (!aw->eng.ps[i].active)
+		continue;
+
+	    if (!batch || !particlesQueue (w, &aw->eng.ps[i]))
 		drawParticles (w, &aw->eng.ps[i]);
 	}
     }
@@ -269,7 +653,8 @@ void updateParticles(ParticleSystem * ps, float time)
 
 void finiParticles(ParticleSystem * ps)
 {
-    free(ps->particles);
+    if (ps->particles)
+	free(ps->particles);
     if (ps->tex)
 	glDeleteTextures(1, &ps->tex);
 
@@ -281,6 +666,8 @@ void finiParticles(ParticleSystem * ps)
 	free(ps->coords_cache);
     if (ps->dcolors_cache)
 	free(ps->dcolors_cache);
+
+    memset (ps, 0, sizeof (ParticleSystem));
 }
 
 void
@@ -333,6 +720,7 @@ particlesUpdateBB (CompOutput *output,
 void
 particlesCleanup (CompWindow * w)
 {
+    ANIMADDON_SCREEN (w->screen);
     ANIMADDON_WINDOW (w);
 
 	if (!aw)
@@ -340,11 +728,35 @@ particlesCleanup (CompWindow * w)
 
     if (aw->eng.numPs)
     {
+	Bool keep = (aw->eng.numPs == as->psPoolNumPs &&
+		     as->psPoolSize < as->psPoolCapacity);
 	int i = 0;
 
 	for (i = 0; i < aw->eng.numPs; i++)
-	    finiParticles (aw->eng.ps + i);
-	free (aw->eng.ps);
+	{
+	    ParticleSystem *ps = aw->eng.ps + i;
+
+	    // The shared texture belongs to the screen
+	    if (ps->tex == as->fireTex)
+		ps->tex = 0;
+
+	    if (keep)
+	    {
+		// Hand the buffers back to the pool, keeping their size
+		if (ps->tex)
+		    glDeleteTextures (1, &ps->tex);
+		ps->tex = 0;
+		ps->active = FALSE;
+	    }
+	    else
+		finiParticles (ps);
+	}
+
+	if (keep)
+	    as->psPool[as->psPoolSize++] = aw->eng.ps;
+	else
+	    free (aw->eng.ps);
+
 	aw->eng.ps = NULL;
 	aw->eng.numPs = 0;
     }
@@ -373,3 +785,169 @@ particlesPrePrepPaintScreen (CompWindow * w, int msSinceLastPaint)
     return particleAnimInProgress;
 }
 
+
+// =====================  Batch entry points  =========================
+
+// Gives w an array of numPs particle systems, taken from the
+// pre-allocated pool if possible. Keeps the systems w already has.
+ParticleSystem *
+allocParticleSystems (CompWindow *w,
+		      int numPs)
+{
+    ParticleSystem *ps;
+
+    ANIMADDON_SCREEN (w->screen);
+    ANIMADDON_WINDOW (w);
+
+    if (aw->eng.numPs)
+	return aw->eng.ps;
+
+    if (numPs == as->psPoolNumPs && as->psPoolSize)
+	ps = as->psPool[--as->psPoolSize];
+    else
+	ps = calloc (numPs, sizeof (ParticleSystem));
+
+    if (!ps)
+	return NULL;
+
+    aw->eng.ps = ps;
+    aw->eng.numPs = numPs;
+
+    return ps;
+}
+
+static void
+particlesFreePool (AnimAddonScreen *as)
+{
+    int i, j;
+
+    for (i = 0; i < as->psPoolSize; i++)
+    {
+	for (j = 0; j < as->psPoolNumPs; j++)
+	    finiParticles (&as->psPool[i][j]);
+	free (as->psPool[i]);
+    }
+    if (as->psPool)
+	free (as->psPool);
+
+    as->psPool = NULL;
+    as->psPoolSize = 0;
+    as->psPoolCapacity = 0;
+    as->psPoolNumPs = 0;
+}
+
+// Pre-allocates particle engine data for nWindows windows, each with
+// numPs particle systems of numParticles particles, so starting their
+// animations later does not allocate.
+Bool
+preallocEngineData (CompScreen *s,
+		    int nWindows,
+		    int numPs,
+		    int numParticles)
+{
+    ParticleSystem **pool;
+
+    ANIMADDON_SCREEN (s);
+
+    if (nWindows <= 0 || numPs <= 0)
+    {
+	particlesFreePool (as);
+	return TRUE;
+    }
+
+    if (numPs != as->psPoolNumPs)
+    {
+	particlesFreePool (as);
+	as->psPoolNumPs = numPs;
+    }
+
+    if (nWindows > as->psPoolCapacity)
+    {
+	pool = realloc (as->psPool, nWindows * sizeof (ParticleSystem *));
+	if (!pool)
+	    return FALSE;
+	as->psPool = pool;
+    }
+    as->psPoolCapacity = nWindows;
+
+    while (as->psPoolSize < nWindows)
+    {
+	ParticleSystem *ps = calloc (numPs, sizeof (ParticleSystem));
+	int i;
+
+	if (!ps)
+	    return FALSE;
+
+	for (i = 0; i < numPs; i++)
+	{
+	    reinitParticles (numParticles, &ps[i]);
+	    particlesEnsureCaches (&ps[i], TRUE);
+	}
+
+	as->psPool[as->psPoolSize++] = ps;
+    }
+
+    return TRUE;
+}
+
+void
+particlesFiniPool (CompScreen *s)
+{
+    ANIMADDON_SCREEN (s);
+
+    particlesFreePool (as);
+}
+
+// Draws the active particle systems of all windows of s for output
+// in one batch per texture and blend mode, bottom window first.
+void
+drawAllParticleSystems (CompScreen *s,
+			const CompTransform *transform,
+			CompOutput *output)
+{
+    CompTransform oldTransform;
+    Bool oldBatchParticles;
+    CompWindow *w;
+
+    ANIMADDON_SCREEN (s);
+
+    // Draw what has been queued with the transform of the current paint
+    particlesFlushBatches (s);
+
+    oldTransform = as->batchTransform;
+    oldBatchParticles = as->batchParticles;
+
+    particlesBeginBatch (s, transform, output);
+
+    for (w = s->windows; w; w = w->next)
+    {
+	AnimAddonWindow *aw = GET_ANIMADDON_WINDOW (w, as);
+	int i;
+
+	if (!aw || !aw->eng.numPs || WINDOW_INVISIBLE (w))
+	    continue;
+
+	// Burn and Beam Up draw their particles after the window
+	if (aw->com->curAnimEffect &&
+	    aw->com->curAnimEffect->properties.postPaintWindowFunc ==
+	    drawParticleSystems)
+	    continue;
+
+	for (i = 0; i < aw->eng.numPs; i++)
+	{
+	    if (aw->eng.ps[i].active &&
+		!particlesQueue (w, &aw->eng.ps[i]))
+	    {
+		glPushMatrix ();
+		glLoadMatrixf (as->batchTransform.m);
+		drawParticles (w, &aw->eng.ps[i]);
+		glPopMatrix ();
+	    }
+	}
+    }
+
+    particlesFlushBatches (s);
+
+    as->batchTransform = oldTransform;
+    as->batchParticles = oldBatchParticles;
+}
@@ -43,19 +43,10 @@
 
 typedef struct
 {
-    float dist;
-    float x, y; // relative from center
+    float x, y;
 
 } spoke_vertex_t;
 
-typedef struct
-{
-    float direction;
-    float length;
-    spoke_vertex_t * spoke_vertex;
-
-} spoke_t;
-
 typedef struct
 {
     Bool is_triangle;       // false if 4 sided, true if 3 sided
@@ -811,6 +802,100 @@ polygonsStoreClips (CompWindow * w,
     }
 }
 
+// Builds the glass fracture pattern for 4 * spokeMultiplier spokes
+// in a window normalized to [-1, 1] x [-1, 1], centered at the origin.
+// One spoke goes into each corner, the rest are spread evenly along the
+// edge between two corner spokes and may be shifted randomly towards
+// the next corner by up to a third of that edge.
+static Bool
+initGlassTemplate (GlassTemplate *template,
+		   int spokeMultiplier)
+{
+    static const float corners[4][2] = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
+    int spokeNum = 4 * spokeMultiplier;
+    int i;
+
+    template->spokeEnds = malloc (spokeNum * 2 * sizeof (GLfloat));
+    template->spokeJitter = malloc (spokeNum * 2 * sizeof (GLfloat));
+    if (!template->spokeEnds || !template->spokeJitter)
+    {
+	if (template->spokeEnds)
+	    free (template->spokeEnds);
+	if (template->spokeJitter)
+	    free (template->spokeJitter);
+	return FALSE;
+    }
+
+    for (i = 0; i < spokeNum; i++)
+    {
+	const float *c0 = corners[i / spokeMultiplier];
+	const float *c1 = corners[(i / spokeMultiplier + 1) % 4];
+	float pos = (float) (i % spokeMultiplier) / spokeMultiplier;
+	float jitter = (i % spokeMultiplier) ? MIN (1.0f / 3, 1 - pos) : 0;
+
+	template->spokeEnds[i * 2]       = c0[0] + pos * (c1[0] - c0[0]);
+	template->spokeEnds[i * 2 + 1]   = c0[1] + pos * (c1[1] - c0[1]);
+	template->spokeJitter[i * 2]     = jitter * (c1[0] - c0[0]);
+	template->spokeJitter[i * 2 + 1] = jitter * (c1[1] - c0[1]);
+    }
+
+    template->spokeMultiplier = spokeMultiplier;
+
+    return TRUE;
+}
+
+static void
+finiGlassTemplate (GlassTemplate *template)
+{
+    free (template->spokeEnds);
+    free (template->spokeJitter);
+    template->spokeMultiplier = 0;
+}
+
+// Returns the cached glass pattern for spokeMultiplier, creating it
+// (in place of the least recently created one) if needed.
+static GlassTemplate *
+getGlassTemplate (CompScreen *s,
+		  int spokeMultiplier)
+{
+    GlassTemplate *template;
+    int i;
+
+    ANIMADDON_SCREEN (s);
+
+    for (i = 0; i < GLASS_TEMPLATE_CACHE_SIZE; i++)
+    {
+	if (as->glassTemplates[i].spokeMultiplier == spokeMultiplier)
+	    return &as->glassTemplates[i];
+    }
+
+    template = &as->glassTemplates[as->nextGlassTemplate];
+    as->nextGlassTemplate = (as->nextGlassTemplate + 1) %
+			    GLASS_TEMPLATE_CACHE_SIZE;
+
+    if (template->spokeMultiplier)
+	finiGlassTemplate (template);
+
+    if (!initGlassTemplate (template, spokeMultiplier))
+	return NULL;
+
+    return template;
+}
+
+void
+freeGlassTemplates (CompScreen *s)
+{
+    int i;
+
+    ANIMADDON_SCREEN (s);
+
+    for (i = 0; i < GLASS_TEMPLATE_CACHE_SIZE; i++)
+    {
+	if (as->glassTemplates[i].spokeMultiplier)
+	    finiGlassTemplate (&as->glassTemplates[i]);
+    }
+}
+
 /*        90        //degree orientation
  *         |
  *    180--+--0
@@ -832,15 +917,7 @@ tessellateIntoGlass (CompWindow * w,
     int spoke_num = 4 * spoke_multiplier;
     int winLimitsX, winLimitsY, winLimitsW, winLimitsH;
     float centerX, centerY;
-    float top_bottom_length, left_right_length;
-
-    spoke_t spoke[spoke_num];
-    memset (spoke, 0, sizeof (spoke_t) * spoke_num);
-
-    for (i = 0; i < spoke_num; i++)
-    {
-	spoke[i].spoke_vertex = calloc (tier_num, sizeof (spoke_vertex_t));
-    }
+    GlassTemplate *template;
 
     if (pset->includeShadows)
     {
@@ -862,87 +939,49 @@ tessellateIntoGlass (CompWindow * w,
     if (winLimitsW < 100 || winLimitsH < 100)
 	return FALSE;
 
+    template = getGlassTemplate (w->screen, spoke_multiplier);
+    if (!template)
+    {
+	compLogMessage ("animationaddon",
+			CompLogLevelError, "Not enough memory");
+	return FALSE;
+    }
+
     centerX = (winLimitsW / 2.0) + winLimitsX;
     centerY = (winLimitsH / 2.0) + winLimitsY;
 
-    /* Calculate corner angles */
-    float corner_angle[4];
-    corner_angle[0] = atanf ((centerY - winLimitsY) /
-			     (winLimitsX + winLimitsW - centerX));
-    corner_angle[1] = M_PI - corner_angle[0];
-    corner_angle[2] = M_PI + corner_angle[0];
-    corner_angle[3] = 2 * M_PI - corner_angle[0];
+    spoke_vertex_t spoke[spoke_num][tier_num];
 
-    float range;
-
-    //calculate the vertex positions
+    //scale the template spokes to the window, with random perturbation
     for (i = 0; i < spoke_num; i++)
     {
-	/* The spokes must go into the corners. The remaining spokes fit between the corner spokes */
-	if ((i % spoke_multiplier) == 0)
-	{
-	    spoke[i].direction = corner_angle[i / spoke_multiplier];
-	}
-	else
-	{
-	    range = corner_angle[((i / spoke_multiplier) + 1) % 4 ] -
-		corner_angle[i / spoke_multiplier];
-	    if (range < 0)
-		range = 2 * M_PI - corner_angle[i / spoke_multiplier] +
-		    corner_angle[((i / spoke_multiplier) + 1) % 4 ];
-
-	    spoke[i].direction = corner_angle[i / spoke_multiplier] +
-		(i % spoke_multiplier) * range / spoke_multiplier;
-
-	    if (spoke[i].direction > 2 * M_PI)
-		spoke[i].direction -= 2 * M_PI;
+	float endX = template->spokeEnds[i * 2];
+	float endY = template->spokeEnds[i * 2 + 1];
+	float jitterX = template->spokeJitter[i * 2];
+	float jitterY = template->spokeJitter[i * 2 + 1];
 
+	if (jitterX != 0 || jitterY != 0)
+	{
 	    // Random direction
-	    spoke[i].direction += range * (float) rand () / 3 / RAND_MAX;
-	}
-
-
-	//calculate the length of the spoke
-	//calculate top/bottom lenght
-	if ((spoke[i].direction < M_PI))
-	    top_bottom_length = (centerY - winLimitsY);
-	else
-	    top_bottom_length = ((winLimitsY + winLimitsH)- centerY);
+	    float rVal = (float) rand () / RAND_MAX;
 
-	top_bottom_length /= sinf (spoke[i].direction);
-	if (top_bottom_length < 0) top_bottom_length *= -1;
-
-	//calculate left right length
-	if ((spoke[i].direction < M_PI / 2) || (spoke[i].direction > 3 * M_PI / 2))
-	    left_right_length = (winLimitsX + winLimitsW) - centerX;
-	else
-	    left_right_length = centerX - winLimitsX;
-
-	left_right_length /= cosf (spoke[i].direction);
-
-	if (left_right_length < 0) left_right_length *= -1;
-
-	//take the smaller of the two
-	if (left_right_length < top_bottom_length)
-	    spoke[i].length = left_right_length;
-	else
-	    spoke[i].length = top_bottom_length;
+	    endX += rVal * jitterX;
+	    endY += rVal * jitterY;
+	}
 
+	endX *= winLimitsW / 2.0;
+	endY *= winLimitsH / 2.0;
 
-	float percent = 1.0 / ((float) tier_num);
 	//calculate spoke vertexes
-	for (j = 0 ; j < tier_num; j++)
+	for (j = 0; j < tier_num; j++)
 	{
-	    spoke[i].spoke_vertex[j].dist = percent * (j + 1) * spoke[i].length;
+	    float percent = (j + 1) / (float) tier_num;
 
-	    spoke[i].spoke_vertex[j].x =
-		centerX + (spoke[i].spoke_vertex[j].dist * cos (spoke[i].direction));
-	    spoke[i].spoke_vertex[j].y =
-		centerY + (spoke[i].spoke_vertex[j].dist * sin (spoke[i].direction));
+	    spoke[i][j].x = centerX + percent * endX;
+	    spoke[i][j].y = centerY + percent * endY;
 	}
     }
 
-
     shard_t shards[spoke_num][tier_num];
 
     //calculate the center and bounds of each polygon
@@ -958,11 +997,11 @@ tessellateIntoGlass (CompWindow * w,
 		shards[i][j].pt0X = centerX;
 		shards[i][j].pt0Y = centerY;
 
-		shards[i][j].pt1X = spoke[i].spoke_vertex[j].x;
-		shards[i][j].pt1Y = spoke[i].spoke_vertex[j].y;
+		shards[i][j].pt1X = spoke[i][j].x;
+		shards[i][j].pt1Y = spoke[i][j].y;
 
-		shards[i][j].pt2X = spoke[(i + 1) % spoke_num].spoke_vertex[j].x;
-		shards[i][j].pt2Y = spoke[(i + 1) % spoke_num].spoke_vertex[j].y;
+		shards[i][j].pt2X = spoke[(i + 1) % spoke_num][j].x;
+		shards[i][j].pt2Y = spoke[(i + 1) % spoke_num][j].y;
 
 		shards[i][j].pt3X = shards[i][j].pt0X;//fourth point is not used
 		shards[i][j].pt3Y = shards[i][j].pt0Y;
@@ -978,27 +1017,27 @@ tessellateIntoGlass (CompWindow * w,
 	    default:
 		//the other tiers are 4 sided polygons
 		shards[i][j].is_triangle = FALSE;
-		shards[i][j].pt0X = spoke[i].spoke_vertex[j - 1].x;
-		shards[i][j].pt0Y = spoke[i].spoke_vertex[j - 1].y;
+		shards[i][j].pt0X = spoke[i][j - 1].x;
+		shards[i][j].pt0Y = spoke[i][j - 1].y;
 
-		shards[i][j].pt1X = spoke[i].spoke_vertex[j].x;
-		shards[i][j].pt1Y = spoke[i].spoke_vertex[j].y;
+		shards[i][j].pt1X = spoke[i][j].x;
+		shards[i][j].pt1Y = spoke[i][j].y;
 
 		if (i != spoke_num - 1)
 		{
-		    shards[i][j].pt2X = spoke[i + 1].spoke_vertex[j].x;
-		    shards[i][j].pt2Y = spoke[i + 1].spoke_vertex[j].y;
+		    shards[i][j].pt2X = spoke[i + 1][j].x;
+		    shards[i][j].pt2Y = spoke[i + 1][j].y;
 
-		    shards[i][j].pt3X = spoke[i + 1].spoke_vertex[j - 1].x;
-		    shards[i][j].pt3Y = spoke[i + 1].spoke_vertex[j - 1].y;
+		    shards[i][j].pt3X = spoke[i + 1][j - 1].x;
+		    shards[i][j].pt3Y = spoke[i + 1][j - 1].y;
 		}
 		else
 		{
-		    shards[i][j].pt2X = spoke[0].spoke_vertex[j].x;
-		    shards[i][j].pt2Y = spoke[0].spoke_vertex[j].y;
+		    shards[i][j].pt2X = spoke[0][j].x;
+		    shards[i][j].pt2Y = spoke[0][j].y;
 
-		    shards[i][j].pt3X = spoke[0].spoke_vertex[j - 1].x;
-		    shards[i][j].pt3Y = spoke[0].spoke_vertex[j - 1].y;
+		    shards[i][j].pt3X = spoke[0][j - 1].x;
+		    shards[i][j].pt3Y = spoke[0][j - 1].y;
 		}
 
 		//calculate the center of the polygon
@@ -1420,6 +1459,7 @@ polygonsDrawCustomGeometry (CompWindow * w)
     CompScreen *s = w->screen;
 
     ANIMADDON_DISPLAY (s->display);
+    ANIMADDON_SCREEN (s);
     ANIMADDON_WINDOW (w);
 
     aw->nDrawGeometryCalls++;
@@ -1473,15 +1513,21 @@ polygonsDrawCustomGeometry (CompWindow * w)
 
     // OpenGL stuff starts here
 
-    GLboolean normalArrayWas = FALSE;
+    // Core only enables the normal array and clip planes around its
+    // own draws, so they don't have to be queried
+    glStateInvalidate (&as->glState);
+    glStateAssume (&as->glState, GL_NORMAL_ARRAY, FALSE);
+    glStateAssume (&as->glState, GL_CLIP_PLANE0, FALSE);
+    glStateAssume (&as->glState, GL_CLIP_PLANE1, FALSE);
+    glStateAssume (&as->glState, GL_CLIP_PLANE2, FALSE);
+    glStateAssume (&as->glState, GL_CLIP_PLANE3, FALSE);
 
     if (pset->thickness > 0)
     {
 	glPushAttrib(GL_NORMALIZE);
 	glEnable(GL_NORMALIZE);
 
-	normalArrayWas = glIsEnabled(GL_NORMAL_ARRAY);
-	glEnableClientState(GL_NORMAL_ARRAY);
+	glStateEnable (&as->glState, GL_NORMAL_ARRAY);
     }
 
     if (pset->doLighting)
@@ -1675,8 +1721,9 @@ polygonsDrawCustomGeometry (CompWindow * w)
 
 		int k;
 
+		// Clip planes stay enabled until all polygons are drawn
 		for (k = 0; k < 4; k++)
-		    glEnable(GL_CLIP_PLANE0 + k);
+		    glStateEnable (&as->glState, GL_CLIP_PLANE0 + k);
 		Bool fadeBackAndSides =
 		    pset->backAndSidesFadeDur > 0 &&
 		    forwardProgress <= pset->backAndSidesFadeDur;
@@ -1737,13 +1784,16 @@ polygonsDrawCustomGeometry (CompWindow * w)
 		}
 		// Draw front face
 		glDrawArrays(GL_POLYGON, 0, p->nSides);
-		for (k = 0; k < 4; k++)
-		    glDisable(GL_CLIP_PLANE0 + k);
 
 		glPopMatrix();
 	    }
 	}
     }
+
+    int k;
+
+    for (k = 0; k < 4; k++)
+	glStateDisable (&as->glState, GL_CLIP_PLANE0 + k);
     // Restore
     // -----------------------------------------
 
@@ -1778,10 +1828,7 @@ polygonsDrawCustomGeometry (CompWindow * w)
     {
 	glPopAttrib(); // GL_NORMALIZE
 
-	if (normalArrayWas)
-	    glEnableClientState(GL_NORMAL_ARRAY);
-	else
-	    glDisableClientState(GL_NORMAL_ARRAY);
+	glStateDisable (&as->glState, GL_NORMAL_ARRAY);
     }
     else
 	glNormal3f (0.0f, 0.0f, -1.0f);
@@ -1903,6 +1950,35 @@ polygonsAnimStep (CompWindow *w, float time)
 			"%s: pset null at line %d\n",__FILE__,  __LINE__);
 }
 
+// Steps the polygons of all windows of s that are being animated with
+// effect, for effects that drive their windows from a screen level hook.
+// Returns the number of windows stepped.
+int
+polygonsAnimStepAll (CompScreen *s,
+		     AnimEffect effect,
+		     float time)
+{
+    CompWindow *w;
+    int nStepped = 0;
+
+    ANIMADDON_SCREEN (s);
+
+    for (w = s->windows; w; w = w->next)
+    {
+	AnimAddonWindow *aw = GET_ANIMADDON_WINDOW (w, as);
+
+	if (!aw || !aw->eng.polygonSet ||
+	    aw->com->curAnimEffect != effect ||
+	    aw->com->animRemainingTime <= 0)
+	    continue;
+
+	polygonsAnimStep (w, time);
+	nStepped++;
+    }
+
+    return nStepped;
+}
+
 void
 polygonsUpdateBB (CompOutput *output,
 		  CompWindow * w,
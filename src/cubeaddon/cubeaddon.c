@@ -24,14 +24,24 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
 #include <unistd.h>
 #include <math.h>
+#include <pthread.h>
+
+#include "config.h"
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
 
 #include <compiz-core.h>
 #include <compiz-cube.h>
+#include <compiz-glstate.h>
+#include <compiz-renderbuffer.h>
 
 #include "cubeaddon_options.h"
 
@@ -46,24 +56,122 @@ static int cubeDisplayPrivateIndex;
 #define CAP_NIMGVERTEX (((CAP_ELEMENTS + 1) * (CAP_ELEMENTS + 1)) * 5)
 #define CAP_NIMGIDX (CAP_ELEMENTS * CAP_ELEMENTS * 4)
 
+#define DEFORM_CACHE_SIZE 4
+
+#define REFLECTION_BLUR_SCALE 4
+
+#define CAP_LOAD_POLL_INTERVAL 50
+#define CAP_MAX_JOBS           2
+
+#define CAP_BUFFER_VERTEX 0
+#define CAP_BUFFER_NORMAL 1
+#define CAP_BUFFER_INDEX  2
+#define CAP_BUFFER_NUM    3
+
+#define GROUND_NVERTEX 8
+
+typedef void (*CubeaddonGenBuffersProc) (GLsizei n,
+					 GLuint  *buffers);
+typedef void (*CubeaddonDeleteBuffersProc) (GLsizei      n,
+					    const GLuint *buffers);
+typedef void (*CubeaddonBindBufferProc) (GLenum target,
+					 GLuint buffer);
+typedef void (*CubeaddonBufferDataProc) (GLenum        target,
+					 GLsizeiptr    size,
+					 const GLvoid  *data,
+					 GLenum        usage);
+
 typedef struct _CubeaddonDisplay
 {
     int screenPrivateIndex;
 } CubeaddonDisplay;
 
+/*
+ * Cap image decoded by a worker thread. The thread only touches the
+ * job until it sets done. The image plugins behind readImageFromFile
+ * are not thread safe, so the thread only decodes PNG files with
+ * libpng; other formats are decoded on the main thread.
+ */
+typedef struct _CubeCapJob
+{
+    struct _CubeCapJob *next;
+
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    Bool            started;
+    Bool            done;
+    Bool            decoded;
+
+    CompDisplay *display;
+    char        *file;
+    int         maxSize;
+
+    void *data;
+    int  width;
+    int  height;
+} CubeCapJob;
+
 typedef struct _CubeCap
 {
     int		    current;
     CompListValue   *files;
 
     Bool            loaded;
+    Bool            mipmap;
+    char            *file;
+    int             width;
+    int             height;
 
     CompTexture	    texture;
     CompTransform   texMat;
+
+    CubeCapJob      *load;    /* replaces the current image once done */
+    CubeCapJob      *preload; /* next image in the list */
+    CubeCapJob      *stale;   /* no longer needed, but still decoding */
 } CubeCap;
 
+/*
+ * The deformation only depends on the position relative to the
+ * deformed output, so it is precomputed per pixel column (and row for
+ * the sphere) and reused as long as the output geometry and the cube
+ * distance stay the same.
+ */
+typedef struct _CubeaddonDeformColumn
+{
+    GLfloat a1;
+    GLfloat sinAng;
+    GLfloat cosAng;
+    GLfloat z;
+    Bool    inside;
+} CubeaddonDeformColumn;
+
+typedef struct _CubeaddonDeformCache
+{
+    Bool  valid;
+    Bool  cylinder;
+
+    int   sx1, sw;
+    int   sy1, sh;
+    float distance;
+    float radSquare;
+
+    CubeaddonDeformColumn *columns;
+    int                   nColumns;
+    GLfloat               *rows;
+    int                   nRows;
+
+    unsigned int lastUsed;
+} CubeaddonDeformCache;
+
+typedef struct _CubeaddonGroundVertex
+{
+    GLfloat color[4];
+    GLfloat x, y;
+} CubeaddonGroundVertex;
+
 typedef struct _CubeaddonScreen
 {
+    PreparePaintScreenProc     preparePaintScreen;
     DonePaintScreenProc        donePaintScreen;
     PaintOutputProc            paintOutput;
     PaintTransformedOutputProc paintTransformedOutput;
@@ -99,6 +207,26 @@ typedef struct _CubeaddonScreen
     GLfloat      *winNormals;
     unsigned int winNormSize;
 
+    CubeaddonDeformCache deformCache[DEFORM_CACHE_SIZE];
+    unsigned int         deformCacheClock;
+
+    /* offscreen buffer for single pass reflection */
+    GLuint reflectionFbo;
+    GLuint reflectionTexture;
+    GLuint reflectionDepth;
+    int    reflectionWidth, reflectionHeight;
+    int    reflectionTexWidth, reflectionTexHeight;
+    Bool   noReflectionFbo;
+    Bool   fboPass;
+
+    /* downscaled copy of the offscreen buffer for the blurred reflection */
+    GLuint reflectionBlurFbo;
+    GLuint reflectionBlurTexture;
+    int    reflectionBlurWidth, reflectionBlurHeight;
+    Bool   noReflectionBlur;
+
+    CompRenderbufferProcs rb;
+
     GLfloat  capFill[CAP_NVERTEX];
     GLfloat  capFillNorm[CAP_NVERTEX];
     GLushort capFillIdx[CAP_NIDX];
@@ -106,8 +234,25 @@ typedef struct _CubeaddonScreen
     float    capDistance;
     int      capDeformType;
 
+    /* vertex buffers for the cap meshes and the ground */
+    CubeaddonGenBuffersProc    genBuffers;
+    CubeaddonDeleteBuffersProc deleteBuffers;
+    CubeaddonBindBufferProc    bindBuffer;
+    CubeaddonBufferDataProc    bufferData;
+
+    GLuint capBuffers[CAP_BUFFER_NUM];
+    GLuint groundBuffer;
+
+    CubeaddonGroundVertex groundVertices[GROUND_NVERTEX];
+    int                   nGroundVertices;
+    Bool                  groundChanged;
+
     CubeCap topCap;
     CubeCap bottomCap;
+
+    CompGLState glState;
+
+    CompTimeoutHandle capLoadHandle;
 } CubeaddonScreen;
 
 #define CUBEADDON_DISPLAY(d) PLUGIN_DISPLAY(d, Cubeaddon, ca)
@@ -124,40 +269,528 @@ cubeaddonInitCap (CompScreen *s, CubeCap *cap)
     cap->current    = 0;
     cap->files	    = NULL;
     cap->loaded     = FALSE;
+    cap->mipmap     = FALSE;
+    cap->file       = NULL;
+    cap->width      = 0;
+    cap->height     = 0;
+    cap->load       = NULL;
+    cap->preload    = NULL;
+    cap->stale      = NULL;
 }
 
+/* Cap image loading -------------------------------------------------------- */
+
 /*
- * Attempt to load current cap image (if any)
+ * Scale an image down to half its size in place
  */
 static void
-cubeaddonLoadCap (CompScreen *s,
-		  CubeCap    *cap,
-		  Bool       scale,
-		  Bool       aspect,
-		  Bool       clamp)
+cubeaddonHalveImage (unsigned char *data,
+		     int           *width,
+		     int           *height)
 {
-    unsigned int width, height;
-    float        xScale, yScale;
+    unsigned char *src, *dst = data;
+    int           x, y, c, w = *width, stride = w * 4;
+
+    for (y = 0; y < *height / 2; y++)
+    {
+	for (x = 0; x < w / 2; x++)
+	{
+	    src = data + (y * 2 * stride) + (x * 8);
+
+	    for (c = 0; c < 4; c++)
+		*dst++ = (src[c] + src[c + 4] +
+			  src[stride + c] + src[stride + c + 4] + 2) / 4;
+	}
+    }
+
+    *width  = w / 2;
+    *height = *height / 2;
+}
+
+#ifdef HAVE_LIBPNG
+/*
+ * Decode a PNG file to premultiplied BGRA, the same format the png
+ * plugin returns. Unlike readImageFromFile this can be called from
+ * the worker threads.
+ */
+static Bool
+cubeaddonReadPng (const char *file,
+		  int        *width,
+		  int        *height,
+		  void       **data)
+{
+    png_structp             png;
+    png_infop               info;
+    png_bytep * volatile    rows = NULL;
+    unsigned char * volatile pixels = NULL;
+    unsigned char           signature[8], *p;
+    png_uint_32             w, h, i;
+    int                     depth, color;
+    FILE                    *fp;
+
+    fp = fopen (file, "rb");
+    if (!fp)
+	return FALSE;
+
+    if (fread (signature, 1, 8, fp) != 8 || png_sig_cmp (signature, 0, 8))
+    {
+	fclose (fp);
+	return FALSE;
+    }
+
+    png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+    {
+	fclose (fp);
+	return FALSE;
+    }
+
+    info = png_create_info_struct (png);
+    if (!info)
+    {
+	png_destroy_read_struct (&png, NULL, NULL);
+	fclose (fp);
+	return FALSE;
+    }
+
+    if (setjmp (png_jmpbuf (png)))
+    {
+	png_destroy_read_struct (&png, &info, NULL);
+	free (rows);
+	free (pixels);
+	fclose (fp);
+	return FALSE;
+    }
+
+    png_init_io (png, fp);
+    png_set_sig_bytes (png, 8);
+    png_read_info (png, info);
+    png_get_IHDR (png, info, &w, &h, &depth, &color, NULL, NULL, NULL);
+
+    if (w > 0x7fff || h > 0x7fff)
+	png_error (png, "image too large");
+
+    if (color == PNG_COLOR_TYPE_PALETTE)
+	png_set_palette_to_rgb (png);
+    if (color == PNG_COLOR_TYPE_GRAY && depth < 8)
+	png_set_expand_gray_1_2_4_to_8 (png);
+    if (png_get_valid (png, info, PNG_INFO_tRNS))
+	png_set_tRNS_to_alpha (png);
+    if (depth == 16)
+	png_set_strip_16 (png);
+    if (depth < 8)
+	png_set_packing (png);
+    if (color == PNG_COLOR_TYPE_GRAY || color == PNG_COLOR_TYPE_GRAY_ALPHA)
+	png_set_gray_to_rgb (png);
+
+    png_set_interlace_handling (png);
+    png_set_bgr (png);
+    png_set_filler (png, 0xff, PNG_FILLER_AFTER);
+    png_read_update_info (png, info);
+
+    pixels = malloc (w * h * 4);
+    rows   = malloc (h * sizeof (png_bytep));
+    if (!pixels || !rows)
+	png_error (png, "out of memory");
+
+    for (i = 0; i < h; i++)
+	rows[i] = pixels + (i * w * 4);
+
+    png_read_image (png, rows);
+    png_read_end (png, info);
+
+    png_destroy_read_struct (&png, &info, NULL);
+    free (rows);
+    fclose (fp);
+
+    /* textures use premultiplied alpha */
+    for (i = 0, p = pixels; i < w * h; i++, p += 4)
+    {
+	if (p[3] == 0xff)
+	    continue;
+
+	p[0] = p[0] * p[3] / 255;
+	p[1] = p[1] * p[3] / 255;
+	p[2] = p[2] * p[3] / 255;
+    }
+
+    *width  = w;
+    *height = h;
+    *data   = pixels;
+
+    return TRUE;
+}
+
+static void *
+cubeaddonCapJobThread (void *closure)
+{
+    CubeCapJob *job = (CubeCapJob *) closure;
+    void       *data;
+    int        width, height;
+    Bool       decoded;
+
+    decoded = cubeaddonReadPng (job->file, &width, &height, &data);
+    if (decoded)
+    {
+	/* there is no point in keeping more pixels than the cap can show */
+	while (job->maxSize && MIN (width, height) / 2 >= job->maxSize)
+	    cubeaddonHalveImage (data, &width, &height);
+    }
+
+    pthread_mutex_lock (&job->mutex);
+    if (decoded)
+    {
+	job->data   = data;
+	job->width  = width;
+	job->height = height;
+    }
+    job->decoded = decoded;
+    job->done    = TRUE;
+    pthread_mutex_unlock (&job->mutex);
+
+    return NULL;
+}
+#endif
+
+static Bool
+cubeaddonCapJobDone (CubeCapJob *job)
+{
+    Bool done;
+
+    pthread_mutex_lock (&job->mutex);
+    done = job->done;
+    pthread_mutex_unlock (&job->mutex);
+
+    return done;
+}
+
+static void
+cubeaddonRunCapJob (CubeCapJob *job)
+{
+#ifdef HAVE_LIBPNG
+    job->started = TRUE;
+
+    if (!pthread_create (&job->thread, NULL, cubeaddonCapJobThread, job))
+	return;
+
+    job->started = FALSE;
+#endif
+
+    /* leave decoding to the main thread */
+    job->done = TRUE;
+}
+
+/*
+ * Decode the image of a finished job on the main thread, unless the
+ * worker thread already did. That blocks painting, so it is put off
+ * while the cube rotates. Returns TRUE once the job is decoded.
+ */
+static Bool
+cubeaddonDecodeCapJob (CompScreen *s,
+		       CubeCapJob *job)
+{
+    void *data;
+    int  width, height;
 
     CUBE_SCREEN (s);
 
+    if (job->decoded)
+	return TRUE;
+
+    if (cs->rotationState != RotationNone)
+	return FALSE;
+
+    job->decoded = TRUE;
+
+    if (!readImageFromFile (job->display, job->file, &width, &height, &data))
+	return TRUE;
+
+    /* there is no point in keeping more pixels than the cap can show */
+    while (job->maxSize && MIN (width, height) / 2 >= job->maxSize)
+	cubeaddonHalveImage (data, &width, &height);
+
+    job->data   = data;
+    job->width  = width;
+    job->height = height;
+
+    return TRUE;
+}
+
+static int
+cubeaddonCountRunningCapJobs (CubeCap *cap)
+{
+    CubeCapJob *job;
+    int        count = 0;
+
+    if (cap->load && cap->load->started && !cubeaddonCapJobDone (cap->load))
+	count++;
+    if (cap->preload && cap->preload->started &&
+	!cubeaddonCapJobDone (cap->preload))
+	count++;
+
+    for (job = cap->stale; job; job = job->next)
+	if (job->started && !cubeaddonCapJobDone (job))
+	    count++;
+
+    return count;
+}
+
+static int
+cubeaddonRunningCapJobs (CompScreen *s)
+{
+    CUBEADDON_SCREEN (s);
+
+    return cubeaddonCountRunningCapJobs (&cas->topCap) +
+	   cubeaddonCountRunningCapJobs (&cas->bottomCap);
+}
+
+/*
+ * Start decoding a cap image in the background, the job is queued
+ * if too many threads are running already
+ */
+static CubeCapJob *
+cubeaddonStartCapJob (CompScreen *s,
+		      const char *file)
+{
+    CubeCapJob *job;
+    int        i;
+
+    job = calloc (1, sizeof (CubeCapJob));
+    if (!job)
+	return NULL;
+
+    job->file = strdup (file);
+    if (!job->file)
+    {
+	free (job);
+	return NULL;
+    }
+
+    job->display = s->display;
+
+    /* a cap never covers more than a whole output */
+    for (i = 0; i < s->nOutputDev; i++)
+	job->maxSize = MAX (job->maxSize, MAX (s->outputDev[i].width,
+					       s->outputDev[i].height));
+
+    pthread_mutex_init (&job->mutex, NULL);
+
+    if (cubeaddonRunningCapJobs (s) < CAP_MAX_JOBS)
+	cubeaddonRunCapJob (job);
+
+    return job;
+}
+
+/*
+ * Wait for the decoding thread and free the job
+ */
+static void
+cubeaddonFreeCapJob (CubeCapJob *job)
+{
+    if (job->started)
+	pthread_join (job->thread, NULL);
+    pthread_mutex_destroy (&job->mutex);
+
+    if (job->data)
+	free (job->data);
+    if (job->file)
+	free (job->file);
+
+    free (job);
+}
+
+/*
+ * Keep a job that is no longer needed until its thread is done,
+ * queued jobs are freed on the next poll
+ */
+static void
+cubeaddonDropCapJob (CubeCap    *cap,
+		     CubeCapJob *job)
+{
+    job->next  = cap->stale;
+    cap->stale = job;
+}
+
+static void
+cubeaddonReapCapJobs (CubeCap *cap)
+{
+    CubeCapJob **job = &cap->stale, *done;
+
+    while (*job)
+    {
+	if (!(*job)->started || cubeaddonCapJobDone (*job))
+	{
+	    done = *job;
+	    *job = done->next;
+	    cubeaddonFreeCapJob (done);
+	}
+	else
+	{
+	    job = &(*job)->next;
+	}
+    }
+}
+
+static void
+cubeaddonFiniCap (CompScreen *s,
+		  CubeCap    *cap)
+{
+    CubeCapJob *job;
+
+    if (cap->load)
+	cubeaddonFreeCapJob (cap->load);
+    if (cap->preload)
+	cubeaddonFreeCapJob (cap->preload);
+
+    while (cap->stale)
+    {
+	job = cap->stale;
+	cap->stale = job->next;
+	cubeaddonFreeCapJob (job);
+    }
+
+    if (cap->file)
+	free (cap->file);
+
     finiTexture (s, &cap->texture);
-    initTexture (s, &cap->texture);
+}
 
-    cap->loaded = FALSE;
+/*
+ * Start queued jobs, decode the images the worker threads couldn't
+ * and damage the screen as soon as a requested image is decoded, so
+ * it gets uploaded on the next frame even if nothing else is painting
+ */
+static Bool
+cubeaddonCapLoadTimeout (void *closure)
+{
+    CompScreen *s = (CompScreen *) closure;
+    CubeCap    *caps[2], *cap;
+    Bool       pending = FALSE;
+    int        i;
+
+    CUBEADDON_SCREEN (s);
+
+    caps[0] = &cas->topCap;
+    caps[1] = &cas->bottomCap;
+
+    for (i = 0; i < 2; i++)
+	cubeaddonReapCapJobs (caps[i]);
+
+    for (i = 0; i < 2; i++)
+    {
+	cap = caps[i];
+
+	if (cap->load && !cap->load->started && !cap->load->done &&
+	    cubeaddonRunningCapJobs (s) < CAP_MAX_JOBS)
+	    cubeaddonRunCapJob (cap->load);
+
+	if (cap->load && cubeaddonCapJobDone (cap->load))
+	{
+	    if (cubeaddonDecodeCapJob (s, cap->load))
+		damageScreen (s);
+	}
+	else if (!cap->load && cap->preload)
+	{
+	    /* only decode the next image when idle */
+	    if (!cap->preload->started && !cap->preload->done &&
+		cubeaddonRunningCapJobs (s) < CAP_MAX_JOBS)
+		cubeaddonRunCapJob (cap->preload);
+
+	    if (cubeaddonCapJobDone (cap->preload))
+		cubeaddonDecodeCapJob (s, cap->preload);
+	}
+
+	pending |= cap->load || cap->stale ||
+		   (cap->preload && !(cubeaddonCapJobDone (cap->preload) &&
+				      cap->preload->decoded));
+    }
+
+    if (!pending)
+	cas->capLoadHandle = 0;
+
+    return pending;
+}
+
+static void
+cubeaddonPollCapJobs (CompScreen *s)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (!cas->capLoadHandle)
+	cas->capLoadHandle = compAddTimeout (CAP_LOAD_POLL_INTERVAL,
+					     CAP_LOAD_POLL_INTERVAL * 2,
+					     cubeaddonCapLoadTimeout, s);
+}
+
+/*
+ * Request the current cap image, the previous image stays on
+ * screen until the new one is decoded
+ */
+static void
+cubeaddonLoadCap (CompScreen *s,
+		  CubeCap    *cap)
+{
+    const char *file;
 
     if (!cap->files || !cap->files->nValue)
 	return;
 
     cap->current = cap->current % cap->files->nValue;
+    file = cap->files->value[cap->current].s;
+
+    if (cap->load)
+    {
+	if (!strcmp (cap->load->file, file))
+	    return;
+
+	cubeaddonDropCapJob (cap, cap->load);
+	cap->load = NULL;
+	cubeaddonPollCapJobs (s);
+    }
+
+    if (cap->loaded && cap->file && !strcmp (cap->file, file))
+	return;
+
+    if (cap->preload && !strcmp (cap->preload->file, file))
+    {
+	cap->load    = cap->preload;
+	cap->preload = NULL;
+    }
+    else
+    {
+	cap->load = cubeaddonStartCapJob (s, file);
+    }
+
+    if (cap->load)
+	cubeaddonPollCapJobs (s);
+}
+
+/*
+ * Upload a decoded cap image
+ */
+static void
+cubeaddonUploadCap (CompScreen *s,
+		    CubeCap    *cap,
+		    CubeCapJob *job)
+{
+    finiTexture (s, &cap->texture);
+    initTexture (s, &cap->texture);
 
-    if (!readImageToTexture (s, &cap->texture,
-			     cap->files->value[cap->current].s,
-			     &width, &height))
+    cap->loaded = FALSE;
+    cap->mipmap = FALSE;
+
+    if (cap->file)
+	free (cap->file);
+
+    cap->file = job->file;
+    job->file = NULL;
+
+    if (!job->data ||
+	!imageBufferToTexture (s, &cap->texture, job->data,
+			       job->width, job->height))
     {
 	compLogMessage ("cubeaddon", CompLogLevelWarn,
-			"Failed to load image: %s",
-			cap->files->value[cap->current].s);
+			"Failed to load image: %s", cap->file);
 
 	finiTexture (s, &cap->texture);
 	initTexture (s, &cap->texture);
@@ -166,6 +799,39 @@ cubeaddonLoadCap (CompScreen *s,
     }
 
     cap->loaded = TRUE;
+    cap->width  = job->width;
+    cap->height = job->height;
+
+    /* caps are mostly seen minified, so always build the mipmaps */
+    if (s->fbo && cap->texture.target == GL_TEXTURE_2D)
+    {
+	glBindTexture (GL_TEXTURE_2D, cap->texture.name);
+	(*s->generateMipmap) (GL_TEXTURE_2D);
+	glBindTexture (GL_TEXTURE_2D, 0);
+
+	cap->texture.oldMipmaps = FALSE;
+	cap->mipmap = TRUE;
+    }
+}
+
+/*
+ * Update texture matrix and wrapping of a loaded cap
+ */
+static void
+cubeaddonSetupCap (CompScreen *s,
+		   CubeCap    *cap,
+		   Bool       scale,
+		   Bool       aspect,
+		   Bool       clamp)
+{
+    unsigned int width = cap->width, height = cap->height;
+    float        xScale, yScale;
+
+    CUBE_SCREEN (s);
+
+    if (!cap->loaded)
+	return;
+
     matrixGetIdentity (&cap->texMat);
 
     cap->texMat.m[0] = cap->texture.matrix.xx;
@@ -224,6 +890,70 @@ cubeaddonLoadCap (CompScreen *s,
     disableTexture (s, &cap->texture);
 }
 
+static void
+cubeaddonUpdateCap (CompScreen *s,
+		    Bool       top)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (top)
+    {
+	cubeaddonSetupCap (s, &cas->topCap, cubeaddonGetTopScale (s),
+			   cubeaddonGetTopAspect (s),
+			   cubeaddonGetTopClamp (s));
+    }
+    else
+    {
+	cubeaddonSetupCap (s, &cas->bottomCap, cubeaddonGetBottomScale (s),
+			   cubeaddonGetBottomAspect (s),
+			   cubeaddonGetBottomClamp (s));
+	matrixScale (&cas->bottomCap.texMat, 1.0, -1.0, 1.0);
+    }
+}
+
+/*
+ * Upload the requested image once it is decoded and start decoding
+ * the next one in the list
+ */
+static void
+cubeaddonProcessCap (CompScreen *s,
+		     Bool       top)
+{
+    CubeCap    *cap;
+    const char *next;
+
+    CUBEADDON_SCREEN (s);
+
+    cap = (top) ? &cas->topCap : &cas->bottomCap;
+
+    if (cap->load && cubeaddonCapJobDone (cap->load) &&
+	cubeaddonDecodeCapJob (s, cap->load))
+    {
+	cubeaddonUploadCap (s, cap, cap->load);
+	cubeaddonFreeCapJob (cap->load);
+	cap->load = NULL;
+
+	cubeaddonUpdateCap (s, top);
+	damageScreen (s);
+    }
+
+    if (cap->load || !cap->files || cap->files->nValue < 2)
+	return;
+
+    next = cap->files->value[(cap->current + 1) % cap->files->nValue].s;
+
+    if (cap->preload)
+    {
+	if (!strcmp (cap->preload->file, next))
+	    return;
+
+	cubeaddonDropCapJob (cap, cap->preload);
+    }
+
+    cap->preload = cubeaddonStartCapJob (s, next);
+    cubeaddonPollCapJobs (s);
+}
+
 /* Settings handling -------------------------------------------------------- */
 
 /*
@@ -240,19 +970,8 @@ cubeaddonChangeCap (CompScreen *s,
     {
 	int count = cap->files->nValue;
 	cap->current = (cap->current + change + count) % count;
-	if (top)
-	{
-	    cubeaddonLoadCap (s, cap, cubeaddonGetTopScale (s),
-			      cubeaddonGetTopAspect (s),
-			      cubeaddonGetTopClamp (s));
-	}
-	else
-	{
-	    cubeaddonLoadCap (s, cap, cubeaddonGetBottomScale (s),
-			      cubeaddonGetBottomAspect (s),
-			      cubeaddonGetBottomClamp (s));
-	    matrixScale (&cap->texMat, 1.0, -1.0, 1.0);
-	}
+	cubeaddonLoadCap (s, cap);
+	cubeaddonUpdateCap (s, top);
 	damageScreen (s);
     }
 }
@@ -401,10 +1120,213 @@ cubeaddonBottomPrev (CompDisplay     *d,
     return FALSE;
 }
 
+/* Vertex buffers ----------------------------------------------------------- */
+
+static void
+cubeaddonInitBuffers (CompScreen *s)
+{
+    const char *extensions = (const char *) glGetString (GL_EXTENSIONS);
+
+    CUBEADDON_SCREEN (s);
+
+    memset (cas->capBuffers, 0, sizeof (cas->capBuffers));
+    cas->groundBuffer = 0;
+
+    cas->genBuffers    = NULL;
+    cas->deleteBuffers = NULL;
+    cas->bindBuffer    = NULL;
+    cas->bufferData    = NULL;
+
+    if (!extensions || !strstr (extensions, "GL_ARB_vertex_buffer_object"))
+	return;
+
+    cas->genBuffers = (CubeaddonGenBuffersProc)
+	(*s->getProcAddress) ((GLubyte *) "glGenBuffersARB");
+    cas->deleteBuffers = (CubeaddonDeleteBuffersProc)
+	(*s->getProcAddress) ((GLubyte *) "glDeleteBuffersARB");
+    cas->bindBuffer = (CubeaddonBindBufferProc)
+	(*s->getProcAddress) ((GLubyte *) "glBindBufferARB");
+    cas->bufferData = (CubeaddonBufferDataProc)
+	(*s->getProcAddress) ((GLubyte *) "glBufferDataARB");
+
+    if (!cas->genBuffers || !cas->deleteBuffers ||
+	!cas->bindBuffer || !cas->bufferData)
+    {
+	cas->genBuffers = NULL;
+	return;
+    }
+
+    (*cas->genBuffers) (CAP_BUFFER_NUM, cas->capBuffers);
+    (*cas->genBuffers) (1, &cas->groundBuffer);
+
+    /* the sphere cap indices never change */
+    (*cas->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB,
+			cas->capBuffers[CAP_BUFFER_INDEX]);
+    (*cas->bufferData) (GL_ELEMENT_ARRAY_BUFFER_ARB,
+			sizeof (cas->capFillIdx), cas->capFillIdx,
+			GL_STATIC_DRAW_ARB);
+    (*cas->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+}
+
+static void
+cubeaddonFiniBuffers (CompScreen *s)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (!cas->genBuffers)
+	return;
+
+    (*cas->deleteBuffers) (CAP_BUFFER_NUM, cas->capBuffers);
+    (*cas->deleteBuffers) (1, &cas->groundBuffer);
+}
+
+/*
+ * Copy the cap mesh to the vertex buffers after it was tessellated
+ */
+static void
+cubeaddonUploadCapBuffers (CompScreen *s)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (!cas->genBuffers)
+	return;
+
+    (*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB,
+			cas->capBuffers[CAP_BUFFER_VERTEX]);
+    (*cas->bufferData) (GL_ARRAY_BUFFER_ARB, sizeof (cas->capFill),
+			cas->capFill, GL_STATIC_DRAW_ARB);
+    (*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB,
+			cas->capBuffers[CAP_BUFFER_NORMAL]);
+    (*cas->bufferData) (GL_ARRAY_BUFFER_ARB, sizeof (cas->capFillNorm),
+			cas->capFillNorm, GL_STATIC_DRAW_ARB);
+    (*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+}
+
+/*
+ * Bind a cap array, returns the pointer to pass to gl*Pointer
+ */
+static const GLvoid *
+cubeaddonBindCapBuffer (CompScreen *s,
+			int        buffer,
+			GLvoid     *data)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (!cas->genBuffers)
+	return data;
+
+    (*cas->bindBuffer) ((buffer == CAP_BUFFER_INDEX) ?
+			GL_ELEMENT_ARRAY_BUFFER_ARB : GL_ARRAY_BUFFER_ARB,
+			cas->capBuffers[buffer]);
+
+    return NULL;
+}
+
+static void
+cubeaddonUnbindCapBuffers (CompScreen *s)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (!cas->genBuffers)
+	return;
+
+    (*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+    (*cas->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+}
+
+static void
+cubeaddonSetGroundVertex (CubeaddonGroundVertex *v,
+			  float                 x,
+			  float                 y,
+			  float                 r,
+			  float                 g,
+			  float                 b,
+			  float                 a)
+{
+    v->color[0] = r;
+    v->color[1] = g;
+    v->color[2] = b;
+    v->color[3] = a;
+    v->x        = x;
+    v->y        = y;
+}
+
+/*
+ * Rebuild the ground quads after one of the ground options changed
+ */
+static void
+cubeaddonUpdateGround (CompScreen *s)
+{
+    CubeaddonGroundVertex *v;
+    unsigned short        *c1, *c2;
+    float                 i, size;
+
+    CUBEADDON_SCREEN (s);
+
+    v    = cas->groundVertices;
+    i    = cubeaddonGetIntensity (s) * 2;
+    size = cubeaddonGetGroundSize (s);
+
+    cubeaddonSetGroundVertex (v++, 0.5, 0.0, 0.0, 0.0, 0.0,
+			      MAX (0.0, 1.0 - i));
+    cubeaddonSetGroundVertex (v++, -0.5, 0.0, 0.0, 0.0, 0.0,
+			      MAX (0.0, 1.0 - i));
+    cubeaddonSetGroundVertex (v++, -0.5, -0.5, 0.0, 0.0, 0.0,
+			      MIN (1.0, 1.0 - (i - 1.0)));
+    cubeaddonSetGroundVertex (v++, 0.5, -0.5, 0.0, 0.0, 0.0,
+			      MIN (1.0, 1.0 - (i - 1.0)));
+
+    if (size > 0.0)
+    {
+	c1 = cubeaddonGetGroundColor1 (s);
+	c2 = cubeaddonGetGroundColor2 (s);
+
+	cubeaddonSetGroundVertex (v++, -0.5, -0.5,
+				  c1[0] / 65535.0f, c1[1] / 65535.0f,
+				  c1[2] / 65535.0f, c1[3] / 65535.0f);
+	cubeaddonSetGroundVertex (v++, 0.5, -0.5,
+				  c1[0] / 65535.0f, c1[1] / 65535.0f,
+				  c1[2] / 65535.0f, c1[3] / 65535.0f);
+	cubeaddonSetGroundVertex (v++, 0.5, -0.5 + size,
+				  c2[0] / 65535.0f, c2[1] / 65535.0f,
+				  c2[2] / 65535.0f, c2[3] / 65535.0f);
+	cubeaddonSetGroundVertex (v++, -0.5, -0.5 + size,
+				  c2[0] / 65535.0f, c2[1] / 65535.0f,
+				  c2[2] / 65535.0f, c2[3] / 65535.0f);
+    }
+
+    cas->nGroundVertices = v - cas->groundVertices;
+    cas->groundChanged   = FALSE;
+
+    if (!cas->genBuffers)
+	return;
+
+    (*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB, cas->groundBuffer);
+    (*cas->bufferData) (GL_ARRAY_BUFFER_ARB,
+			cas->nGroundVertices * sizeof (CubeaddonGroundVertex),
+			cas->groundVertices, GL_STATIC_DRAW_ARB);
+    (*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+}
+
+static void
+cubeaddonGroundChanged (CompScreen             *s,
+			CompOption             *opt,
+			CubeaddonScreenOptions num)
+{
+    CUBEADDON_SCREEN (s);
+
+    cas->groundChanged = TRUE;
+}
+
 static void
 drawBasicGround (CompScreen *s)
 {
-    float i;
+    GLvoid *colors, *vertices;
+
+    CUBEADDON_SCREEN (s);
+
+    if (cas->groundChanged)
+	cubeaddonUpdateGround (s);
 
     glPushMatrix ();
 
@@ -414,29 +1336,34 @@ drawBasicGround (CompScreen *s)
     glLoadIdentity ();
     glTranslatef (0.0, 0.0, -DEFAULT_Z_CAMERA);
 
-    i = cubeaddonGetIntensity (s) * 2;
-
-    glBegin (GL_QUADS);
-    glColor4f (0.0, 0.0, 0.0, MAX (0.0, 1.0 - i) );
-    glVertex2f (0.5, 0.0);
-    glVertex2f (-0.5, 0.0);
-    glColor4f (0.0, 0.0, 0.0, MIN (1.0, 1.0 - (i - 1.0) ) );
-    glVertex2f (-0.5, -0.5);
-    glVertex2f (0.5, -0.5);
-    glEnd ();
+    if (cas->genBuffers)
+    {
+	(*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB, cas->groundBuffer);
 
-    if (cubeaddonGetGroundSize (s) > 0.0)
+	/* offsets into the bound buffer */
+	colors   = (GLvoid *) offsetof (CubeaddonGroundVertex, color);
+	vertices = (GLvoid *) offsetof (CubeaddonGroundVertex, x);
+    }
+    else
     {
-	glBegin (GL_QUADS);
-	glColor4usv (cubeaddonGetGroundColor1 (s) );
-	glVertex2f (-0.5, -0.5);
-	glVertex2f (0.5, -0.5);
-	glColor4usv (cubeaddonGetGroundColor2 (s) );
-	glVertex2f (0.5, -0.5 + cubeaddonGetGroundSize (s) );
-	glVertex2f (-0.5, -0.5 + cubeaddonGetGroundSize (s) );
-	glEnd ();
+	colors   = cas->groundVertices[0].color;
+	vertices = &cas->groundVertices[0].x;
     }
 
+    glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState (GL_COLOR_ARRAY);
+
+    glColorPointer (4, GL_FLOAT, sizeof (CubeaddonGroundVertex), colors);
+    glVertexPointer (2, GL_FLOAT, sizeof (CubeaddonGroundVertex), vertices);
+
+    glDrawArrays (GL_QUADS, 0, cas->nGroundVertices);
+
+    glDisableClientState (GL_COLOR_ARRAY);
+    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+
+    if (cas->genBuffers)
+	(*cas->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+
     glColor4usv (defaultColor);
 
     glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -444,6 +1371,81 @@ drawBasicGround (CompScreen *s)
     glPopMatrix ();
 }
 
+/*
+ * Draw the ground over the reflection, above mode with a vertical
+ * rotation uses its own fading
+ */
+static void
+cubeaddonPaintGround (CompScreen *s,
+		      Bool       above)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (above)
+    {
+	int   j;
+	float i, c;
+	float v = MIN (1.0, cas->vRot / 30.0);
+	float col1[4], col2[4];
+
+	glPushMatrix ();
+
+	glEnable (GL_BLEND);
+	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glLoadIdentity ();
+	glTranslatef (0.0, 0.0, -DEFAULT_Z_CAMERA);
+
+	i = cubeaddonGetIntensity (s) * 2;
+	c = cubeaddonGetIntensity (s);
+
+	glBegin (GL_QUADS);
+	glColor4f (0.0, 0.0, 0.0,
+		   ((1 - v) * MAX (0.0, 1.0 - i)) + (v * c));
+	glVertex2f (0.5, v / 2.0);
+	glVertex2f (-0.5, v / 2.0);
+	glColor4f (0.0, 0.0, 0.0,
+		   ((1 - v) * MIN (1.0, 1.0 - (i - 1.0))) + (v * c));
+	glVertex2f (-0.5, -0.5);
+	glVertex2f (0.5, -0.5);
+	glEnd ();
+
+	for (j = 0; j < 4; j++)
+	{
+	    col1[j] = (1.0 - v) * cubeaddonGetGroundColor1 (s) [j] +
+		      (v * (cubeaddonGetGroundColor1 (s) [j] +
+			    cubeaddonGetGroundColor2 (s) [j]) * 0.5);
+	    col1[j] /= 0xffff;
+	    col2[j] = (1.0 - v) * cubeaddonGetGroundColor2 (s) [j] +
+		      (v * (cubeaddonGetGroundColor1 (s) [j] +
+			    cubeaddonGetGroundColor2 (s) [j]) * 0.5);
+	    col2[j] /= 0xffff;
+	}
+
+	if (cubeaddonGetGroundSize (s) > 0.0)
+	{
+	    glBegin (GL_QUADS);
+	    glColor4fv (col1);
+	    glVertex2f (-0.5, -0.5);
+	    glVertex2f (0.5, -0.5);
+	    glColor4fv (col2);
+	    glVertex2f (0.5, -0.5 +
+			((1 - v) * cubeaddonGetGroundSize (s)) + v);
+	    glVertex2f (-0.5, -0.5 +
+			((1 - v) * cubeaddonGetGroundSize (s)) + v);
+	    glEnd ();
+	}
+
+	glColor4usv (defaultColor);
+
+	glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable (GL_BLEND);
+	glPopMatrix ();
+    }
+    else
+	drawBasicGround (s);
+}
+
 static Bool
 cubeaddonCheckOrientation (CompScreen              *s,
 			   const ScreenPaintAttrib *sAttrib,
@@ -497,15 +1499,24 @@ cubeaddonClearTargetOutput (CompScreen *s,
     CUBEADDON_SCREEN (s);
     CUBE_SCREEN (s);
 
+    /* the offscreen copy of the cube needs a transparent
+       background, it is cleared in cubeaddonEndFboReflection */
+    if (cas->fboPass)
+	return;
+
+    glStateInvalidate (&cas->glState);
+
     if (cas->reflection)
-	glCullFace (GL_BACK);
+	glStateCullFace (&cas->glState, GL_BACK);
 
     UNWRAP (cas, cs, clearTargetOutput);
     (*cs->clearTargetOutput) (s, xRotate, cas->backVRotate);
     WRAP (cas, cs, clearTargetOutput, cubeaddonClearTargetOutput);
 
+    glStateInvalidate (&cas->glState);
+
     if (cas->reflection)
-	glCullFace (GL_FRONT);
+	glStateCullFace (&cas->glState, GL_FRONT);
 }
 
 static Bool
@@ -610,8 +1621,8 @@ cubeaddonPaintCap (CompScreen		   *s,
     ScreenPaintAttrib sa;
     CompTransform     sTransform;
     int               i, l, opacity;
-    int               cullNorm, cullInv;
-    Bool              wasCulled = glIsEnabled (GL_CULL_FACE);
+    GLenum            cullNorm, cullInv;
+    Bool              wasCulled;
     float             cInv = (top) ? 1.0: -1.0;
     CubeCap           *cap;
     Bool              cAspect;
@@ -619,13 +1630,18 @@ cubeaddonPaintCap (CompScreen		   *s,
     CUBE_SCREEN (s);
     CUBEADDON_SCREEN (s);
 
-    glGetIntegerv (GL_CULL_FACE_MODE, &cullNorm);
+    /* cube, 3d and gears change the culling before the caps are
+       painted, so it has to be asked from GL here */
+    glStateInvalidate (&cas->glState);
+
+    wasCulled = glStateIsEnabled (&cas->glState, GL_CULL_FACE);
+    cullNorm  = glStateGetCullFace (&cas->glState);
     cullInv   = (cullNorm == GL_BACK)? GL_FRONT : GL_BACK;
 
     opacity = cs->desktopOpacity * color[3] / 0xffff;
 
     glPushMatrix ();
-    glEnable (GL_BLEND);
+    glStateEnable (&cas->glState, GL_BLEND);
 
     if (top)
     {
@@ -643,23 +1659,31 @@ cubeaddonPaintCap (CompScreen		   *s,
 
     if (cubeaddonGetDeformation (s) == DeformationSphere &&
         cubeaddonGetDeformCaps (s))
-	glEnableClientState (GL_NORMAL_ARRAY);
+	glStateEnable (&cas->glState, GL_NORMAL_ARRAY);
 
-    glVertexPointer (3, GL_FLOAT, 0, cas->capFill);
+    glVertexPointer (3, GL_FLOAT, 0,
+		     cubeaddonBindCapBuffer (s, CAP_BUFFER_VERTEX, cas->capFill));
 
-    glEnable(GL_CULL_FACE);
+    glStateEnable (&cas->glState, GL_CULL_FACE);
 
     for (l = 0; l < ((cs->invert == 1) ? 2 : 1); l++)
     {
 	if (cubeaddonGetDeformation (s) == DeformationSphere &&
 	    cubeaddonGetDeformCaps (s))
 	{
-	    glNormalPointer (GL_FLOAT, 0, (l == 0) ? cas->capFill : cas->capFillNorm);
+	    if (l == 0)
+		glNormalPointer (GL_FLOAT, 0,
+				 cubeaddonBindCapBuffer (s, CAP_BUFFER_VERTEX,
+							 cas->capFill));
+	    else
+		glNormalPointer (GL_FLOAT, 0,
+				 cubeaddonBindCapBuffer (s, CAP_BUFFER_NORMAL,
+							 cas->capFillNorm));
 	}
 	else
 	    glNormal3f (0.0, (l == 0) ? 1.0 : -1.0, 0.0);
 
-	glCullFace(((l == 1) ^ top) ? cullInv : cullNorm);
+	glStateCullFace (&cas->glState, ((l == 1) ^ top) ? cullInv : cullNorm);
 
 	for (i = 0; i < size; i++)
 	{
@@ -697,7 +1721,8 @@ cubeaddonPaintCap (CompScreen		   *s,
 	    if (cubeaddonGetDeformation (s) == DeformationSphere &&
 	        cubeaddonGetDeformCaps (s))
 		glDrawElements (GL_QUADS, CAP_NIDX, GL_UNSIGNED_SHORT,
-				cas->capFillIdx);
+				cubeaddonBindCapBuffer (s, CAP_BUFFER_INDEX,
+							cas->capFillIdx));
 
 	    if (cap->loaded)
 	    {
@@ -710,6 +1735,9 @@ cubeaddonPaintCap (CompScreen		   *s,
 		glColor4us (cs->desktopOpacity, cs->desktopOpacity,
 		    cs->desktopOpacity, cs->desktopOpacity);
 	        enableTexture (s, &cap->texture, COMP_TEXTURE_FILTER_GOOD);
+		if (cap->mipmap)
+		    glTexParameteri (cap->texture.target, GL_TEXTURE_MIN_FILTER,
+				     GL_LINEAR_MIPMAP_LINEAR);
 
 		if (cAspect)
 		{
@@ -761,7 +1789,8 @@ cubeaddonPaintCap (CompScreen		   *s,
 		if (cubeaddonGetDeformation (s) == DeformationSphere &&
 	            cubeaddonGetDeformCaps (s))
 		    glDrawElements (GL_QUADS, CAP_NIDX, GL_UNSIGNED_SHORT,
-				    cas->capFillIdx);
+				    cubeaddonBindCapBuffer (s, CAP_BUFFER_INDEX,
+							    cas->capFillIdx));
 
 		glDisable(GL_TEXTURE_GEN_S);
 		glDisable(GL_TEXTURE_GEN_T);
@@ -770,14 +1799,16 @@ cubeaddonPaintCap (CompScreen		   *s,
 	}
     }
 
+    cubeaddonUnbindCapBuffers (s);
+
     glEnableClientState (GL_TEXTURE_COORD_ARRAY);
-    glDisableClientState (GL_NORMAL_ARRAY);
-    glDisable (GL_BLEND);
+    glStateDisable (&cas->glState, GL_NORMAL_ARRAY);
+    glStateDisable (&cas->glState, GL_BLEND);
     glNormal3f (0.0, -1.0, 0.0);
 
-    glCullFace (cullNorm);
+    glStateCullFace (&cas->glState, cullNorm);
     if (!wasCulled)
-	glDisable (GL_CULL_FACE);
+	glStateDisable (&cas->glState, GL_CULL_FACE);
 
     glPopMatrix ();
 
@@ -802,43 +1833,193 @@ cubeaddonPaintTop (CompScreen		   *s,
 	WRAP (cas, cs, paintTop, cubeaddonPaintTop);
     }
 
-    if (!cubeaddonGetDrawTop (s))
-        return;
+    if (!cubeaddonGetDrawTop (s))
+        return;
+
+    cubeaddonPaintCap (s, sAttrib, transform, output, size, TRUE,
+		       cubeaddonGetAdjustTop (s),
+		       cubeaddonGetTopColor(s));
+}
+
+/*
+ * Paint bottom cube face
+ */
+static void
+cubeaddonPaintBottom (CompScreen	      *s,
+		      const ScreenPaintAttrib *sAttrib,
+		      const CompTransform     *transform,
+		      CompOutput	      *output,
+		      int		      size)
+{
+    CUBE_SCREEN (s);
+    CUBEADDON_SCREEN (s);
+
+    if ((!cubeaddonGetDrawBottom (s) && cs->invert == 1) ||
+        (!cubeaddonGetDrawTop (s) && cs->invert == -1))
+    {
+	UNWRAP (cas, cs, paintBottom);
+	(*cs->paintBottom) (s, sAttrib, transform, output, size);
+	WRAP (cas, cs, paintBottom, cubeaddonPaintBottom);
+    }
+
+    if (!cubeaddonGetDrawBottom (s))
+        return;
+
+    cubeaddonPaintCap (s, sAttrib, transform, output, size, FALSE,
+		       cubeaddonGetAdjustBottom (s),
+		       cubeaddonGetBottomColor(s));
+}
+
+static void
+cubeaddonComputeDeformColumn (CubeaddonDeformCache  *cache,
+			      float                 x,
+			      CubeaddonDeformColumn *column)
+{
+    float a1, ang;
+
+    a1 = ((x - cache->sx1) / (float) cache->sw) - 0.5;
+
+    if (cache->cylinder)
+    {
+	ang = a1 * a1;
+	column->inside = (ang < cache->radSquare);
+	if (column->inside)
+	    column->z = sqrtf (cache->radSquare - ang) - cache->distance;
+    }
+    else
+    {
+	ang = atanf (a1 / cache->distance);
+
+	column->a1     = a1;
+	column->sinAng = sinf (ang);
+	column->cosAng = cosf (ang);
+	column->inside = TRUE;
+    }
+}
+
+static float
+cubeaddonComputeDeformRow (CubeaddonDeformCache *cache,
+			   float                y)
+{
+    float a2;
+
+    a2 = ((y - cache->sy1) / (float) cache->sh) - 0.5;
+
+    return sqrtf (cache->radSquare - (a2 * a2));
+}
+
+/*
+ * Returns the deformation tables for the given output geometry,
+ * (re)building them only if none of the cached ones matches.
+ */
+static CubeaddonDeformCache *
+cubeaddonGetDeformCache (CompScreen *s,
+			 Bool       cylinder,
+			 int        sx1,
+			 int        sw,
+			 int        sy1,
+			 int        sh,
+			 float      radSquare)
+{
+    CubeaddonDeformCache *cache, *oldest = NULL;
+    int                  i, nColumns, nRows;
+
+    CUBEADDON_SCREEN (s);
+    CUBE_SCREEN (s);
+
+    for (i = 0; i < DEFORM_CACHE_SIZE; i++)
+    {
+	cache = &cas->deformCache[i];
+
+	if (cache->valid && cache->cylinder == cylinder &&
+	    cache->sx1 == sx1 && cache->sw == sw &&
+	    cache->sy1 == sy1 && cache->sh == sh &&
+	    cache->distance == cs->distance && cache->radSquare == radSquare)
+	{
+	    cache->lastUsed = cas->deformCacheClock++;
+	    return cache;
+	}
+
+	/* prefer unused entries, then the least recently used one */
+	if (!oldest)
+	    oldest = cache;
+	else if (!cache->valid)
+	{
+	    if (oldest->valid)
+		oldest = cache;
+	}
+	else if (oldest->valid && cache->lastUsed < oldest->lastUsed)
+	    oldest = cache;
+    }
+
+    cache = oldest;
+
+    nColumns = sw + (2 * CUBEADDON_GRID_SIZE);
+    nRows    = (cylinder) ? 0 : sh + (2 * CUBEADDON_GRID_SIZE);
+
+    if (cache->nColumns < nColumns)
+    {
+	CubeaddonDeformColumn *columns;
+
+	columns = realloc (cache->columns,
+			   nColumns * sizeof (CubeaddonDeformColumn));
+	if (!columns)
+	    return NULL;
+
+	cache->columns  = columns;
+	cache->nColumns = nColumns;
+    }
+
+    if (cache->nRows < nRows)
+    {
+	GLfloat *rows;
+
+	rows = realloc (cache->rows, nRows * sizeof (GLfloat));
+	if (!rows)
+	    return NULL;
+
+	cache->rows  = rows;
+	cache->nRows = nRows;
+    }
+
+    cache->cylinder  = cylinder;
+    cache->sx1       = sx1;
+    cache->sw        = sw;
+    cache->sy1       = sy1;
+    cache->sh        = sh;
+    cache->distance  = cs->distance;
+    cache->radSquare = radSquare;
 
-    cubeaddonPaintCap (s, sAttrib, transform, output, size, TRUE,
-		       cubeaddonGetAdjustTop (s),
-		       cubeaddonGetTopColor(s));
+    for (i = 0; i < nColumns; i++)
+	cubeaddonComputeDeformColumn (cache, sx1 - CUBEADDON_GRID_SIZE + i,
+				      &cache->columns[i]);
+
+    for (i = 0; i < nRows; i++)
+	cache->rows[i] =
+	    cubeaddonComputeDeformRow (cache, sy1 - CUBEADDON_GRID_SIZE + i);
+
+    cache->valid    = TRUE;
+    cache->lastUsed = cas->deformCacheClock++;
+
+    return cache;
 }
 
-/*
- * Paint bottom cube face
- */
 static void
-cubeaddonPaintBottom (CompScreen	      *s,
-		      const ScreenPaintAttrib *sAttrib,
-		      const CompTransform     *transform,
-		      CompOutput	      *output,
-		      int		      size)
+cubeaddonFiniDeformCache (CompScreen *s)
 {
-    CUBE_SCREEN (s);
+    int i;
+
     CUBEADDON_SCREEN (s);
 
-    if ((!cubeaddonGetDrawBottom (s) && cs->invert == 1) ||
-        (!cubeaddonGetDrawTop (s) && cs->invert == -1))
+    for (i = 0; i < DEFORM_CACHE_SIZE; i++)
     {
-	UNWRAP (cas, cs, paintBottom);
-	(*cs->paintBottom) (s, sAttrib, transform, output, size);
-	WRAP (cas, cs, paintBottom, cubeaddonPaintBottom);
+	if (cas->deformCache[i].columns)
+	    free (cas->deformCache[i].columns);
+	if (cas->deformCache[i].rows)
+	    free (cas->deformCache[i].rows);
     }
-
-    if (!cubeaddonGetDrawBottom (s))
-        return;
-
-    cubeaddonPaintCap (s, sAttrib, transform, output, size, FALSE,
-		       cubeaddonGetAdjustBottom (s),
-		       cubeaddonGetBottomColor(s));
 }
-	
+
 static void
 cubeaddonAddWindowGeometry (CompWindow *w,
 			    CompMatrix *matrix,
@@ -853,18 +2034,23 @@ cubeaddonAddWindowGeometry (CompWindow *w,
 
     if (cas->deform > 0.0)
     {
-	int         x1, x2, y1, y2, yi, i, j, oldVCount = w->vCount;
+	int         x1, x2, y1, y2, yi, i, oldVCount = w->vCount;
 	REGION      reg;
 	GLfloat     *v;
 	int         offX = 0, offY = 0;
-	int         sx1, sx2, sw, sy1, sy2, sh, nBox, currBox, cLast;
-	float       lastX, lastZ = 0.0, radSquare, last[2][4];
-	Bool        found;
+	int         sx1, sx2, sw, sy1, sy2, sh, nBox, currBox;
+	int         ix, iy;
+	float       x, y, radSquare, a2;
+	Bool        cylinder;
 	float       inv = (cs->invert == 1) ? 1.0 : -1.0;
 
-	float       a1, a2, ang;
+	CubeaddonDeformCache  *cache;
+	CubeaddonDeformColumn *column, tmpColumn;
 
-	if (cubeaddonGetDeformation (s) == DeformationCylinder || cs->unfolded)
+	cylinder = (cubeaddonGetDeformation (s) == DeformationCylinder ||
+		    cs->unfolded);
+
+	if (cylinder)
 	{
 	    yi = region->extents.y2 - region->extents.y1;
 	    radSquare = (cs->distance * cs->distance) + 0.25;
@@ -1005,76 +2191,55 @@ cubeaddonAddWindowGeometry (CompWindow *w,
 	    }
 	}
 
-	if (cubeaddonGetDeformation (s) == DeformationCylinder || cs->unfolded)
-	{
-	    lastX = -1000000000.0;
-	
-	    for (i = oldVCount; i < w->vCount; i++)
-	    {
-		if (v[0] == lastX)
-		{
-		    v[2] = lastZ;
-		}
-		else if (v[0] + offX >= sx1 - CUBEADDON_GRID_SIZE &&
-			 v[0] + offX < sx2 + CUBEADDON_GRID_SIZE)
-		{
-		    ang = (((v[0] + offX - sx1) / (float)sw) - 0.5);
-		    ang *= ang;
-		    if (ang < radSquare)
-		    {
-			v[2] = sqrtf (radSquare - ang) - cs->distance;
-			v[2] *= cas->deform * inv;
-		    }
-		}
+	cache = cubeaddonGetDeformCache (s, cylinder, sx1, sw, sy1, sh,
+					 radSquare);
+	if (!cache)
+	    return;
 
-		lastX = v[0];
-		lastZ = v[2];
+	/* vertices usually are on integer positions, so they can use
+	   the precomputed values, others are computed directly */
+	for (i = oldVCount; i < w->vCount; i++)
+	{
+	    x = v[0] + offX;
+	    y = v[1] + offY;
 
+	    if (x < sx1 - CUBEADDON_GRID_SIZE || x >= sx2 + CUBEADDON_GRID_SIZE)
+	    {
 		v += w->vertexStride;
+		continue;
 	    }
-	}
-	else
-	{
-
-	    last[0][0] = -1000000000.0;
-	    last[1][0] = -1000000000.0;
 
-	    cLast = 0;
-	    for (i = oldVCount; i < w->vCount; i++)
+	    ix = x;
+	    if (ix == x)
 	    {
-		found = FALSE;
+		column = &cache->columns[ix - sx1 + CUBEADDON_GRID_SIZE];
+	    }
+	    else
+	    {
+		cubeaddonComputeDeformColumn (cache, x, &tmpColumn);
+		column = &tmpColumn;
+	    }
 
-		for (j = 0; j < 2 && !found; j++)
-		    if (last[j][0] == v[0] && last[j][1] == v[1])
-		    {
-			v[0] = last[j][2];
-			v[2] = last[j][3];
-			found = TRUE;
-		    }
+	    if (cylinder)
+	    {
+		if (column->inside)
+		    v[2] = column->z * cas->deform * inv;
+	    }
+	    else if (y >= sy1 - CUBEADDON_GRID_SIZE &&
+		     y < sy2 + CUBEADDON_GRID_SIZE)
+	    {
+		iy = y;
+		if (iy == y)
+		    a2 = cache->rows[iy - sy1 + CUBEADDON_GRID_SIZE];
+		else
+		    a2 = cubeaddonComputeDeformRow (cache, y);
 
-		if (!found && v[0] + offX >= sx1 - CUBEADDON_GRID_SIZE &&
-		    v[0] + offX < sx2 + CUBEADDON_GRID_SIZE &&
-		    v[1] + offY >= sy1 - CUBEADDON_GRID_SIZE &&
-		    v[1] + offY < sy2 + CUBEADDON_GRID_SIZE)
-		{
-		    last[cLast][0] = v[0];
-		    last[cLast][1] = v[1];
-		    a1 = (((v[0] + offX - sx1) / (float)sw) - 0.5);
-		    a2 = (((v[1] + offY - sy1) / (float)sh) - 0.5);
-		    a2 *= a2;
-
-		    ang = atanf (a1 / cs->distance);
-		    a2 = sqrtf (radSquare - a2);
-
-		    v[2] += ((cosf (ang) * a2) - cs->distance) *
-			    cas->deform * inv;
-		    v[0] += ((sinf (ang) * a2) - a1) * sw * cas->deform;
-		    last[cLast][2] = v[0];
-		    last[cLast][3] = v[2];
-		    cLast = (cLast + 1) & 1;
-		}
-		v += w->vertexStride;
+		v[2] += ((column->cosAng * a2) - cs->distance) *
+		        cas->deform * inv;
+		v[0] += ((column->sinAng * a2) - column->a1) * sw * cas->deform;
 	    }
+
+	    v += w->vertexStride;
 	}
     }
     else
@@ -1248,6 +2413,378 @@ cubeaddonDrawWindowTexture (CompWindow	         *w,
     WRAP (cas, s, drawWindowTexture, cubeaddonDrawWindowTexture);
 }
 
+static void
+cubeaddonFiniReflectionFbo (CompScreen *s)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (cas->reflectionFbo)
+	(*s->deleteFramebuffers) (1, &cas->reflectionFbo);
+    if (cas->reflectionTexture)
+	glDeleteTextures (1, &cas->reflectionTexture);
+    if (cas->reflectionDepth)
+	(*cas->rb.deleteRenderbuffers) (1, &cas->reflectionDepth);
+
+    cas->reflectionFbo     = 0;
+    cas->reflectionTexture = 0;
+    cas->reflectionDepth   = 0;
+}
+
+static void
+cubeaddonFiniReflectionBlur (CompScreen *s)
+{
+    CUBEADDON_SCREEN (s);
+
+    if (cas->reflectionBlurFbo)
+	(*s->deleteFramebuffers) (1, &cas->reflectionBlurFbo);
+    if (cas->reflectionBlurTexture)
+	glDeleteTextures (1, &cas->reflectionBlurTexture);
+
+    cas->reflectionBlurFbo     = 0;
+    cas->reflectionBlurTexture = 0;
+}
+
+/*
+ * Create the offscreen buffer for the single pass reflection, or
+ * resize it to the current screen size
+ */
+static Bool
+cubeaddonInitReflectionFbo (CompScreen *s)
+{
+    int    texWidth, texHeight;
+    GLint  oldFbo;
+    GLenum status;
+
+    CUBEADDON_SCREEN (s);
+
+    if (!s->fbo || cas->noReflectionFbo)
+	return FALSE;
+
+    /* the cube, the caps and 3d windows are depth tested */
+    if (!renderbufferProcsInit (s, &cas->rb))
+    {
+	compLogMessage ("cubeaddon", CompLogLevelWarn,
+			"No renderbuffer support, "
+			"falling back to two pass reflection");
+
+	cas->noReflectionFbo = TRUE;
+	return FALSE;
+    }
+
+    if (cas->reflectionFbo && cas->reflectionWidth == s->width &&
+	cas->reflectionHeight == s->height)
+	return TRUE;
+
+    texWidth  = s->width;
+    texHeight = s->height;
+
+    if (!s->textureNonPowerOfTwo)
+    {
+	for (texWidth = 1; texWidth < s->width; texWidth <<= 1);
+	for (texHeight = 1; texHeight < s->height; texHeight <<= 1);
+    }
+
+    if (!cas->reflectionTexture)
+	glGenTextures (1, &cas->reflectionTexture);
+    if (!cas->reflectionDepth)
+	(*cas->rb.genRenderbuffers) (1, &cas->reflectionDepth);
+    if (!cas->reflectionFbo)
+	(*s->genFramebuffers) (1, &cas->reflectionFbo);
+
+    glBindTexture (GL_TEXTURE_2D, cas->reflectionTexture);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, texWidth, texHeight, 0,
+		  GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &oldFbo);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, cas->reflectionFbo);
+    (*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+				cas->reflectionTexture, 0);
+    renderbufferAttachDepth (&cas->rb, cas->reflectionDepth,
+			     texWidth, texHeight);
+    status = (*s->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, oldFbo);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+	compLogMessage ("cubeaddon", CompLogLevelWarn,
+			"Offscreen reflection buffer incomplete, "
+			"falling back to two pass reflection");
+
+	cubeaddonFiniReflectionFbo (s);
+	cas->noReflectionFbo = TRUE;
+	return FALSE;
+    }
+
+    cas->reflectionWidth     = s->width;
+    cas->reflectionHeight    = s->height;
+    cas->reflectionTexWidth  = texWidth;
+    cas->reflectionTexHeight = texHeight;
+
+    return TRUE;
+}
+
+/*
+ * Create the downscaled copy of the offscreen buffer, or resize it to
+ * the current offscreen buffer size
+ */
+static Bool
+cubeaddonInitReflectionBlur (CompScreen *s)
+{
+    int    width, height;
+    GLint  oldFbo;
+    GLenum status;
+
+    CUBEADDON_SCREEN (s);
+
+    if (cas->noReflectionBlur)
+	return FALSE;
+
+    width  = MAX (1, cas->reflectionTexWidth / REFLECTION_BLUR_SCALE);
+    height = MAX (1, cas->reflectionTexHeight / REFLECTION_BLUR_SCALE);
+
+    if (cas->reflectionBlurFbo && cas->reflectionBlurWidth == width &&
+	cas->reflectionBlurHeight == height)
+	return TRUE;
+
+    if (!cas->reflectionBlurTexture)
+	glGenTextures (1, &cas->reflectionBlurTexture);
+    if (!cas->reflectionBlurFbo)
+	(*s->genFramebuffers) (1, &cas->reflectionBlurFbo);
+
+    glBindTexture (GL_TEXTURE_2D, cas->reflectionBlurTexture);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+		  GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &oldFbo);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, cas->reflectionBlurFbo);
+    (*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+				cas->reflectionBlurTexture, 0);
+    status = (*s->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, oldFbo);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+	compLogMessage ("cubeaddon", CompLogLevelWarn,
+			"Reflection blur buffer incomplete, "
+			"painting the reflection unblurred");
+
+	cubeaddonFiniReflectionBlur (s);
+	cas->noReflectionBlur = TRUE;
+	return FALSE;
+    }
+
+    cas->reflectionBlurWidth  = width;
+    cas->reflectionBlurHeight = height;
+
+    return TRUE;
+}
+
+/*
+ * Scale the offscreen buffer down into the blur texture. Magnifying
+ * that copy again with linear filtering blurs the reflection, at a
+ * fraction of the fill rate of the full size buffer.
+ */
+static void
+cubeaddonDownscaleReflection (CompScreen *s)
+{
+    GLint viewport[4];
+
+    CUBEADDON_SCREEN (s);
+
+    glGetIntegerv (GL_VIEWPORT, viewport);
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, cas->reflectionBlurFbo);
+    glViewport (0, 0, cas->reflectionBlurWidth, cas->reflectionBlurHeight);
+
+    glMatrixMode (GL_PROJECTION);
+    glPushMatrix ();
+    glLoadIdentity ();
+    glMatrixMode (GL_MODELVIEW);
+    glPushMatrix ();
+    glLoadIdentity ();
+
+    glEnable (GL_TEXTURE_2D);
+    glBindTexture (GL_TEXTURE_2D, cas->reflectionTexture);
+
+    glBegin (GL_QUADS);
+    glTexCoord2f (0.0, 0.0);
+    glVertex2f (-1.0, -1.0);
+    glTexCoord2f (1.0, 0.0);
+    glVertex2f (1.0, -1.0);
+    glTexCoord2f (1.0, 1.0);
+    glVertex2f (1.0, 1.0);
+    glTexCoord2f (0.0, 1.0);
+    glVertex2f (-1.0, 1.0);
+    glEnd ();
+
+    glBindTexture (GL_TEXTURE_2D, 0);
+    glDisable (GL_TEXTURE_2D);
+
+    glMatrixMode (GL_PROJECTION);
+    glPopMatrix ();
+    glMatrixMode (GL_MODELVIEW);
+    glPopMatrix ();
+
+    glViewport (viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+/*
+ * Redirect painting of the cube into the offscreen buffer, returns
+ * the previously bound framebuffer
+ */
+static GLint
+cubeaddonBeginFboReflection (CompScreen *s)
+{
+    GLint   oldFbo;
+    GLfloat clearColor[4];
+
+    CUBEADDON_SCREEN (s);
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &oldFbo);
+    glGetFloatv (GL_COLOR_CLEAR_VALUE, clearColor);
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, cas->reflectionFbo);
+
+    glClearColor (0.0f, 0.0f, 0.0f, 0.0f);
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+	     GL_STENCIL_BUFFER_BIT);
+    glClearColor (clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+    cas->fboPass = TRUE;
+
+    return oldFbo;
+}
+
+/*
+ * Single pass reflection: the cube painted once into the offscreen
+ * buffer is drawn mirrored at the ground line and on top of it
+ * unmodified. The mirror line is where the bottom center of the cube
+ * and its mirror image meet on screen, so the reflection doesn't have
+ * the correct perspective of the two pass mode.
+ */
+static void
+cubeaddonEndFboReflection (CompScreen              *s,
+			   GLint                   oldFbo,
+			   const ScreenPaintAttrib *sAttrib,
+			   const CompTransform     *transform,
+			   const CompTransform     *rTransform,
+			   CompOutput              *output,
+			   Bool                    aboveGround)
+{
+    CompTransform sTransform, projection, pTransform;
+    CompVector    point = { .v = { 0.0, -0.5, 0.0, 1.0 } };
+    CompVector    real, mirror;
+    float         xRot, vRot, progress, line;
+    float         tx1, tx2, ty1, ty2, tyLine;
+    Bool          blur;
+
+    CUBEADDON_SCREEN (s);
+    CUBE_SCREEN (s);
+
+    cas->fboPass = FALSE;
+
+    blur = cubeaddonGetReflectionBlur (s) && cubeaddonInitReflectionBlur (s);
+    if (blur)
+	cubeaddonDownscaleReflection (s);
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, oldFbo);
+
+    /* the background wasn't painted to the real target yet */
+    (*cs->getRotation) (s, &xRot, &vRot, &progress);
+    (*cs->clearTargetOutput) (s, xRot, vRot);
+
+    /* find the mirror line on screen */
+    matrixGetIdentity (&pTransform);
+    (*s->applyScreenTransform) (s, sAttrib, output, &pTransform);
+    memcpy (projection.m, s->projection, sizeof (projection.m));
+
+    matrixMultiply (&sTransform, transform, &pTransform);
+    matrixMultiply (&sTransform, &projection, &sTransform);
+    matrixMultiplyVector (&real, &point, &sTransform);
+
+    matrixMultiply (&sTransform, rTransform, &pTransform);
+    matrixMultiply (&sTransform, &projection, &sTransform);
+    matrixMultiplyVector (&mirror, &point, &sTransform);
+
+    if (real.w == 0.0 || mirror.w == 0.0)
+	line = -0.5;
+    else
+	line = ((real.y / real.w) + (mirror.y / mirror.w)) / 4.0;
+
+    tx1 = (float) output->region.extents.x1 / cas->reflectionTexWidth;
+    tx2 = (float) output->region.extents.x2 / cas->reflectionTexWidth;
+    ty1 = (float) (s->height - output->region.extents.y2) /
+	  cas->reflectionTexHeight;
+    ty2 = (float) (s->height - output->region.extents.y1) /
+	  cas->reflectionTexHeight;
+    tyLine = ty1 + ((line + 0.5) * (ty2 - ty1));
+
+    glPushMatrix ();
+    glLoadIdentity ();
+    glTranslatef (0.0, 0.0, -DEFAULT_Z_CAMERA);
+
+    glEnable (GL_BLEND);
+    glEnable (GL_TEXTURE_2D);
+    glBindTexture (GL_TEXTURE_2D, (blur) ? cas->reflectionBlurTexture :
+					   cas->reflectionTexture);
+
+    /* mirrored copy, the top of the cube ends up at the bottom */
+    glBegin (GL_QUADS);
+    glTexCoord2f (tx1, ty2);
+    glVertex2f (-0.5, (2.0 * line) - 0.5);
+    glTexCoord2f (tx2, ty2);
+    glVertex2f (0.5, (2.0 * line) - 0.5);
+    glTexCoord2f (tx2, tyLine);
+    glVertex2f (0.5, line);
+    glTexCoord2f (tx1, tyLine);
+    glVertex2f (-0.5, line);
+    glEnd ();
+
+    glBindTexture (GL_TEXTURE_2D, 0);
+    glDisable (GL_TEXTURE_2D);
+    glDisable (GL_BLEND);
+    glPopMatrix ();
+
+    cubeaddonPaintGround (s, aboveGround);
+
+    /* and the cube itself on top */
+    glPushMatrix ();
+    glLoadIdentity ();
+    glTranslatef (0.0, 0.0, -DEFAULT_Z_CAMERA);
+
+    glEnable (GL_BLEND);
+    glEnable (GL_TEXTURE_2D);
+    glBindTexture (GL_TEXTURE_2D, cas->reflectionTexture);
+
+    glBegin (GL_QUADS);
+    glTexCoord2f (tx1, ty1);
+    glVertex2f (-0.5, -0.5);
+    glTexCoord2f (tx2, ty1);
+    glVertex2f (0.5, -0.5);
+    glTexCoord2f (tx2, ty2);
+    glVertex2f (0.5, 0.5);
+    glTexCoord2f (tx1, ty2);
+    glVertex2f (-0.5, 0.5);
+    glEnd ();
+
+    glBindTexture (GL_TEXTURE_2D, 0);
+    glDisable (GL_TEXTURE_2D);
+    glDisable (GL_BLEND);
+    glPopMatrix ();
+}
+
 static void
 cubeaddonPaintTransformedOutput (CompScreen              *s,
 				 const ScreenPaintAttrib *sAttrib,
@@ -1258,10 +2795,15 @@ cubeaddonPaintTransformedOutput (CompScreen              *s,
 {
     static GLfloat light0Position[] = { -0.5f, 0.5f, -9.0f, 1.0f };
     CompTransform  sTransform = *transform;
+    CompTransform  rTransform;
+    Bool           fboReflection = FALSE, aboveGround = FALSE;
+    GLint          oldFbo = 0;
 
     CUBEADDON_SCREEN (s);
     CUBE_SCREEN (s);
 
+    glStateInvalidate (&cas->glState);
+
     if (cubeaddonGetDeformation (s) != DeformationNone
 	&& s->hsize * cs->nOutput > 2 && s->desktopWindowCount &&
 	(cs->rotationState == RotationManual ||
@@ -1397,6 +2939,8 @@ cubeaddonPaintTransformedOutput (CompScreen              *s,
 	cas->capDeform     = cas->deform;
 	cas->capDistance   = cs->distance;
 	cas->capDeformType = cubeaddonGetDeformation (s);
+
+	cubeaddonUploadCapBuffers (s);
     }
 
     if (cs->invert == 1 && cas->first && cubeaddonGetReflection (s))
@@ -1404,26 +2948,33 @@ cubeaddonPaintTransformedOutput (CompScreen              *s,
 	cas->first = FALSE;
 	cas->reflection = TRUE;
 
+	fboReflection = cubeaddonGetReflectionFbo (s) &&
+	                cubeaddonInitReflectionFbo (s);
+
+	rTransform = sTransform;
+
 	if (cs->grabIndex)
 	{
-	    CompTransform rTransform = sTransform;
-
 	    matrixTranslate (&rTransform, 0.0, -1.0, 0.0);
 	    matrixScale (&rTransform, 1.0, -1.0, 1.0);
-	    glCullFace (GL_FRONT);
 
-	    UNWRAP (cas, s, paintTransformedOutput);
-	    (*s->paintTransformedOutput) (s, sAttrib, &rTransform,
-					  region, output, mask);
-	    WRAP (cas, s, paintTransformedOutput,
-		  cubeaddonPaintTransformedOutput);
+	    if (!fboReflection)
+	    {
+		glStateCullFace (&cas->glState, GL_FRONT);
+
+		UNWRAP (cas, s, paintTransformedOutput);
+		(*s->paintTransformedOutput) (s, sAttrib, &rTransform,
+					      region, output, mask);
+		WRAP (cas, s, paintTransformedOutput,
+		      cubeaddonPaintTransformedOutput);
 
-	    glCullFace (GL_BACK);
-	    drawBasicGround (s);
+		glStateInvalidate (&cas->glState);
+		glStateCullFace (&cas->glState, GL_BACK);
+		drawBasicGround (s);
+	    }
 	}
 	else
 	{
-	    CompTransform rTransform = sTransform;
 	    CompTransform pTransform;
 	    float         angle = 360.0 / ((float) s->hsize * cs->nOutput);
 	    float         xRot, vRot, xRotate, xRotate2, vRotate, p;
@@ -1577,88 +3128,32 @@ cubeaddonPaintTransformedOutput (CompScreen              *s,
 		matrixScale (&rTransform, 1.0, -1.0, 1.0);
 	    }
 
-	    glPushMatrix ();
-	    glLoadIdentity ();
-	    glScalef (1.0, -1.0, 1.0);
-	    glLightfv (GL_LIGHT0, GL_POSITION, light0Position);
-	    glPopMatrix ();
-	    glCullFace (GL_FRONT);
-
-	    UNWRAP (cas, s, paintTransformedOutput);
-	    (*s->paintTransformedOutput) (s, sAttrib, &rTransform,
-					  region, output, mask);
-	    WRAP (cas, s, paintTransformedOutput,
-		  cubeaddonPaintTransformedOutput);
-
-	    glCullFace (GL_BACK);
-	    glPushMatrix ();
-	    glLoadIdentity ();
-	    glLightfv (GL_LIGHT0, GL_POSITION, light0Position);
-	    glPopMatrix ();
+	    aboveGround = (cubeaddonGetMode (s) == ModeAbove && cas->vRot > 0.0);
 
-	    if (cubeaddonGetMode (s) == ModeAbove && cas->vRot > 0.0)
+	    if (!fboReflection)
 	    {
-		int   j;
-		float i, c;
-		float v = MIN (1.0, cas->vRot / 30.0);
-		float col1[4], col2[4];
-
 		glPushMatrix ();
-
-		glEnable (GL_BLEND);
-		glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
 		glLoadIdentity ();
-		glTranslatef (0.0, 0.0, -DEFAULT_Z_CAMERA);
-
-		i = cubeaddonGetIntensity (s) * 2;
-		c = cubeaddonGetIntensity (s);
-
-		glBegin (GL_QUADS);
-		glColor4f (0.0, 0.0, 0.0,
-			   ((1 - v) * MAX (0.0, 1.0 - i)) + (v * c));
-		glVertex2f (0.5, v / 2.0);
-		glVertex2f (-0.5, v / 2.0);
-		glColor4f (0.0, 0.0, 0.0,
-			   ((1 - v) * MIN (1.0, 1.0 - (i - 1.0))) + (v * c));
-		glVertex2f (-0.5, -0.5);
-		glVertex2f (0.5, -0.5);
-		glEnd ();
-
-		for (j = 0; j < 4; j++)
-		{
-		    col1[j] = (1.0 - v) * cubeaddonGetGroundColor1 (s) [j] +
-			      (v * (cubeaddonGetGroundColor1 (s) [j] +
-				    cubeaddonGetGroundColor2 (s) [j]) * 0.5);
-		    col1[j] /= 0xffff;
-		    col2[j] = (1.0 - v) * cubeaddonGetGroundColor2 (s) [j] +
-			      (v * (cubeaddonGetGroundColor1 (s) [j] +
-				    cubeaddonGetGroundColor2 (s) [j]) * 0.5);
-		    col2[j] /= 0xffff;
-		}
-
-		if (cubeaddonGetGroundSize (s) > 0.0)
-		{
-		    glBegin (GL_QUADS);
-		    glColor4fv (col1);
-		    glVertex2f (-0.5, -0.5);
-		    glVertex2f (0.5, -0.5);
-		    glColor4fv (col2);
-		    glVertex2f (0.5, -0.5 +
-				((1 - v) * cubeaddonGetGroundSize (s)) + v);
-		    glVertex2f (-0.5, -0.5 +
-				((1 - v) * cubeaddonGetGroundSize (s)) + v);
-		    glEnd ();
-		}
+		glScalef (1.0, -1.0, 1.0);
+		glLightfv (GL_LIGHT0, GL_POSITION, light0Position);
+		glPopMatrix ();
+		glStateCullFace (&cas->glState, GL_FRONT);
 
-		glColor4usv (defaultColor);
+		UNWRAP (cas, s, paintTransformedOutput);
+		(*s->paintTransformedOutput) (s, sAttrib, &rTransform,
+					      region, output, mask);
+		WRAP (cas, s, paintTransformedOutput,
+		      cubeaddonPaintTransformedOutput);
 
-		glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-		glDisable (GL_BLEND);
+		glStateInvalidate (&cas->glState);
+		glStateCullFace (&cas->glState, GL_BACK);
+		glPushMatrix ();
+		glLoadIdentity ();
+		glLightfv (GL_LIGHT0, GL_POSITION, light0Position);
 		glPopMatrix ();
+
+		cubeaddonPaintGround (s, aboveGround);
 	    }
-	    else
-		drawBasicGround (s);
 	}
 	
 	memset (cs->capsPainted, 0, sizeof (Bool) * s->nOutputDev);
@@ -1674,10 +3169,19 @@ cubeaddonPaintTransformedOutput (CompScreen              *s,
 
     matrixTranslate (&sTransform, 0.0, cas->yTrans, cas->zTrans);
 
+    if (fboReflection)
+	oldFbo = cubeaddonBeginFboReflection (s);
+
     UNWRAP (cas, s, paintTransformedOutput);
     (*s->paintTransformedOutput) (s, sAttrib, &sTransform,
 				  region, output, mask);
     WRAP (cas, s, paintTransformedOutput, cubeaddonPaintTransformedOutput);
+
+    glStateInvalidate (&cas->glState);
+
+    if (fboReflection)
+	cubeaddonEndFboReflection (s, oldFbo, sAttrib, &sTransform,
+				   &rTransform, output, aboveGround);
 }
 
 static Bool
@@ -1704,6 +3208,20 @@ cubeaddonPaintOutput (CompScreen              *s,
     return status;
 }
 
+static void
+cubeaddonPreparePaintScreen (CompScreen *s,
+			     int        msSinceLastPaint)
+{
+    CUBEADDON_SCREEN (s);
+
+    cubeaddonProcessCap (s, TRUE);
+    cubeaddonProcessCap (s, FALSE);
+
+    UNWRAP (cas, s, preparePaintScreen);
+    (*s->preparePaintScreen) (s, msSinceLastPaint);
+    WRAP (cas, s, preparePaintScreen, cubeaddonPreparePaintScreen);
+}
+
 static void
 cubeaddonDonePaintScreen (CompScreen * s)
 {
@@ -1812,6 +3330,29 @@ cubeaddonInitScreen (CompPlugin *p,
     cas->tmpBox  = NULL;
     cas->nTmpBox = 0;
 
+    glStateInvalidate (&cas->glState);
+
+    memset (cas->deformCache, 0, sizeof (cas->deformCache));
+    cas->deformCacheClock = 0;
+
+    cas->reflectionFbo       = 0;
+    cas->reflectionTexture   = 0;
+    cas->reflectionDepth     = 0;
+    cas->reflectionWidth     = 0;
+    cas->reflectionHeight    = 0;
+    cas->reflectionTexWidth  = 0;
+    cas->reflectionTexHeight = 0;
+    cas->noReflectionFbo     = FALSE;
+
+    cas->reflectionBlurFbo     = 0;
+    cas->reflectionBlurTexture = 0;
+    cas->reflectionBlurWidth   = 0;
+    cas->reflectionBlurHeight  = 0;
+    cas->noReflectionBlur      = FALSE;
+    cas->fboPass             = FALSE;
+
+    memset (&cas->rb, 0, sizeof (cas->rb));
+
     idx = cas->capFillIdx;
     for (i = 0; i < CAP_ELEMENTS - 1; i++)
     {
@@ -1825,9 +3366,21 @@ cubeaddonInitScreen (CompPlugin *p,
 	}
     }
 
+    cubeaddonInitBuffers (s);
+
+    cas->nGroundVertices = 0;
+    cas->groundChanged   = TRUE;
+
+    cubeaddonSetIntensityNotify (s, cubeaddonGroundChanged);
+    cubeaddonSetGroundColor1Notify (s, cubeaddonGroundChanged);
+    cubeaddonSetGroundColor2Notify (s, cubeaddonGroundChanged);
+    cubeaddonSetGroundSizeNotify (s, cubeaddonGroundChanged);
+
     cubeaddonInitCap (s, &cas->topCap);
     cubeaddonInitCap (s, &cas->bottomCap);
 
+    cas->capLoadHandle = 0;
+
     cas->topCap.files = cubeaddonGetTopImages (s);
     cas->bottomCap.files = cubeaddonGetBottomImages (s);
 
@@ -1846,6 +3399,7 @@ cubeaddonInitScreen (CompPlugin *p,
 
     WRAP (cas, s, paintTransformedOutput, cubeaddonPaintTransformedOutput);
     WRAP (cas, s, paintOutput, cubeaddonPaintOutput);
+    WRAP (cas, s, preparePaintScreen, cubeaddonPreparePaintScreen);
     WRAP (cas, s, donePaintScreen, cubeaddonDonePaintScreen);
     WRAP (cas, s, addWindowGeometry, cubeaddonAddWindowGeometry);
     WRAP (cas, s, drawWindow, cubeaddonDrawWindow);
@@ -1875,10 +3429,22 @@ cubeaddonFiniScreen (CompPlugin *p,
     if (cas->tmpBox)
 	free (cas->tmpBox);
 
+    cubeaddonFiniDeformCache (s);
+    cubeaddonFiniReflectionFbo (s);
+    cubeaddonFiniReflectionBlur (s);
+    cubeaddonFiniBuffers (s);
+
+    if (cas->capLoadHandle)
+	compRemoveTimeout (cas->capLoadHandle);
+
+    cubeaddonFiniCap (s, &cas->topCap);
+    cubeaddonFiniCap (s, &cas->bottomCap);
+
     XDestroyRegion (cas->tmpRegion);
 
     UNWRAP (cas, s, paintTransformedOutput);
     UNWRAP (cas, s, paintOutput);
+    UNWRAP (cas, s, preparePaintScreen);
     UNWRAP (cas, s, donePaintScreen);
     UNWRAP (cas, s, addWindowGeometry);
     UNWRAP (cas, s, drawWindow);
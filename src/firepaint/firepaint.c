@@ -19,6 +19,10 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
 #include <compiz-core.h>
 
 #include "firepaint_options.h"
@@ -76,9 +80,26 @@ typedef struct _ParticleSystem
     int vertex_cache_count;
     int color_cache_count;
     int dcolors_cache_count;
+
+    /* point sprite path, 0 if not supported */
+    GLuint  vertexProgram;
+    GLfloat maxPointSize;
 }
 ParticleSystem;
 
+/* passes the sprite size in texture coordinate 0 through to the point size,
+   as fixed function point sizes can not be set per vertex */
+static const char *particleVertexProgram =
+    "!!ARBvp1.0"
+    "PARAM mvp[4] = { state.matrix.mvp };"
+    "DP4 result.position.x, mvp[0], vertex.position;"
+    "DP4 result.position.y, mvp[1], vertex.position;"
+    "DP4 result.position.z, mvp[2], vertex.position;"
+    "DP4 result.position.w, mvp[3], vertex.position;"
+    "MOV result.color, vertex.color;"
+    "MOV result.pointsize.x, vertex.texcoord[0].x;"
+    "END";
+
 
 static void
 initParticles (int            numParticles,
@@ -104,6 +125,9 @@ initParticles (int            numParticles,
     ps->coords_cache_count  = 0;
     ps->dcolors_cache_count = 0;
 
+    ps->vertexProgram = 0;
+    ps->maxPointSize  = 0.0f;
+
     int i;
 
     for (i = 0; i < numParticles; i++)
@@ -113,66 +137,155 @@ initParticles (int            numParticles,
 }
 
 static void
-drawParticles (CompScreen     *s,
-	       ParticleSystem *ps)
+initParticleSprites (CompScreen     *s,
+		     ParticleSystem *ps)
 {
-    GLfloat *dcolors;
-    GLfloat *vertices;
-    GLfloat *coords;
-    GLfloat *colors;
+    const char *extensions;
+    GLfloat    range[2];
+    GLint      errorPos;
 
-    glPushMatrix ();
+    ps->vertexProgram = 0;
 
-    glEnable (GL_BLEND);
+    /* core only loads the ARB program entry points together
+       with fragment program support */
+    if (!s->fragmentProgram)
+	return;
 
-    if (ps->tex)
-    {
-	glBindTexture (GL_TEXTURE_2D, ps->tex);
-	glEnable (GL_TEXTURE_2D);
-    }
+    extensions = (const char *) glGetString (GL_EXTENSIONS);
+    if (!extensions ||
+	!strstr (extensions, "GL_ARB_point_sprite") ||
+	!strstr (extensions, "GL_ARB_vertex_program"))
+	return;
 
-    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glGetFloatv (GL_ALIASED_POINT_SIZE_RANGE, range);
+    ps->maxPointSize = range[1];
 
-    int i;
-    Particle *part;
+    glGetError ();
 
-    /* Check that the cache is big enough */
+    (*s->genPrograms) (1, &ps->vertexProgram);
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, ps->vertexProgram);
+    (*s->programString) (GL_VERTEX_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB,
+			 strlen (particleVertexProgram),
+			 particleVertexProgram);
 
-    if (ps->numParticles > ps->vertex_cache_count)
-    {
-	ps->vertices_cache = realloc (ps->vertices_cache,
-				      ps->numParticles * 4 * 3 *
-				      sizeof (GLfloat));
-	ps->vertex_cache_count = ps->numParticles;
-    }
+    glGetIntegerv (GL_PROGRAM_ERROR_POSITION_ARB, &errorPos);
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, 0);
 
-    if (ps->numParticles > ps->coords_cache_count)
+    if (glGetError () != GL_NO_ERROR || errorPos != -1)
     {
-	ps->coords_cache = realloc (ps->coords_cache,
-				    ps->numParticles * 4 * 2 *
-				    sizeof (GLfloat));
-	ps->coords_cache_count = ps->numParticles;
+	compLogMessage ("firepaint", CompLogLevelWarn,
+			"Failed to load particle vertex program, "
+			"falling back to quads");
+
+	(*s->deletePrograms) (1, &ps->vertexProgram);
+	ps->vertexProgram = 0;
     }
+}
 
-    if (ps->numParticles > ps->color_cache_count)
+/* submits one point per particle, returns FALSE without drawing when
+   a particle is larger than the biggest supported point size */
+static Bool
+drawParticleSprites (CompScreen     *s,
+		     ParticleSystem *ps)
+{
+    GLfloat  *dcolors  = ps->dcolors_cache;
+    GLfloat  *vertices = ps->vertices_cache;
+    GLfloat  *sizes    = ps->coords_cache;
+    GLfloat  *colors   = ps->colors_cache;
+    Particle *part;
+    int      i, numActive = 0;
+
+    for (i = 0; i < ps->numParticles; i++)
     {
-	ps->colors_cache = realloc (ps->colors_cache,
-				    ps->numParticles * 4 * 4 *
-				    sizeof (GLfloat));
-	ps->color_cache_count = ps->numParticles;
+	part = &ps->particles[i];
+
+	if (part->life > 0.0f)
+	{
+	    float w = part->width;
+	    float h = part->height;
+
+	    w += (w * part->w_mod) * part->life;
+	    h += (h * part->h_mod) * part->life;
+
+	    /* sprites are square, cover the whole particle */
+	    sizes[0] = MAX (w, h);
+	    if (sizes[0] > ps->maxPointSize)
+		return FALSE;
+
+	    vertices[0] = part->x;
+	    vertices[1] = part->y;
+	    vertices[2] = part->z;
+
+	    colors[0] = part->r;
+	    colors[1] = part->g;
+	    colors[2] = part->b;
+	    colors[3] = part->life * part->a;
+
+	    if (ps->darken > 0)
+	    {
+		dcolors[0] = part->r;
+		dcolors[1] = part->g;
+		dcolors[2] = part->b;
+		dcolors[3] = part->life * part->a * ps->darken;
+
+		dcolors += 4;
+	    }
+
+	    vertices += 3;
+	    sizes    += 1;
+	    colors   += 4;
+
+	    numActive++;
+	}
     }
 
+    glEnable (GL_POINT_SPRITE_ARB);
+    glTexEnvi (GL_POINT_SPRITE_ARB, GL_COORD_REPLACE_ARB, GL_TRUE);
+    glEnable (GL_VERTEX_PROGRAM_POINT_SIZE_ARB);
+    glEnable (GL_VERTEX_PROGRAM_ARB);
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, ps->vertexProgram);
+
+    glEnableClientState (GL_COLOR_ARRAY);
+
+    glTexCoordPointer (1, GL_FLOAT, sizeof (GLfloat), ps->coords_cache);
+    glVertexPointer (3, GL_FLOAT, 3 * sizeof (GLfloat), ps->vertices_cache);
+
+    // darken the background
+
     if (ps->darken > 0)
     {
-	if (ps->dcolors_cache_count < ps->numParticles)
-	{
-	    ps->dcolors_cache = realloc (ps->dcolors_cache,
-					 ps->numParticles * 4 * 4 *
-					 sizeof (GLfloat));
-	    ps->dcolors_cache_count = ps->numParticles;
-	}
+	glBlendFunc (GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	glColorPointer (4, GL_FLOAT, 4 * sizeof (GLfloat), ps->dcolors_cache);
+	glDrawArrays (GL_POINTS, 0, numActive);
     }
 
+    // draw particles
+    glBlendFunc (GL_SRC_ALPHA, ps->blendMode);
+
+    glColorPointer (4, GL_FLOAT, 4 * sizeof (GLfloat), ps->colors_cache);
+    glDrawArrays (GL_POINTS, 0, numActive);
+    glDisableClientState (GL_COLOR_ARRAY);
+
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, 0);
+    glDisable (GL_VERTEX_PROGRAM_ARB);
+    glDisable (GL_VERTEX_PROGRAM_POINT_SIZE_ARB);
+    glTexEnvi (GL_POINT_SPRITE_ARB, GL_COORD_REPLACE_ARB, GL_FALSE);
+    glDisable (GL_POINT_SPRITE_ARB);
+
+    return TRUE;
+}
+
+static void
+drawParticleQuads (ParticleSystem *ps)
+{
+    GLfloat *dcolors;
+    GLfloat *vertices;
+    GLfloat *coords;
+    GLfloat *colors;
+
+    int i;
+    Particle *part;
+
     dcolors  = ps->dcolors_cache;
     vertices = ps->vertices_cache;
     coords   = ps->coords_cache;
@@ -290,6 +403,63 @@ drawParticles (CompScreen     *s,
     glColorPointer (4, GL_FLOAT, 4 * sizeof (GLfloat), ps->colors_cache);
     glDrawArrays (GL_QUADS, 0, numActive);
     glDisableClientState (GL_COLOR_ARRAY);
+}
+
+static void
+drawParticles (CompScreen     *s,
+	       ParticleSystem *ps)
+{
+    glPushMatrix ();
+
+    glEnable (GL_BLEND);
+
+    if (ps->tex)
+    {
+	glBindTexture (GL_TEXTURE_2D, ps->tex);
+	glEnable (GL_TEXTURE_2D);
+    }
+
+    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    /* Check that the cache is big enough */
+
+    if (ps->numParticles > ps->vertex_cache_count)
+    {
+	ps->vertices_cache = realloc (ps->vertices_cache,
+				      ps->numParticles * 4 * 3 *
+				      sizeof (GLfloat));
+	ps->vertex_cache_count = ps->numParticles;
+    }
+
+    if (ps->numParticles > ps->coords_cache_count)
+    {
+	ps->coords_cache = realloc (ps->coords_cache,
+				    ps->numParticles * 4 * 2 *
+				    sizeof (GLfloat));
+	ps->coords_cache_count = ps->numParticles;
+    }
+
+    if (ps->numParticles > ps->color_cache_count)
+    {
+	ps->colors_cache = realloc (ps->colors_cache,
+				    ps->numParticles * 4 * 4 *
+				    sizeof (GLfloat));
+	ps->color_cache_count = ps->numParticles;
+    }
+
+    if (ps->darken > 0)
+    {
+	if (ps->dcolors_cache_count < ps->numParticles)
+	{
+	    ps->dcolors_cache = realloc (ps->dcolors_cache,
+					 ps->numParticles * 4 * 4 *
+					 sizeof (GLfloat));
+	    ps->dcolors_cache_count = ps->numParticles;
+	}
+    }
+
+    if (!ps->vertexProgram || !drawParticleSprites (s, ps))
+	drawParticleQuads (ps);
 
     glPopMatrix ();
     glColor4usv (defaultColor);
@@ -336,7 +506,8 @@ updateParticles (ParticleSystem *ps,
 }
 
 static void
-finiParticles (ParticleSystem * ps)
+finiParticles (CompScreen     *s,
+	       ParticleSystem *ps)
 {
     free (ps->particles);
     ps->particles = NULL;
@@ -344,6 +515,9 @@ finiParticles (ParticleSystem * ps)
     if (ps->tex)
 	glDeleteTextures (1, &ps->tex);
 
+    if (ps->vertexProgram)
+	(*s->deletePrograms) (1, &ps->vertexProgram);
+
     if (ps->vertices_cache)
 	free (ps->vertices_cache);
 
@@ -359,7 +533,12 @@ finiParticles (ParticleSystem * ps)
 
 /* =====================  END: Particle engine  ========================= */
 
-#define NUM_ADD_POINTS 1000
+typedef struct _FirePoint
+{
+    short        x, y;
+    unsigned int time;	/* fs->clock when the point was painted */
+}
+FirePoint;
 
 typedef struct _FireDisplay
 {
@@ -375,10 +554,13 @@ typedef struct _FireScreen
     ParticleSystem ps;
     Bool init;
 
-    XPoint *points;
-    int    pointsSize;
-    int    numPoints;
-    
+    /* ring buffer of painted points, oldest at pointsHead */
+    FirePoint    *points;
+    int          pointsSize;
+    int          pointsHead;
+    int          numPoints;
+    unsigned int clock;
+
     float brightness;
 
     int grabIndex;
@@ -402,27 +584,107 @@ FireScreen;
 #define FIRE_SCREEN(s)                                       \
     FireScreen *fs = GET_FIRE_SCREEN (s, GET_FIRE_DISPLAY (s->display))
 
+#define FIRE_POINT(fs, i) \
+    (&(fs)->points[((fs)->pointsHead + (i)) % (fs)->pointsSize])
+
+static Bool
+fireResizePoints (CompScreen *s,
+		  int        size)
+{
+    FirePoint *points;
+    int       i, num;
+
+    FIRE_SCREEN (s);
+
+    points = malloc (size * sizeof (FirePoint));
+    if (!points)
+	return FALSE;
+
+    /* keep the newest points */
+    num = MIN (fs->numPoints, size);
+    for (i = 0; i < num; i++)
+	points[i] = *FIRE_POINT (fs, fs->numPoints - num + i);
+
+    if (fs->points)
+	free (fs->points);
+
+    fs->points     = points;
+    fs->pointsSize = size;
+    fs->pointsHead = 0;
+    fs->numPoints  = num;
+
+    return TRUE;
+}
+
 static void
 fireAddPoint (CompScreen *s,
 	      int        x,
 	      int        y,
 	      Bool       requireGrab)
 {
+    FirePoint *point;
+    int       minDist;
+
     FIRE_SCREEN (s);
 
-    if (!requireGrab || fs->grabIndex)
+    if (requireGrab && !fs->grabIndex)
+	return;
+
+    if (fs->pointsSize != firepaintGetMaxPoints (s))
     {
-	if (fs->pointsSize < fs->numPoints + 1)
+	if (!fireResizePoints (s, firepaintGetMaxPoints (s)))
+	    return;
+    }
+
+    /* merge points that are too close to the previous one, moving the
+       pointer slowly would otherwise store the same spot many times */
+    minDist = firepaintGetMinPointDistance (s);
+    if (fs->numPoints && minDist)
+    {
+	point = FIRE_POINT (fs, fs->numPoints - 1);
+
+	if (abs (point->x - x) < minDist && abs (point->y - y) < minDist)
 	{
-	    fs->points = realloc (fs->points,
-				  (fs->pointsSize + NUM_ADD_POINTS) *
-				  sizeof (XPoint));
-	    fs->pointsSize += NUM_ADD_POINTS;
+	    point->time = fs->clock;
+	    return;
 	}
+    }
+
+    if (fs->numPoints == fs->pointsSize)
+    {
+	/* drop the oldest point */
+	fs->pointsHead = (fs->pointsHead + 1) % fs->pointsSize;
+	fs->numPoints--;
+    }
+
+    point = FIRE_POINT (fs, fs->numPoints);
+    point->x    = x;
+    point->y    = y;
+    point->time = fs->clock;
+
+    fs->numPoints++;
+}
+
+static void
+fireDecayPoints (CompScreen *s,
+		 int        time)
+{
+    unsigned int lifetime = firepaintGetPointLifetime (s) * 1000;
+
+    FIRE_SCREEN (s);
+
+    fs->clock += time;
 
-	fs->points[fs->numPoints].x = x;
-	fs->points[fs->numPoints].y = y;
-	fs->numPoints++;
+    if (!lifetime)
+	return;
+
+    /* points are stored in painting order, so expired points are
+       always at the head of the ring */
+    while (fs->numPoints &&
+	   fs->clock - FIRE_POINT (fs, 0)->time > lifetime)
+    {
+	fs->pointsHead = (fs->pointsHead + 1) % fs->pointsSize;
+	fs->numPoints--;
     }
 }
 
@@ -456,6 +718,99 @@ fireAddParticle (CompDisplay     *d,
 }
 
 
+/* adds a point of a polyline, filling the gap to the previous point
+   with points every spacing pixels */
+static void
+fireAddStrokePoint (CompScreen *s,
+		    float      x,
+		    float      y,
+		    float      *lastX,
+		    float      *lastY,
+		    Bool       first,
+		    float      spacing)
+{
+    if (!first && spacing > 0.0f)
+    {
+	float dx = x - *lastX;
+	float dy = y - *lastY;
+	int   i, steps;
+
+	/* older points would be dropped from the ring anyway */
+	steps = MIN (sqrt (dx * dx + dy * dy) / spacing,
+		     firepaintGetMaxPoints (s));
+
+	for (i = 1; i < steps; i++)
+	    fireAddPoint (s, *lastX + dx * i / steps,
+			  *lastY + dy * i / steps, FALSE);
+    }
+
+    fireAddPoint (s, x, y, FALSE);
+
+    *lastX = x;
+    *lastY = y;
+}
+
+static Bool
+fireAddStroke (CompDisplay     *d,
+	       CompAction      *action,
+	       CompActionState state,
+	       CompOption      *option,
+	       int	       nOption)
+{
+    CompScreen *s;
+    Window     xid;
+
+    xid  = getIntOptionNamed (option, nOption, "root", 0);
+
+    s = findScreenAtDisplay (d, xid);
+    if (s)
+    {
+	char  *points, *end;
+	float x, y, lastX = 0, lastY = 0, spacing;
+	int   n = 0;
+
+	points  = getStringOptionNamed (option, nOption, "points", "");
+	spacing = getFloatOptionNamed (option, nOption, "spacing", 0);
+
+	/* points is a list of x and y pairs, "x1,y1 x2,y2 ..." */
+	for (;;)
+	{
+	    while (*points == ',' || *points == ';')
+		points++;
+
+	    x = strtod (points, &end);
+	    if (end == points)
+		break;
+
+	    points = end;
+	    while (*points == ',' || *points == ';')
+		points++;
+
+	    y = strtod (points, &end);
+	    if (end == points)
+		break;
+
+	    points = end;
+
+	    /* strtod accepts nan and inf, which can't be converted to
+	       the integer point coordinates */
+	    if (!isfinite (x) || !isfinite (y))
+		break;
+
+	    x = MAX (0, MIN (x, s->width - 1));
+	    y = MAX (0, MIN (y, s->height - 1));
+
+	    fireAddStrokePoint (s, x, y, &lastX, &lastY, n == 0, spacing);
+	    n++;
+	}
+
+	if (n)
+	    damageScreen (s);
+    }
+
+    return FALSE;
+}
+
 static Bool
 fireInitiate (CompDisplay     *d,
 	      CompAction      *action,
@@ -542,7 +897,8 @@ fireClear (CompDisplay     *d,
     if (s)
     {
 	FIRE_SCREEN (s);
-	fs->numPoints = 0;
+	fs->numPoints  = 0;
+	fs->pointsHead = 0;
 	return TRUE;
     }
 
@@ -560,6 +916,8 @@ firePreparePaintScreen (CompScreen *s,
 
     FIRE_SCREEN (s);
 
+    fireDecayPoints (s, time);
+
     if (fs->init && fs->numPoints)
     {
 	initParticles (firepaintGetNumParticles (s), &fs->ps);
@@ -579,6 +937,8 @@ firePreparePaintScreen (CompScreen *s,
 	fs->ps.darken    = 0.5;
 	fs->ps.blendMode = GL_ONE;
 
+	initParticleSprites (s, &fs->ps);
+
     }
 
     if (!fs->init)
@@ -591,7 +951,7 @@ firePreparePaintScreen (CompScreen *s,
 			(1.05 -	firepaintGetFireLife(s));
 	Particle *part;
 	float rVal;
-	int rVal2;
+	FirePoint *point;
 
 	for (i = 0; i < fs->ps.numParticles && max_new > 0; i++)
 	{
@@ -614,9 +974,9 @@ firePreparePaintScreen (CompScreen *s,
 		part->h_mod = size * rVal;
 
 		/* choose random position */
-		rVal2 = random () % fs->numPoints;
-		part->x = fs->points[rVal2].x;
-		part->y = fs->points[rVal2].y;
+		point = FIRE_POINT (fs, random () % fs->numPoints);
+		part->x = point->x;
+		part->y = point->y;
 		part->z = 0.0;
 		part->xo = part->x;
 		part->yo = part->y;
@@ -690,7 +1050,7 @@ firePreparePaintScreen (CompScreen *s,
 
     if (!fs->init && !fs->numPoints && !fs->ps.active)
     {
-	finiParticles (&fs->ps);
+	finiParticles (s, &fs->ps);
 	fs->init = TRUE;
     }
 
@@ -834,6 +1194,7 @@ fireInitDisplay (CompPlugin  *p,
     firepaintSetClearKeyInitiate (d, fireClear);
     firepaintSetClearButtonInitiate (d, fireClear);
     firepaintSetAddParticleInitiate (d, fireAddParticle);
+    firepaintSetAddStrokeInitiate (d, fireAddStroke);
 
     return TRUE;
 }
@@ -868,7 +1229,9 @@ fireInitScreen (CompPlugin *p,
 
     fs->points     = NULL;
     fs->pointsSize = 0;
+    fs->pointsHead = 0;
     fs->numPoints  = 0;
+    fs->clock      = 0;
 
     fs->grabIndex = 0;
 
@@ -895,7 +1258,7 @@ fireFiniScreen (CompPlugin *p,
     UNWRAP (fs, s, donePaintScreen);
 
     if (!fs->init)
-	finiParticles (&fs->ps);
+	finiParticles (s, &fs->ps);
 
     if (fs->points)
 	free (fs->points);
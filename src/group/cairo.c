@@ -24,6 +24,59 @@
 
 #include "group-internal.h"
 
+/*
+ * groupAllocCairoLayerBuffer
+ *
+ */
+static Bool
+groupAllocCairoLayerBuffer (GroupCairoLayer *layer,
+			    int             width,
+			    int             height)
+{
+    if (layer->cairo)
+	cairo_destroy (layer->cairo);
+    if (layer->surface)
+	cairo_surface_destroy (layer->surface);
+    if (layer->buffer)
+	free (layer->buffer);
+
+    layer->cairo   = NULL;
+    layer->surface = NULL;
+
+    layer->bufWidth     = width;
+    layer->bufHeight    = height;
+    layer->textureValid = FALSE;
+
+    layer->buffer = calloc (4 * width * height, sizeof (unsigned char));
+    if (!layer->buffer)
+    {
+	compLogMessage ("group", CompLogLevelError,
+			"Failed to allocate cairo layer buffer.");
+	return FALSE;
+    }
+
+    layer->surface = cairo_image_surface_create_for_data (layer->buffer,
+							  CAIRO_FORMAT_ARGB32,
+							  width, height,
+							  4 * width);
+    if (cairo_surface_status (layer->surface) != CAIRO_STATUS_SUCCESS)
+    {
+	compLogMessage ("group", CompLogLevelError,
+			"Failed to create cairo layer surface.");
+	return FALSE;
+    }
+
+    layer->cairo = cairo_create (layer->surface);
+    if (cairo_status (layer->cairo) != CAIRO_STATUS_SUCCESS)
+    {
+	compLogMessage ("group", CompLogLevelError,
+			"Failed to create cairo layer context.");
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
 /*
  * groupRebuildCairoLayer
  *
@@ -34,20 +87,65 @@ groupRebuildCairoLayer (CompScreen      *s,
 			int             width,
 			int             height)
 {
-    int        timeBuf = layer->animationTime;
-    PaintState stateBuf = layer->state;
+    /* only reallocate when growing, and leave some room so
+       a slowly growing tab bar doesn't reallocate every time */
+    if (width > layer->bufWidth || height > layer->bufHeight)
+    {
+	int bufWidth  = MAX (width, layer->bufWidth);
+	int bufHeight = MAX (height, layer->bufHeight);
 
-    groupDestroyCairoLayer (s, layer);
-    layer = groupCreateCairoLayer (s, width, height);
-    if (!layer)
-	return NULL;
+	if (width > layer->bufWidth)
+	    bufWidth += bufWidth / 4;
+	if (height > layer->bufHeight)
+	    bufHeight += bufHeight / 4;
 
-    layer->animationTime = timeBuf;
-    layer->state = stateBuf;
+	if (!groupAllocCairoLayerBuffer (layer, bufWidth, bufHeight))
+	{
+	    groupDestroyCairoLayer (s, layer);
+	    return NULL;
+	}
+    }
+
+    layer->texWidth  = width;
+    layer->texHeight = height;
+
+    groupClearCairoLayer (layer);
 
     return layer;
 }
 
+/*
+ * groupUploadCairoLayer
+ *
+ */
+static void
+groupUploadCairoLayer (CompScreen      *s,
+		       GroupCairoLayer *layer)
+{
+    if (!layer->textureValid)
+    {
+	/* (re)allocate texture storage for the whole buffer */
+	layer->textureValid =
+	    imageBufferToTexture (s, &layer->texture, (char *) layer->buffer,
+				  layer->bufWidth, layer->bufHeight);
+	return;
+    }
+
+    makeScreenCurrent (s);
+
+    glBindTexture (layer->texture.target, layer->texture.name);
+
+    glPixelStorei (GL_UNPACK_ROW_LENGTH, layer->bufWidth);
+    glTexSubImage2D (layer->texture.target, 0, 0, 0,
+		     layer->texWidth, layer->texHeight,
+		     GL_BGRA, GL_UNSIGNED_BYTE, layer->buffer);
+    glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+
+    glBindTexture (layer->texture.target, 0);
+
+    layer->texture.oldMipmaps = TRUE;
+}
+
 /*
  * groupClearCairoLayer
  *
@@ -82,7 +180,7 @@ groupDestroyCairoLayer (CompScreen      *s,
 
     finiTexture (s, &layer->texture);
 
-    if (layer->pixmap)
+    if (layer->pixmap && !layer->pixmapCached)
 	XFreePixmap (s->display->display, layer->pixmap);
 
     if (layer->buffer)
@@ -112,6 +210,8 @@ groupCreateCairoLayer (CompScreen *s,
     layer->buffer  = NULL;
     layer->pixmap  = None;
 
+    layer->pixmapCached = FALSE;
+
     layer->animationTime = 0;
     layer->state         = PaintOff;
 
@@ -120,32 +220,8 @@ groupCreateCairoLayer (CompScreen *s,
 
     initTexture (s, &layer->texture);
 
-    layer->buffer = calloc (4 * width * height, sizeof (unsigned char));
-    if (!layer->buffer)
-    {
-	compLogMessage ("group", CompLogLevelError,
-			"Failed to allocate cairo layer buffer.");
-	groupDestroyCairoLayer (s, layer);
-	return NULL;
-    }
-
-    layer->surface = cairo_image_surface_create_for_data (layer->buffer,
-							  CAIRO_FORMAT_ARGB32,
-							  width, height,
-							  4 * width);
-    if (cairo_surface_status (layer->surface) != CAIRO_STATUS_SUCCESS)
+    if (!groupAllocCairoLayerBuffer (layer, width, height))
     {
-	compLogMessage ("group", CompLogLevelError,
-			"Failed to create cairo layer surface.");
-	groupDestroyCairoLayer (s, layer);
-	return NULL;
-    }
-
-    layer->cairo = cairo_create (layer->surface);
-    if (cairo_status (layer->cairo) != CAIRO_STATUS_SUCCESS)
-    {
-	compLogMessage ("group", CompLogLevelError,
-			"Failed to create cairo layer context.");
 	groupDestroyCairoLayer (s, layer);
 	return NULL;
     }
@@ -208,9 +284,7 @@ groupRenderTopTabHighlight (GroupSelection *group)
 			   (group->color[3] / 65535.0f));
     cairo_stroke (cr);
 
-    imageBufferToTexture (group->screen,
-			  &layer->texture, (char*) layer->buffer,
-			  layer->texWidth, layer->texHeight);
+    groupUploadCairoLayer (group->screen, layer);
 }
 
 /*
@@ -631,8 +705,185 @@ groupRenderTabBarBackground(GroupSelection *group)
     cairo_stroke(cr);
 
     cairo_restore (cr);
-    imageBufferToTexture (s, &layer->texture, (char*) layer->buffer,
-			  layer->texWidth, layer->texHeight);
+    groupUploadCairoLayer (s, layer);
+}
+
+/*
+ * groupReleaseTitleCacheEntry
+ *
+ */
+static void
+groupReleaseTitleCacheEntry (CompScreen           *s,
+			     GroupTitleCacheEntry *entry)
+{
+    GroupSelection *group;
+    Bool           inUse = FALSE;
+
+    GROUP_SCREEN (s);
+
+    if (entry->pixmap)
+    {
+	/* a text layer still showing this title takes over the pixmap */
+	for (group = gs->groups; group; group = group->next)
+	{
+	    GroupCairoLayer *layer;
+
+	    if (!group->tabBar || !group->tabBar->textLayer)
+		continue;
+
+	    layer = group->tabBar->textLayer;
+	    if (layer->pixmapCached && layer->pixmap == entry->pixmap)
+	    {
+		layer->pixmapCached = FALSE;
+		inUse = TRUE;
+		break;
+	    }
+	}
+
+	if (!inUse)
+	    XFreePixmap (s->display->display, entry->pixmap);
+    }
+
+    if (entry->family)
+	free (entry->family);
+
+    memset (entry, 0, sizeof (GroupTitleCacheEntry));
+}
+
+/*
+ * groupInvalidateTitleCache
+ *
+ */
+void
+groupInvalidateTitleCache (CompScreen *s,
+			   Window     id)
+{
+    int i;
+
+    GROUP_SCREEN (s);
+
+    /* None drops every cached title */
+    for (i = 0; i < GROUP_TITLE_CACHE_SIZE; i++)
+    {
+	GroupTitleCacheEntry *entry = &gs->titleCache[i];
+
+	if (entry->id && (id == None || entry->id == id))
+	    groupReleaseTitleCacheEntry (s, entry);
+    }
+}
+
+/*
+ * groupFiniTitleCache
+ *
+ */
+void
+groupFiniTitleCache (CompScreen *s)
+{
+    int i;
+
+    GROUP_SCREEN (s);
+
+    for (i = 0; i < GROUP_TITLE_CACHE_SIZE; i++)
+    {
+	GroupTitleCacheEntry *entry = &gs->titleCache[i];
+
+	if (entry->pixmap)
+	    XFreePixmap (s->display->display, entry->pixmap);
+	if (entry->family)
+	    free (entry->family);
+    }
+
+    memset (gs->titleCache, 0, sizeof (gs->titleCache));
+}
+
+/*
+ * groupLookupTitleCache
+ *
+ */
+static GroupTitleCacheEntry *
+groupLookupTitleCache (CompScreen           *s,
+		       Window               id,
+		       const CompTextAttrib *attrib)
+{
+    int i;
+
+    GROUP_SCREEN (s);
+
+    for (i = 0; i < GROUP_TITLE_CACHE_SIZE; i++)
+    {
+	GroupTitleCacheEntry *entry = &gs->titleCache[i];
+
+	if (entry->id != id || !entry->pixmap)
+	    continue;
+
+	if (entry->size != attrib->size           ||
+	    entry->maxWidth != attrib->maxWidth   ||
+	    entry->maxHeight != attrib->maxHeight ||
+	    memcmp (entry->color, attrib->color, sizeof (entry->color)) ||
+	    strcmp (entry->family, attrib->family))
+	{
+	    continue;
+	}
+
+	entry->lastUsed = ++gs->titleCacheClock;
+	return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * groupInsertTitleCache
+ *
+ */
+static GroupTitleCacheEntry *
+groupInsertTitleCache (CompScreen           *s,
+		       Window               id,
+		       const CompTextAttrib *attrib,
+		       Pixmap               pixmap,
+		       int                  width,
+		       int                  height)
+{
+    GroupTitleCacheEntry *entry = NULL;
+    char                 *family;
+    int                  i;
+
+    GROUP_SCREEN (s);
+
+    family = strdup (attrib->family);
+    if (!family)
+	return NULL;
+
+    /* take a free slot or evict the least recently used one */
+    for (i = 0; i < GROUP_TITLE_CACHE_SIZE; i++)
+    {
+	if (!gs->titleCache[i].id)
+	{
+	    entry = &gs->titleCache[i];
+	    break;
+	}
+
+	if (!entry || gs->titleCache[i].lastUsed < entry->lastUsed)
+	    entry = &gs->titleCache[i];
+    }
+
+    if (entry->id)
+	groupReleaseTitleCacheEntry (s, entry);
+
+    entry->id        = id;
+    entry->family    = family;
+    entry->size      = attrib->size;
+    entry->maxWidth  = attrib->maxWidth;
+    entry->maxHeight = attrib->maxHeight;
+    memcpy (entry->color, attrib->color, sizeof (entry->color));
+
+    entry->pixmap = pixmap;
+    entry->width  = width;
+    entry->height = height;
+
+    entry->lastUsed = ++gs->titleCacheClock;
+
+    return entry;
 }
 
 /*
@@ -645,6 +896,7 @@ groupRenderWindowTitle (GroupSelection *group)
     GroupCairoLayer *layer;
     int             width, height;
     Pixmap          pixmap = None;
+    Bool            cached = FALSE;
     CompScreen      *s = group->screen;
     CompDisplay     *d = s->display;
     GroupTabBar     *bar = group->tabBar;
@@ -657,15 +909,24 @@ groupRenderWindowTitle (GroupSelection *group)
     width = bar->region->extents.x2 - bar->region->extents.x1;
     height = bar->region->extents.y2 - bar->region->extents.y1;
 
-    bar->textLayer = groupRebuildCairoLayer (s, bar->textLayer, width, height);
+    /* the text layer is backed by a pixmap, so only the previous
+       pixmap needs to go - the cairo buffer is left untouched */
     layer = bar->textLayer;
-    if (!layer)
-	return;
+    if (layer->pixmap)
+    {
+	finiTexture (s, &layer->texture);
+	initTexture (s, &layer->texture);
+	if (!layer->pixmapCached)
+	    XFreePixmap (d->display, layer->pixmap);
+	layer->pixmap       = None;
+	layer->pixmapCached = FALSE;
+    }
 
     if (bar->textSlot && bar->textSlot->window && gd->textFunc)
     {
-	CompTextData    *data;
-	CompTextAttrib  textAttrib;
+	CompTextData         *data;
+	CompTextAttrib       textAttrib;
+	GroupTitleCacheEntry *entry;
 
 	textAttrib.family = groupGetTabbarFontFamily(s);
 	textAttrib.size   = groupGetTabbarFontSize (s);
@@ -681,14 +942,35 @@ groupRenderWindowTitle (GroupSelection *group)
 	textAttrib.maxWidth = width;
 	textAttrib.maxHeight = height;
 
-	data = (gd->textFunc->renderWindowTitle) (s, bar->textSlot->window->id,
-						  FALSE, &textAttrib);
-	if (data)
+	entry = groupLookupTitleCache (s, bar->textSlot->window->id,
+				       &textAttrib);
+	if (!entry)
+	{
+	    data = (gd->textFunc->renderWindowTitle) (s,
+						      bar->textSlot->window->id,
+						      FALSE, &textAttrib);
+	    if (data)
+	    {
+		entry = groupInsertTitleCache (s, bar->textSlot->window->id,
+					       &textAttrib, data->pixmap,
+					       data->width, data->height);
+		if (!entry)
+		{
+		    /* not cacheable, so the layer owns the pixmap */
+		    pixmap = data->pixmap;
+		    width  = data->width;
+		    height = data->height;
+		}
+		free (data);
+	    }
+	}
+
+	if (entry)
 	{
-	    pixmap = data->pixmap;
-	    width = data->width;
-	    height = data->height;
-	    free (data);
+	    pixmap = entry->pixmap;
+	    width  = entry->width;
+	    height = entry->height;
+	    cached = TRUE;
 	}
     }
 
@@ -716,7 +998,8 @@ groupRenderWindowTitle (GroupSelection *group)
 
     if (pixmap)
     {
-	layer->pixmap = pixmap;
+	layer->pixmap       = pixmap;
+	layer->pixmapCached = cached;
 	bindPixmapToTexture (s, &layer->texture, layer->pixmap,
 			     layer->texWidth, layer->texHeight, 32);
     }
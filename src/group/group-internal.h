@@ -145,6 +145,8 @@ typedef struct _GlowTextureProperties {
     int  glowOffset;
 } GlowTextureProperties;
 
+#define NUM_GLOW_TYPES 2
+
 /*
  * Structs for pending callbacks
  */
@@ -174,11 +176,8 @@ struct _GroupPendingUngrabs {
     GroupPendingUngrabs *next;
 };
 
-typedef struct _GroupPendingSyncs GroupPendingSyncs;
-struct _GroupPendingSyncs {
-    CompWindow        *w;
-    GroupPendingSyncs *next;
-};
+/* number of queue entries preallocated per screen and queue type */
+#define GROUP_QUEUE_POOL_SIZE 32
 
 /*
  * Pointer to display list
@@ -193,6 +192,13 @@ extern int groupDisplayPrivateIndex;
 #define SHOW_BAR_INSTANTLY_MASK (1 << 0)
 #define PERMANENT		(1 << 1)
 
+/* Minimum time between two thumbnail updates of a slot, in ms */
+#define GROUP_THUMB_UPDATE_INTERVAL 100
+
+/* Tab bar spring simulation step, in ms */
+#define GROUP_PHYSICS_STEP      16
+#define GROUP_PHYSICS_MAX_STEPS 8
+
 /* Mask values for tabbing animation */
 #define IS_ANIMATED		(1 << 0)
 #define FINISHED_ANIMATION	(1 << 1)
@@ -237,14 +243,44 @@ typedef struct _GroupCairoLayer {
 
     /* used if layer is used for text drawing */
     Pixmap pixmap;
+    Bool   pixmapCached; /* pixmap is owned by the title cache */
 
+    /* size of the drawn contents */
     int texWidth;
     int texHeight;
 
+    /* allocated size of buffer and texture, may exceed the above */
+    int  bufWidth;
+    int  bufHeight;
+    Bool textureValid;
+
     PaintState state;
     int        animationTime;
 } GroupCairoLayer;
 
+/*
+ * Rendered tab titles, kept per screen so switching
+ * between tabs doesn't rasterize the same text again
+ */
+#define GROUP_TITLE_CACHE_SIZE 16
+
+typedef struct _GroupTitleCacheEntry {
+    Window id;
+
+    /* text attributes the title was rendered with */
+    char           *family;
+    int            size;
+    unsigned short color[4];
+    int            maxWidth;
+    int            maxHeight;
+
+    Pixmap pixmap;
+    int    width;
+    int    height;
+
+    unsigned int lastUsed;
+} GroupTitleCacheEntry;
+
 /*
  * GroupTabBarSlot
  */
@@ -261,6 +297,16 @@ struct _GroupTabBarSlot {
     int	  springX;
     int	  speed;
     float msSinceLastMove;
+    int   draggedForce; /* scratch value of groupApplyForces */
+
+    /* cached thumbnail, rendered through an FBO */
+    GLuint   thumbFbo;
+    GLuint   thumbTexture;
+    int      thumbWidth, thumbHeight;
+    int      thumbTexWidth, thumbTexHeight;
+    Bool     thumbDirty;
+    int      msSinceThumbUpdate;
+    GLushort thumbOpacity, thumbBrightness, thumbSaturation;
 };
 
 /*
@@ -293,6 +339,7 @@ typedef struct _GroupTabBar {
     int   leftSpringX, rightSpringX;
     int   leftSpeed, rightSpeed;
     float leftMsSinceLastMove, rightMsSinceLastMove;
+    int   msSinceLastStep;
 } GroupTabBar;
 
 /*
@@ -380,6 +427,20 @@ typedef struct _GroupResizeInfo {
     XRectangle origGeometry;
 } GroupResizeInfo;
 
+/*
+ * Window id index, maps the ids of grouped windows and
+ * input prevention windows to their window and group
+ */
+#define GROUP_WINDOW_HASH_MIN_SIZE 64
+
+typedef struct _GroupWindowHashEntry GroupWindowHashEntry;
+struct _GroupWindowHashEntry {
+    Window               id;
+    CompWindow           *window; /* NULL for input prevention windows */
+    GroupSelection       *group;
+    GroupWindowHashEntry *next;
+};
+
 /*
  * GroupDisplay structure
  */
@@ -400,6 +461,10 @@ typedef struct _GroupDisplay {
     Atom resizeNotifyAtom;
 
     TextFunc *textFunc;
+
+    GroupWindowHashEntry **windowHash;
+    int                  windowHashSize;
+    int                  nWindowHashEntries;
 } GroupDisplay;
 
 /*
@@ -424,11 +489,16 @@ typedef struct _GroupScreen {
     WindowStateChangeNotifyProc   windowStateChangeNotify;
     ActivateWindowProc            activateWindow;
 
-    GroupPendingMoves   *pendingMoves;
-    GroupPendingGrabs   *pendingGrabs;
-    GroupPendingUngrabs *pendingUngrabs;
+    GroupPendingMoves   *pendingMoves, *pendingMovesTail;
+    GroupPendingGrabs   *pendingGrabs, *pendingGrabsTail;
+    GroupPendingUngrabs *pendingUngrabs, *pendingUngrabsTail;
     CompTimeoutHandle   dequeueTimeoutHandle;
 
+    /* recycled queue entries, backed by a preallocated pool */
+    GroupPendingMoves   *freeMoves, *movePool;
+    GroupPendingGrabs   *freeGrabs, *grabPool;
+    GroupPendingUngrabs *freeUngrabs, *ungrabPool;
+
     GroupSelection *groups;
     GroupSelection tmpSel;
 
@@ -454,7 +524,15 @@ typedef struct _GroupScreen {
 
     CompTimeoutHandle initialActionsTimeoutHandle;
 
-    CompTexture glowTexture;
+    /* all glow textures are uploaded once, glowTexture
+       points to the one of the selected glow type */
+    CompTexture glowTextures[NUM_GLOW_TYPES];
+    CompTexture *glowTexture;
+
+    Bool noThumbFbo;
+
+    GroupTitleCacheEntry titleCache[GROUP_TITLE_CACHE_SIZE];
+    unsigned int         titleCacheClock;
 } GroupScreen;
 
 /*
@@ -473,7 +551,14 @@ typedef struct _GroupWindow {
 
     Bool needsPosSync;
 
+    /* queue entries of this window, used for coalescing */
+    GroupPendingMoves   *pendingMove;
+    GroupPendingGrabs   *pendingGrab;
+    GroupPendingUngrabs *pendingUngrab;
+
+    /* window relative glow geometry, only non-empty quads */
     GlowQuad *glowQuads;
+    int      nGlowQuads;
 
     GroupWindowState    windowState;
     GroupWindowHideInfo *windowHideInfo;
@@ -502,6 +587,30 @@ typedef struct _GroupWindow {
 Bool
 groupIsGroupWindow (CompWindow *w);
 
+Bool
+groupInitWindowHash (CompDisplay *d);
+
+void
+groupFiniWindowHash (CompDisplay *d);
+
+void
+groupHashWindowId (CompDisplay    *d,
+		   Window         id,
+		   CompWindow     *w,
+		   GroupSelection *group);
+
+void
+groupUnhashWindowId (CompDisplay *d,
+		     Window      id);
+
+GroupWindowHashEntry *
+groupLookupWindowId (CompDisplay *d,
+		     Window      id);
+
+CompWindow *
+groupFindGroupedWindow (CompDisplay *d,
+			Window      id);
+
 void
 groupUpdateWindowProperty (CompWindow *w);
 
@@ -652,6 +761,13 @@ groupRenderTabBarBackground (GroupSelection *group);
 void
 groupRenderWindowTitle (GroupSelection *group);
 
+void
+groupInvalidateTitleCache (CompScreen *s,
+			   Window     id);
+
+void
+groupFiniTitleCache (CompScreen *s);
+
 
 /*
  * tab.c
@@ -818,10 +934,23 @@ groupResizeTabBarRegion (GroupSelection *group,
 void
 groupDamageTabBarRegion (GroupSelection *group);
 
+void
+groupDamageTabBarSlot (GroupTabBarSlot *slot);
+
+void
+groupDamageTabBarBackground (GroupSelection *group);
+
+void
+groupDamageTabBarText (GroupSelection *group);
+
 /*
  * paint.c
  */
 
+void
+groupFiniSlotThumb (CompScreen      *s,
+		    GroupTabBarSlot *slot);
+
 void
 groupComputeGlowQuads (CompWindow *w,
 		       CompMatrix *matrix);
@@ -898,6 +1027,15 @@ groupEnqueueGrabNotify (CompWindow   *w,
 void
 groupEnqueueUngrabNotify (CompWindow *w);
 
+void
+groupInitQueues (CompScreen *s);
+
+void
+groupFiniQueues (CompScreen *s);
+
+void
+groupRemoveWindowFromQueues (CompWindow *w);
+
 /*
  * selection.c
  */
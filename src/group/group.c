@@ -46,6 +46,202 @@ groupIsGroupWindow (CompWindow *w)
     return TRUE;
 }
 
+/*
+ * groupWindowHashIndex
+ *
+ */
+static inline int
+groupWindowHashIndex (GroupDisplay *gd,
+		      Window       id)
+{
+    /* ids of one client are consecutive, so the low bits spread well */
+    return id & (gd->windowHashSize - 1);
+}
+
+/*
+ * groupInitWindowHash
+ *
+ */
+Bool
+groupInitWindowHash (CompDisplay *d)
+{
+    GROUP_DISPLAY (d);
+
+    gd->windowHashSize     = GROUP_WINDOW_HASH_MIN_SIZE;
+    gd->nWindowHashEntries = 0;
+    gd->windowHash = calloc (gd->windowHashSize,
+			     sizeof (GroupWindowHashEntry *));
+
+    return (gd->windowHash != NULL);
+}
+
+/*
+ * groupFiniWindowHash
+ *
+ */
+void
+groupFiniWindowHash (CompDisplay *d)
+{
+    int i;
+
+    GROUP_DISPLAY (d);
+
+    for (i = 0; i < gd->windowHashSize; i++)
+    {
+	while (gd->windowHash[i])
+	{
+	    GroupWindowHashEntry *entry = gd->windowHash[i];
+
+	    gd->windowHash[i] = entry->next;
+	    free (entry);
+	}
+    }
+
+    free (gd->windowHash);
+    gd->windowHash = NULL;
+    gd->nWindowHashEntries = 0;
+}
+
+/*
+ * groupGrowWindowHash
+ *
+ */
+static void
+groupGrowWindowHash (GroupDisplay *gd)
+{
+    GroupWindowHashEntry **old = gd->windowHash;
+    int                  oldSize = gd->windowHashSize;
+    int                  i;
+
+    gd->windowHash = calloc (oldSize * 2, sizeof (GroupWindowHashEntry *));
+    if (!gd->windowHash)
+    {
+	/* keep using the old table, only the chains get longer */
+	gd->windowHash = old;
+	return;
+    }
+
+    gd->windowHashSize = oldSize * 2;
+
+    for (i = 0; i < oldSize; i++)
+    {
+	while (old[i])
+	{
+	    GroupWindowHashEntry *entry = old[i];
+	    int                  index;
+
+	    old[i] = entry->next;
+
+	    index = groupWindowHashIndex (gd, entry->id);
+	    entry->next = gd->windowHash[index];
+	    gd->windowHash[index] = entry;
+	}
+    }
+
+    free (old);
+}
+
+/*
+ * groupLookupWindowId
+ *
+ */
+GroupWindowHashEntry *
+groupLookupWindowId (CompDisplay *d,
+		     Window      id)
+{
+    GroupWindowHashEntry *entry;
+
+    GROUP_DISPLAY (d);
+
+    if (!id)
+	return NULL;
+
+    entry = gd->windowHash[groupWindowHashIndex (gd, id)];
+    for (; entry; entry = entry->next)
+	if (entry->id == id)
+	    return entry;
+
+    return NULL;
+}
+
+/*
+ * groupHashWindowId
+ *
+ */
+void
+groupHashWindowId (CompDisplay    *d,
+		   Window         id,
+		   CompWindow     *w,
+		   GroupSelection *group)
+{
+    GroupWindowHashEntry *entry;
+    int                  index;
+
+    GROUP_DISPLAY (d);
+
+    entry = groupLookupWindowId (d, id);
+    if (!entry)
+    {
+	entry = malloc (sizeof (GroupWindowHashEntry));
+	if (!entry)
+	    return;
+
+	if (gd->nWindowHashEntries >= gd->windowHashSize)
+	    groupGrowWindowHash (gd);
+
+	index = groupWindowHashIndex (gd, id);
+
+	entry->id   = id;
+	entry->next = gd->windowHash[index];
+	gd->windowHash[index] = entry;
+	gd->nWindowHashEntries++;
+    }
+
+    entry->window = w;
+    entry->group  = group;
+}
+
+/*
+ * groupUnhashWindowId
+ *
+ */
+void
+groupUnhashWindowId (CompDisplay *d,
+		     Window      id)
+{
+    GroupWindowHashEntry **prev, *entry;
+
+    GROUP_DISPLAY (d);
+
+    prev = &gd->windowHash[groupWindowHashIndex (gd, id)];
+    for (entry = *prev; entry; prev = &entry->next, entry = entry->next)
+    {
+	if (entry->id == id)
+	{
+	    *prev = entry->next;
+	    free (entry);
+	    gd->nWindowHashEntries--;
+	    return;
+	}
+    }
+}
+
+/*
+ * groupFindGroupedWindow
+ *
+ * Description:
+ * Returns the window with the given id if it is member of a group.
+ *
+ */
+CompWindow *
+groupFindGroupedWindow (CompDisplay *d,
+			Window      id)
+{
+    GroupWindowHashEntry *entry = groupLookupWindowId (d, id);
+
+    return entry ? entry->window : NULL;
+}
+
 /*
  * groupDragHoverTimeout
  *
@@ -260,13 +456,19 @@ groupGrabScreen (CompScreen           *s,
 /*
  * groupRaiseWindows
  *
+ * Computes the final stacking order of the group once: all group
+ * windows directly below top, keeping their relative order. Windows
+ * that are already in place are left alone, so raising a group that
+ * is (mostly) stacked correctly doesn't produce a restack request and
+ * ConfigureNotify per window.
+ *
  */
 static void
 groupRaiseWindows (CompWindow     *top,
 		   GroupSelection *group)
 {
     CompWindow **stack;
-    CompWindow *w;
+    CompWindow *w, *below;
     int        count = 0, i;
 
     if (group->nWins == 1)
@@ -283,8 +485,23 @@ groupRaiseWindows (CompWindow     *top,
 	    stack[count++] = w;
     }
 
-    for (i = 0; i < count; i++)
-	restackWindowBelow (stack[i], top);
+    /* find how many windows are already stacked right below top */
+    w = top->prev;
+    for (i = count - 1; i >= 0; i--)
+    {
+	if (w != stack[i])
+	    break;
+
+	w = w->prev;
+    }
+
+    /* stack the rest one after another, from top to bottom */
+    below = (i < count - 1) ? stack[i + 1] : top;
+    for (; i >= 0; i--)
+    {
+	restackWindowBelow (stack[i], below);
+	below = stack[i];
+    }
 
     free (stack);
 }
@@ -292,6 +509,10 @@ groupRaiseWindows (CompWindow     *top,
 /*
  * groupMinimizeWindows
  *
+ * Only touches windows that aren't in the requested state yet - as
+ * the unmap and map of every group member lead back here, this keeps
+ * minimizing a group from generating work for each window pair.
+ *
  */
 static void
 groupMinimizeWindows (CompWindow     *top,
@@ -305,6 +526,9 @@ groupMinimizeWindows (CompWindow     *top,
 	if (w->id == top->id)
 	    continue;
 
+	if (!w->minimized == !minimize)
+	    continue;
+
 	if (minimize)
 	    minimizeWindow (w);
 	else
@@ -335,6 +559,11 @@ groupShadeWindows (CompWindow     *top,
 	else
 	    state = w->state & ~CompWindowStateShadedMask;
 
+	/* skip windows which already are in the requested state to
+	   avoid redundant property updates and state notifications */
+	if (state == w->state)
+	    continue;
+
 	changeWindowState (w, state);
 	updateWindowAttributes (w, CompStackingUpdateModeNone);
     }
@@ -419,6 +648,8 @@ groupDeleteGroupWindow (CompWindow *w)
 
 	damageWindowOutputExtents (w);
 	gw->group = NULL;
+	groupUnhashWindowId (w->screen->display, w->id);
+	groupInvalidateTitleCache (w->screen, w->id);
 	updateWindowOutputExtents (w);
 	groupUpdateWindowProperty (w);
     }
@@ -520,6 +751,8 @@ groupDeleteGroup (GroupSelection *group)
 
 	    damageWindowOutputExtents (cw);
 	    gw->group = NULL;
+	    groupUnhashWindowId (s->display, cw->id);
+	    groupInvalidateTitleCache (s, cw->id);
 	    updateWindowOutputExtents (cw);
 	    groupUpdateWindowProperty (cw);
 
@@ -595,6 +828,7 @@ groupAddWindowToGroup (CompWindow     *w,
 	group->windows[group->nWins] = w;
 	group->nWins++;
 	gw->group = group;
+	groupHashWindowId (w->screen->display, w->id, w, group);
 
 	updateWindowOutputExtents (w);
 	groupUpdateWindowProperty (w);
@@ -720,6 +954,7 @@ groupAddWindowToGroup (CompWindow     *w,
 	gs->groups = g;
 
 	gw->group = g;
+	groupHashWindowId (w->screen->display, w->id, w, g);
 
 	groupUpdateWindowProperty (w);
     }
@@ -845,7 +1080,7 @@ groupRemoveWindow (CompDisplay     *d,
     CompWindow *w;
 
     xid = getIntOptionNamed (option, nOption, "window", 0);
-    w   = findWindowAtDisplay (d, xid);
+    w   = groupFindGroupedWindow (d, xid);
     if (w)
     {
 	GROUP_WINDOW (w);
@@ -872,7 +1107,7 @@ groupCloseWindows (CompDisplay     *d,
     CompWindow *w;
 
     xid = getIntOptionNamed (option, nOption, "window", 0);
-    w   = findWindowAtDisplay (d, xid);
+    w   = groupFindGroupedWindow (d, xid);
     if (w)
     {
 	GROUP_WINDOW (w);
@@ -905,7 +1140,7 @@ groupChangeColor (CompDisplay     *d,
     CompWindow *w;
 
     xid = getIntOptionNamed (option, nOption, "window", 0);
-    w   = findWindowAtDisplay (d, xid);
+    w   = groupFindGroupedWindow (d, xid);
     if (w)
     {
 	GROUP_WINDOW (w);
@@ -1552,21 +1787,44 @@ groupHandleEvent (CompDisplay *d,
 
     switch (event->type) {
     case PropertyNotify:
-	if (event->xproperty.atom == d->wmNameAtom)
+	if (event->xproperty.atom == d->wmNameAtom ||
+	    event->xproperty.atom == XA_WM_NAME)
 	{
 	    CompWindow *w;
-	    w = findWindowAtDisplay (d, event->xproperty.window);
+	    w = groupFindGroupedWindow (d, event->xproperty.window);
 	    if (w)
 	    {
 		GROUP_WINDOW (w);
 
+		groupInvalidateTitleCache (w->screen, w->id);
+
 		if (gw->group && gw->group->tabBar &&
 		    gw->group->tabBar->textSlot    &&
 		    gw->group->tabBar->textSlot->window == w)
 		{
-		    /* make sure we are using the updated name */
+		    /* make sure we are using the updated name; damage both
+		       the old and the new text extents */
+		    groupDamageTabBarText (gw->group);
 		    groupRenderWindowTitle (gw->group);
-		    groupDamageTabBarRegion (gw->group);
+		    groupDamageTabBarText (gw->group);
+		}
+	    }
+	}
+	else if (event->xproperty.atom == d->frameExtentsAtom)
+	{
+	    CompWindow *w;
+	    w = findWindowAtDisplay (d, event->xproperty.window);
+	    if (w)
+	    {
+		GROUP_WINDOW (w);
+		GROUP_SCREEN (w->screen);
+
+		/* the glow is placed relative to the decoration, which
+		   can change without a window resize */
+		if (gw->glowQuads)
+		{
+		    groupComputeGlowQuads (w, &gs->glowTexture->matrix);
+		    addWindowDamage (w);
 		}
 	    }
 	}
@@ -1715,7 +1973,7 @@ groupWindowResizeNotify (CompWindow *w,
     WRAP (gs, s, windowResizeNotify, groupWindowResizeNotify);
 
     if (gw->glowQuads)
-	groupComputeGlowQuads (w, &gs->glowTexture.matrix);
+	groupComputeGlowQuads (w, &gs->glowTexture->matrix);
 
     if (gw->group && gw->group->tabBar && IS_TOP_TAB (w, gw->group))
     {
@@ -1749,9 +2007,6 @@ groupWindowMoveNotify (CompWindow *w,
     (*s->windowMoveNotify) (w, dx, dy, immediate);
     WRAP (gs, s, windowMoveNotify, groupWindowMoveNotify);
 
-    if (gw->glowQuads)
-	groupComputeGlowQuads (w, &gs->glowTexture.matrix);
-
     if (!gw->group || gs->queued)
 	return;
 
@@ -2030,23 +2285,8 @@ groupDamageWindowRect (CompWindow *w,
 
     if (gw->slot)
     {
-	int    vx, vy;
-	Region reg;
-
-	groupGetDrawOffsetForSlot (gw->slot, &vx, &vy);
-	if (vx || vy)
-	{
-	    reg = XCreateRegion ();
-	    XUnionRegion (reg, gw->slot->region, reg);
-	    XOffsetRegion (reg, vx, vy);
-	}
-	else
-	    reg = gw->slot->region;
-
-	damageScreenRegion (s, reg);
-
-	if (vx || vy)
-	    XDestroyRegion (reg);
+	gw->slot->thumbDirty = TRUE;
+	groupDamageTabBarSlot (gw->slot);
     }
 
     return status;
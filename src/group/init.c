@@ -27,7 +27,7 @@
 
 int groupDisplayPrivateIndex;
 
-static const GlowTextureProperties glowTextureProperties[2] = {
+static const GlowTextureProperties glowTextureProperties[NUM_GLOW_TYPES] = {
     /* GlowTextureRectangular */
     {glowTexRect, 32, 21},
     /* GlowTextureRing */
@@ -58,6 +58,7 @@ groupScreenOptionChanged (CompScreen         *s,
 	case GroupScreenOptionTabbarFontFamily:
 	case GroupScreenOptionTabbarFontSize:
 	case GroupScreenOptionTabbarFontColor:
+	    groupInvalidateTitleCache (s, None);
 	    for (group = gs->groups; group; group = group->next)
 		groupRenderWindowTitle (group);
 	    break;
@@ -80,7 +81,7 @@ groupScreenOptionChanged (CompScreen         *s,
 		{
 		    GROUP_WINDOW (w);
 
-		    groupComputeGlowQuads (w, &gs->glowTexture.matrix);
+		    groupComputeGlowQuads (w, &gs->glowTexture->matrix);
 		    if (gw->glowQuads)
 		    {
 			damageWindowOutputExtents (w);
@@ -92,28 +93,17 @@ groupScreenOptionChanged (CompScreen         *s,
 	    }
 	case GroupScreenOptionGlowType:
 	    {
-		GroupGlowTypeEnum     glowType;
-		GlowTextureProperties *glowProperty;
+		GroupGlowTypeEnum glowType;
 
-		GROUP_DISPLAY (s->display);
 		glowType = groupGetGlowType (s);
-		glowProperty = &gd->glowTextureProperties[glowType];
-
-		finiTexture (s, &gs->glowTexture);
-		initTexture (s, &gs->glowTexture);
-
-		imageDataToTexture (s, &gs->glowTexture,
-				    glowProperty->textureData,
-				    glowProperty->textureSize,
-				    glowProperty->textureSize,
-				    GL_RGBA, GL_UNSIGNED_BYTE);
+		gs->glowTexture = &gs->glowTextures[glowType];
 
 		if (groupGetGlow (s) && gs->groups)
 		{
 		    CompWindow *w;
 
 		    for (w = s->windows; w; w = w->next)
-			groupComputeGlowQuads (w, &gs->glowTexture.matrix);
+			groupComputeGlowQuads (w, &gs->glowTexture->matrix);
 
 		    damageScreen (s);
 		}
@@ -230,6 +220,16 @@ groupInitDisplay (CompPlugin  *p,
     gd->lastRestackedGroup = NULL;
     gd->resizeInfo = NULL;
 
+    d->base.privates[groupDisplayPrivateIndex].ptr = gd;
+
+    if (!groupInitWindowHash (d))
+    {
+	d->base.privates[groupDisplayPrivateIndex].ptr = NULL;
+	freeScreenPrivateIndex (d, gd->screenPrivateIndex);
+	free (gd);
+	return FALSE;
+    }
+
     gd->groupWinPropertyAtom = XInternAtom (d->display,
 					    "_COMPIZ_GROUP", 0);
     gd->resizeNotifyAtom     = XInternAtom (d->display,
@@ -251,8 +251,6 @@ groupInitDisplay (CompPlugin  *p,
     groupSetIgnoreKeyTerminate (d, groupUnsetIgnore);
     groupSetChangeColorKeyInitiate (d, groupChangeColor);
 
-    d->base.privates[groupDisplayPrivateIndex].ptr = gd;
-
     srand (time (NULL));
 
     return TRUE;
@@ -270,6 +268,8 @@ groupFiniDisplay (CompPlugin  *p,
 
     freeScreenPrivateIndex (d, gd->screenPrivateIndex);
 
+    groupFiniWindowHash (d);
+
     UNWRAP (gd, d, handleEvent);
 
     free (gd);
@@ -285,6 +285,7 @@ groupInitScreen (CompPlugin *p,
 {
     GroupScreen       *gs;
     GroupGlowTypeEnum glowType;
+    int               i;
 
     GROUP_DISPLAY (s->display);
 
@@ -341,10 +342,13 @@ groupInitScreen (CompPlugin *p,
 
     gs->lastHoveredGroup = NULL;
 
-    gs->queued          = FALSE;
-    gs->pendingMoves    = NULL;
-    gs->pendingGrabs    = NULL;
-    gs->pendingUngrabs  = NULL;
+    gs->queued = FALSE;
+    groupInitQueues (s);
+
+    gs->noThumbFbo = FALSE;
+
+    memset (gs->titleCache, 0, sizeof (gs->titleCache));
+    gs->titleCacheClock = 0;
 
     gs->dequeueTimeoutHandle = 0;
 
@@ -362,14 +366,20 @@ groupInitScreen (CompPlugin *p,
     gs->initialActionsTimeoutHandle =
 	compAddTimeout (0, 0, groupApplyInitialActions, (void *) s);
 
-    initTexture (s, &gs->glowTexture);
+    /* upload the textures for all glow types once, switching the
+       glow type then only needs to select another one */
+    for (i = 0; i < NUM_GLOW_TYPES; i++)
+    {
+	initTexture (s, &gs->glowTextures[i]);
+	imageDataToTexture (s, &gs->glowTextures[i],
+			    glowTextureProperties[i].textureData,
+			    glowTextureProperties[i].textureSize,
+			    glowTextureProperties[i].textureSize,
+			    GL_RGBA, GL_UNSIGNED_BYTE);
+    }
 
     glowType = groupGetGlowType (s);
-    imageDataToTexture (s, &gs->glowTexture,
-			glowTextureProperties[glowType].textureData,
-			glowTextureProperties[glowType].textureSize,
-			glowTextureProperties[glowType].textureSize,
-			GL_RGBA, GL_UNSIGNED_BYTE);
+    gs->glowTexture = &gs->glowTextures[glowType];
 
     return TRUE;
 }
@@ -382,6 +392,8 @@ static void
 groupFiniScreen (CompPlugin *p,
 		 CompScreen *s)
 {
+    int i;
+
     GROUP_SCREEN (s);
 
     if (gs->groups)
@@ -399,6 +411,8 @@ groupFiniScreen (CompPlugin *p,
 		    if (slot->region)
 			XDestroyRegion (slot->region);
 
+		    groupFiniSlotThumb (s, slot);
+
 		    nextSlot = slot->next;
 		    free (slot);
 		    slot = nextSlot;
@@ -442,6 +456,9 @@ groupFiniScreen (CompPlugin *p,
     if (gs->dequeueTimeoutHandle)
 	compRemoveTimeout (gs->dequeueTimeoutHandle);
 
+    groupFiniQueues (s);
+    groupFiniTitleCache (s);
+
     if (gs->initialActionsTimeoutHandle)
 	compRemoveTimeout (gs->initialActionsTimeoutHandle);
 
@@ -462,7 +479,9 @@ groupFiniScreen (CompPlugin *p,
     UNWRAP (gs, s, windowStateChangeNotify);
     UNWRAP (gs, s, activateWindow);
 
-    finiTexture (s, &gs->glowTexture);
+    for (i = 0; i < NUM_GLOW_TYPES; i++)
+	finiTexture (s, &gs->glowTextures[i]);
+
     free (gs);
 }
 
@@ -485,10 +504,15 @@ groupInitWindow (CompPlugin *p,
     gw->group        = NULL;
     gw->slot         = NULL;
     gw->glowQuads    = NULL;
+    gw->nGlowQuads   = 0;
     gw->inSelection  = FALSE;
     gw->needsPosSync = FALSE;
     gw->readOnlyProperty = FALSE;
 
+    gw->pendingMove   = NULL;
+    gw->pendingGrab   = NULL;
+    gw->pendingUngrab = NULL;
+
     /* for tab */
     gw->animateState = 0;
 
@@ -516,7 +540,7 @@ groupInitWindow (CompPlugin *p,
 
     w->base.privates[gs->windowPrivateIndex].ptr = gw;
 
-    groupComputeGlowQuads (w, &gs->glowTexture.matrix);
+    groupComputeGlowQuads (w, &gs->glowTexture->matrix);
 
     return TRUE;
 }
@@ -543,6 +567,9 @@ groupFiniWindow (CompPlugin *p,
     if (gw->group)
 	groupDeleteGroupWindow (w);
 
+    groupRemoveWindowFromQueues (w);
+    groupInvalidateTitleCache (w->screen, w->id);
+
     if (gw->glowQuads)
 	free (gw->glowQuads);
 
@@ -24,6 +24,248 @@
 
 #include "group-internal.h"
 
+/*
+ * groupFiniSlotThumb
+ *
+ */
+void
+groupFiniSlotThumb (CompScreen      *s,
+		    GroupTabBarSlot *slot)
+{
+    if (!slot->thumbFbo && !slot->thumbTexture)
+	return;
+
+    makeScreenCurrent (s);
+
+    if (slot->thumbFbo)
+	(*s->deleteFramebuffers) (1, &slot->thumbFbo);
+    if (slot->thumbTexture)
+	glDeleteTextures (1, &slot->thumbTexture);
+
+    slot->thumbFbo     = 0;
+    slot->thumbTexture = 0;
+    slot->thumbWidth   = 0;
+    slot->thumbHeight  = 0;
+}
+
+/*
+ * groupInitSlotThumb
+ *
+ */
+static Bool
+groupInitSlotThumb (CompScreen      *s,
+		    GroupTabBarSlot *slot,
+		    int             width,
+		    int             height)
+{
+    GLint  oldFbo;
+    GLenum status;
+    int    texWidth = width, texHeight = height;
+
+    GROUP_SCREEN (s);
+
+    groupFiniSlotThumb (s, slot);
+
+    if (!s->textureNonPowerOfTwo)
+    {
+	for (texWidth = 1; texWidth < width; texWidth <<= 1);
+	for (texHeight = 1; texHeight < height; texHeight <<= 1);
+    }
+
+    glGenTextures (1, &slot->thumbTexture);
+    glBindTexture (GL_TEXTURE_2D, slot->thumbTexture);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, texWidth, texHeight, 0,
+		  GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &oldFbo);
+
+    (*s->genFramebuffers) (1, &slot->thumbFbo);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, slot->thumbFbo);
+    (*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+				GL_TEXTURE_2D, slot->thumbTexture, 0);
+    status = (*s->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, oldFbo);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+	compLogMessage ("group", CompLogLevelWarn,
+			"Incomplete thumbnail framebuffer, falling back "
+			"to direct thumbnail drawing.");
+	groupFiniSlotThumb (s, slot);
+	gs->noThumbFbo = TRUE;
+	return FALSE;
+    }
+
+    slot->thumbWidth     = width;
+    slot->thumbHeight    = height;
+    slot->thumbTexWidth  = texWidth;
+    slot->thumbTexHeight = texHeight;
+
+    return TRUE;
+}
+
+/*
+ * groupRenderSlotThumb
+ *
+ */
+static void
+groupRenderSlotThumb (CompWindow      *w,
+		      GroupTabBarSlot *slot,
+		      float           scale)
+{
+    CompScreen     *s = w->screen;
+    FragmentAttrib fragment;
+    CompTransform  wTransform;
+    GLint          oldFbo;
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &oldFbo);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, slot->thumbFbo);
+
+    glPushAttrib (GL_VIEWPORT_BIT | GL_SCISSOR_BIT | GL_COLOR_BUFFER_BIT);
+
+    glDisable (GL_SCISSOR_TEST);
+    glViewport (0, 0, slot->thumbWidth, slot->thumbHeight);
+
+    glClearColor (0.0f, 0.0f, 0.0f, 0.0f);
+    glClear (GL_COLOR_BUFFER_BIT);
+
+    /* window coordinates with y pointing down, so the
+       top of the thumbnail ends up at the highest row */
+    glMatrixMode (GL_PROJECTION);
+    glPushMatrix ();
+    glLoadIdentity ();
+    glOrtho (0, slot->thumbWidth, slot->thumbHeight, 0, -1.0, 1.0);
+    glMatrixMode (GL_MODELVIEW);
+
+    matrixGetIdentity (&wTransform);
+    matrixTranslate (&wTransform, slot->thumbWidth / 2, 0.0f, 0.0f);
+    matrixScale (&wTransform, scale, scale, 1.0f);
+    matrixTranslate (&wTransform, -(WIN_X (w) + WIN_WIDTH (w) / 2),
+		     -(WIN_Y (w) - w->output.top), 0.0f);
+
+    glPushMatrix ();
+    glLoadMatrixf (wTransform.m);
+
+    initFragmentAttrib (&fragment, &w->paint);
+
+    (*s->drawWindow) (w, &wTransform, &fragment, &infiniteRegion,
+		      PAINT_WINDOW_TRANSFORMED_MASK |
+		      PAINT_WINDOW_TRANSLUCENT_MASK);
+
+    glPopMatrix ();
+
+    glMatrixMode (GL_PROJECTION);
+    glPopMatrix ();
+    glMatrixMode (GL_MODELVIEW);
+
+    glPopAttrib ();
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, oldFbo);
+
+    slot->thumbDirty         = FALSE;
+    slot->msSinceThumbUpdate = 0;
+
+    slot->thumbOpacity    = w->paint.opacity;
+    slot->thumbBrightness = w->paint.brightness;
+    slot->thumbSaturation = w->paint.saturation;
+}
+
+/*
+ * groupPaintCachedThumb
+ *
+ */
+static Bool
+groupPaintCachedThumb (CompWindow          *w,
+		       GroupTabBarSlot     *slot,
+		       const CompTransform *transform,
+		       int                 x,
+		       int                 y,
+		       int                 width,
+		       int                 height,
+		       float               scale,
+		       GLushort            opacity)
+{
+    CompScreen *s = w->screen;
+    Bool       fresh = FALSE;
+    float      tx, ty;
+
+    GROUP_SCREEN (s);
+
+    if (!s->fbo || gs->noThumbFbo || width <= 0 || height <= 0)
+	return FALSE;
+
+    if (!slot->thumbFbo ||
+	slot->thumbWidth != width || slot->thumbHeight != height)
+    {
+	if (!groupInitSlotThumb (s, slot, width, height))
+	    return FALSE;
+
+	fresh = TRUE;
+    }
+
+    if (slot->thumbOpacity != w->paint.opacity       ||
+	slot->thumbBrightness != w->paint.brightness ||
+	slot->thumbSaturation != w->paint.saturation)
+    {
+	slot->thumbDirty = TRUE;
+    }
+
+    /* window damage only marks the thumbnail dirty, it is
+       re-rendered at most once per update interval */
+    if (fresh || (slot->thumbDirty &&
+		  slot->msSinceThumbUpdate >= GROUP_THUMB_UPDATE_INTERVAL))
+    {
+	groupRenderSlotThumb (w, slot, scale);
+    }
+
+    tx = (float) width / slot->thumbTexWidth;
+    ty = (float) height / slot->thumbTexHeight;
+
+    glPushMatrix ();
+    glLoadMatrixf (transform->m);
+
+    glEnable (GL_BLEND);
+    glEnable (GL_TEXTURE_2D);
+    glBindTexture (GL_TEXTURE_2D, slot->thumbTexture);
+
+    if (opacity != OPAQUE)
+    {
+	/* the thumbnail is premultiplied, so scale all channels */
+	screenTexEnvMode (s, GL_MODULATE);
+	glColor4us (opacity, opacity, opacity, opacity);
+    }
+
+    glBegin (GL_QUADS);
+    glTexCoord2f (0.0f, ty);
+    glVertex2i (x, y);
+    glTexCoord2f (0.0f, 0.0f);
+    glVertex2i (x, y + height);
+    glTexCoord2f (tx, 0.0f);
+    glVertex2i (x + width, y + height);
+    glTexCoord2f (tx, ty);
+    glVertex2i (x + width, y);
+    glEnd ();
+
+    if (opacity != OPAQUE)
+    {
+	glColor4usv (defaultColor);
+	screenTexEnvMode (s, GL_REPLACE);
+    }
+
+    glBindTexture (GL_TEXTURE_2D, 0);
+    glDisable (GL_TEXTURE_2D);
+    glDisable (GL_BLEND);
+
+    glPopMatrix ();
+
+    return TRUE;
+}
+
 /*
  * groupPaintThumb - taken from switcher and modified for tab bar
  *
@@ -38,6 +280,7 @@ groupPaintThumb (GroupSelection      *group,
     CompScreen            *s = w->screen;
     AddWindowGeometryProc oldAddWindowGeometry;
     WindowPaintAttrib     wAttrib = w->paint;
+    int                   opacity = OPAQUE;
     int                   tw, th;
 
     tw = slot->region->extents.x2 - slot->region->extents.x1;
@@ -51,16 +294,17 @@ groupPaintThumb (GroupSelection      *group,
     /* animate fade */
     if (group && group->tabBar->state == PaintFadeIn)
     {
-	wAttrib.opacity -= wAttrib.opacity * group->tabBar->animationTime /
-	                   (groupGetFadeTime (s) * 1000);
+	opacity -= opacity * group->tabBar->animationTime /
+	           (groupGetFadeTime (s) * 1000);
     }
     else if (group && group->tabBar->state == PaintFadeOut)
     {
-	wAttrib.opacity = wAttrib.opacity * group->tabBar->animationTime /
-	                  (groupGetFadeTime (s) * 1000);
+	opacity = opacity * group->tabBar->animationTime /
+	          (groupGetFadeTime (s) * 1000);
     }
 
-    wAttrib.opacity = wAttrib.opacity * targetOpacity / OPAQUE;
+    opacity = opacity * targetOpacity / OPAQUE;
+    wAttrib.opacity = wAttrib.opacity * opacity / OPAQUE;
 
     if (w->mapNum)
     {
@@ -99,6 +343,17 @@ groupPaintThumb (GroupSelection      *group,
 			      slot->region->extents.x2) / 2 + vx;
 	wAttrib.yTranslate = slot->region->extents.y1 + vy;
 
+	/* use the cached thumbnail if possible, it only contains
+	   the window itself so the fade is applied when drawing it */
+	if (groupPaintCachedThumb (w, slot, transform,
+				   wAttrib.xTranslate - tw / 2,
+				   wAttrib.yTranslate, tw, th,
+				   wAttrib.xScale, opacity))
+	{
+	    s->addWindowGeometry = oldAddWindowGeometry;
+	    return;
+	}
+
 	initFragmentAttrib (&fragment, &wAttrib);
 
 	matrixTranslate (&wTransform,
@@ -386,9 +641,24 @@ groupPreparePaintScreen (CompScreen *s,
 
 	if (bar)
 	{
-	    groupApplyForces (s, bar, (gs->dragged) ? gs->draggedSlot : NULL);
+	    GroupTabBarSlot *slot;
+
 	    groupApplySpeeds (s, group, msSinceLastPaint);
 
+	    /* repaint thumbnails which were held back by the rate limit */
+	    for (slot = bar->slots; slot; slot = slot->next)
+	    {
+		if (slot->msSinceThumbUpdate >= GROUP_THUMB_UPDATE_INTERVAL)
+		    continue;
+
+		slot->msSinceThumbUpdate += msSinceLastPaint;
+		if (slot->thumbDirty && bar->state != PaintOff &&
+		    slot->msSinceThumbUpdate >= GROUP_THUMB_UPDATE_INTERVAL)
+		{
+		    groupDamageTabBarSlot (slot);
+		}
+	    }
+
 	    if ((bar->state != PaintOff) && HAS_TOP_WIN (group))
 		groupHandleHoverDetection (group);
 
@@ -563,35 +833,58 @@ groupDonePaintScreen (CompScreen *s)
 	    damageScreen (s);
 	else if (group->tabBar)
 	{
-	    Bool needDamage = FALSE;
+	    GroupTabBar *bar = group->tabBar;
 
-	    if ((group->tabBar->state == PaintFadeIn) ||
-		(group->tabBar->state == PaintFadeOut))
+	    /* only damage what is animated - moving slots damage
+	       themselves when being moved, see groupIntegrateSpeeds
+	       and groupHandleMotionEvent */
+	    if ((bar->state == PaintFadeIn) || (bar->state == PaintFadeOut))
 	    {
-		needDamage = TRUE;
+		groupDamageTabBarRegion (group);
+		continue;
 	    }
 
-	    if (group->tabBar->textLayer)
+	    if (bar->bgAnimation)
+		groupDamageTabBarBackground (group);
+
+	    /* keep the spring animation running while the bar borders
+	       or slots are moving */
+	    if (bar->state != PaintOff)
 	    {
-		if ((group->tabBar->textLayer->state == PaintFadeIn) ||
-		    (group->tabBar->textLayer->state == PaintFadeOut))
+		GroupTabBarSlot *slot;
+
+		if (!bar->bgAnimation && (bar->leftSpeed || bar->rightSpeed))
+		    groupDamageTabBarBackground (group);
+
+		for (slot = bar->slots; slot; slot = slot->next)
 		{
-		    needDamage = TRUE;
+		    int center = (slot->region->extents.x1 +
+				  slot->region->extents.x2) / 2;
+
+		    if (slot->speed || center != slot->springX)
+			groupDamageTabBarSlot (slot);
 		}
 	    }
 
-	    if (group->tabBar->bgAnimation)
-		needDamage = TRUE;
-
-	    if (gs->draggedSlot)
-		needDamage = TRUE;
-
-	    if (needDamage)
-		groupDamageTabBarRegion (group);
+	    if (bar->textLayer &&
+		((bar->textLayer->state == PaintFadeIn) ||
+		 (bar->textLayer->state == PaintFadeOut)))
+	    {
+		groupDamageTabBarText (group);
+	    }
 	}
     }
 }
 
+/*
+ * groupComputeGlowQuads
+ *
+ * The glow geometry is relative to the window's input rect origin, so
+ * it only needs to be recomputed when the window size, the frame
+ * extents or the glow settings change; groupDrawWindow moves it to the
+ * window position.
+ *
+ */
 void
 groupComputeGlowQuads (CompWindow *w,
 		       CompMatrix *matrix)
@@ -599,6 +892,7 @@ groupComputeGlowQuads (CompWindow *w,
     BoxRec            *box;
     CompMatrix        *quadMatrix;
     int               glowSize, glowOffset;
+    int               width, height, i;
     GroupGlowTypeEnum glowType;
 
     GROUP_WINDOW (w);
@@ -617,6 +911,7 @@ groupComputeGlowQuads (CompWindow *w,
 	    free (gw->glowQuads);
 	    gw->glowQuads = NULL;
 	}
+	gw->nGlowQuads = 0;
 	return;
     }
 
@@ -627,95 +922,90 @@ groupComputeGlowQuads (CompWindow *w,
     glowOffset = (glowSize * gd->glowTextureProperties[glowType].glowOffset /
 		  gd->glowTextureProperties[glowType].textureSize) + 1;
 
+    width  = WIN_REAL_WIDTH (w);
+    height = WIN_REAL_HEIGHT (w);
+
     /* Top left corner */
     box = &gw->glowQuads[GLOWQUAD_TOPLEFT].box;
     gw->glowQuads[GLOWQUAD_TOPLEFT].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_TOPLEFT].matrix;
 
-    box->x1 = WIN_REAL_X (w) - glowSize + glowOffset;
-    box->y1 = WIN_REAL_Y (w) - glowSize + glowOffset;
-    box->x2 = WIN_REAL_X (w) + glowOffset;
-    box->y2 = WIN_REAL_Y (w) + glowOffset;
+    box->x1 = -glowSize + glowOffset;
+    box->y1 = -glowSize + glowOffset;
+    box->x2 = glowOffset;
+    box->y2 = glowOffset;
 
     quadMatrix->xx = 1.0f / glowSize;
     quadMatrix->yy = -1.0f / glowSize;
     quadMatrix->x0 = -(box->x1 * quadMatrix->xx);
     quadMatrix->y0 = 1.0 -(box->y1 * quadMatrix->yy);
 
-    box->x2 = MIN (WIN_REAL_X (w) + glowOffset,
-		   WIN_REAL_X (w) + (WIN_REAL_WIDTH (w) / 2));
-    box->y2 = MIN (WIN_REAL_Y (w) + glowOffset,
-		   WIN_REAL_Y (w) + (WIN_REAL_HEIGHT (w) / 2));
+    box->x2 = MIN (glowOffset, width / 2);
+    box->y2 = MIN (glowOffset, height / 2);
 
     /* Top right corner */
     box = &gw->glowQuads[GLOWQUAD_TOPRIGHT].box;
     gw->glowQuads[GLOWQUAD_TOPRIGHT].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_TOPRIGHT].matrix;
 
-    box->x1 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) - glowOffset;
-    box->y1 = WIN_REAL_Y (w) - glowSize + glowOffset;
-    box->x2 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) + glowSize - glowOffset;
-    box->y2 = WIN_REAL_Y (w) + glowOffset;
+    box->x1 = width - glowOffset;
+    box->y1 = -glowSize + glowOffset;
+    box->x2 = width + glowSize - glowOffset;
+    box->y2 = glowOffset;
 
     quadMatrix->xx = -1.0f / glowSize;
     quadMatrix->yy = -1.0f / glowSize;
     quadMatrix->x0 = 1.0 - (box->x1 * quadMatrix->xx);
     quadMatrix->y0 = 1.0 - (box->y1 * quadMatrix->yy);
 
-    box->x1 = MAX (WIN_REAL_X (w) + WIN_REAL_WIDTH (w) - glowOffset,
-		   WIN_REAL_X (w) + (WIN_REAL_WIDTH (w) / 2));
-    box->y2 = MIN (WIN_REAL_Y (w) + glowOffset,
-		   WIN_REAL_Y (w) + (WIN_REAL_HEIGHT (w) / 2));
+    box->x1 = MAX (width - glowOffset, width / 2);
+    box->y2 = MIN (glowOffset, height / 2);
 
     /* Bottom left corner */
     box = &gw->glowQuads[GLOWQUAD_BOTTOMLEFT].box;
     gw->glowQuads[GLOWQUAD_BOTTOMLEFT].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_BOTTOMLEFT].matrix;
 
-    box->x1 = WIN_REAL_X (w) - glowSize + glowOffset;
-    box->y1 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) - glowOffset;
-    box->x2 = WIN_REAL_X (w) + glowOffset;
-    box->y2 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) + glowSize - glowOffset;
+    box->x1 = -glowSize + glowOffset;
+    box->y1 = height - glowOffset;
+    box->x2 = glowOffset;
+    box->y2 = height + glowSize - glowOffset;
 
     quadMatrix->xx = 1.0f / glowSize;
     quadMatrix->yy = 1.0f / glowSize;
     quadMatrix->x0 = -(box->x1 * quadMatrix->xx);
     quadMatrix->y0 = -(box->y1 * quadMatrix->yy);
 
-    box->y1 = MAX (WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) - glowOffset,
-		   WIN_REAL_Y (w) + (WIN_REAL_HEIGHT (w) / 2));
-    box->x2 = MIN (WIN_REAL_X (w) + glowOffset,
-		   WIN_REAL_X (w) + (WIN_REAL_WIDTH (w) / 2));
+    box->y1 = MAX (height - glowOffset, height / 2);
+    box->x2 = MIN (glowOffset, width / 2);
 
     /* Bottom right corner */
     box = &gw->glowQuads[GLOWQUAD_BOTTOMRIGHT].box;
     gw->glowQuads[GLOWQUAD_BOTTOMRIGHT].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_BOTTOMRIGHT].matrix;
 
-    box->x1 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) - glowOffset;
-    box->y1 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) - glowOffset;
-    box->x2 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) + glowSize - glowOffset;
-    box->y2 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) + glowSize - glowOffset;
+    box->x1 = width - glowOffset;
+    box->y1 = height - glowOffset;
+    box->x2 = width + glowSize - glowOffset;
+    box->y2 = height + glowSize - glowOffset;
 
     quadMatrix->xx = -1.0f / glowSize;
     quadMatrix->yy = 1.0f / glowSize;
     quadMatrix->x0 = 1.0 - (box->x1 * quadMatrix->xx);
     quadMatrix->y0 = -(box->y1 * quadMatrix->yy);
 
-    box->x1 = MAX (WIN_REAL_X (w) + WIN_REAL_WIDTH (w) - glowOffset,
-		   WIN_REAL_X (w) + (WIN_REAL_WIDTH (w) / 2));
-    box->y1 = MAX (WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) - glowOffset,
-		   WIN_REAL_Y (w) + (WIN_REAL_HEIGHT (w) / 2));
+    box->x1 = MAX (width - glowOffset, width / 2);
+    box->y1 = MAX (height - glowOffset, height / 2);
 
     /* Top edge */
     box = &gw->glowQuads[GLOWQUAD_TOP].box;
     gw->glowQuads[GLOWQUAD_TOP].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_TOP].matrix;
 
-    box->x1 = WIN_REAL_X (w) + glowOffset;
-    box->y1 = WIN_REAL_Y (w) - glowSize + glowOffset;
-    box->x2 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) - glowOffset;
-    box->y2 = WIN_REAL_Y (w) + glowOffset;
+    box->x1 = glowOffset;
+    box->y1 = -glowSize + glowOffset;
+    box->x2 = width - glowOffset;
+    box->y2 = glowOffset;
 
     quadMatrix->xx = 0.0f;
     quadMatrix->yy = -1.0f / glowSize;
@@ -727,10 +1017,10 @@ groupComputeGlowQuads (CompWindow *w,
     gw->glowQuads[GLOWQUAD_BOTTOM].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_BOTTOM].matrix;
 
-    box->x1 = WIN_REAL_X (w) + glowOffset;
-    box->y1 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) - glowOffset;
-    box->x2 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) - glowOffset;
-    box->y2 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) + glowSize - glowOffset;
+    box->x1 = glowOffset;
+    box->y1 = height - glowOffset;
+    box->x2 = width - glowOffset;
+    box->y2 = height + glowSize - glowOffset;
 
     quadMatrix->xx = 0.0f;
     quadMatrix->yy = 1.0f / glowSize;
@@ -742,10 +1032,10 @@ groupComputeGlowQuads (CompWindow *w,
     gw->glowQuads[GLOWQUAD_LEFT].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_LEFT].matrix;
 
-    box->x1 = WIN_REAL_X (w) - glowSize + glowOffset;
-    box->y1 = WIN_REAL_Y (w) + glowOffset;
-    box->x2 = WIN_REAL_X (w) + glowOffset;
-    box->y2 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) - glowOffset;
+    box->x1 = -glowSize + glowOffset;
+    box->y1 = glowOffset;
+    box->x2 = glowOffset;
+    box->y2 = height - glowOffset;
 
     quadMatrix->xx = 1.0f / glowSize;
     quadMatrix->yy = 0.0f;
@@ -757,15 +1047,25 @@ groupComputeGlowQuads (CompWindow *w,
     gw->glowQuads[GLOWQUAD_RIGHT].matrix = *matrix;
     quadMatrix = &gw->glowQuads[GLOWQUAD_RIGHT].matrix;
 
-    box->x1 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) - glowOffset;
-    box->y1 = WIN_REAL_Y (w) + glowOffset;
-    box->x2 = WIN_REAL_X (w) + WIN_REAL_WIDTH (w) + glowSize - glowOffset;
-    box->y2 = WIN_REAL_Y (w) + WIN_REAL_HEIGHT (w) - glowOffset;
+    box->x1 = width - glowOffset;
+    box->y1 = glowOffset;
+    box->x2 = width + glowSize - glowOffset;
+    box->y2 = height - glowOffset;
 
     quadMatrix->xx = -1.0f / glowSize;
     quadMatrix->yy = 0.0f;
     quadMatrix->x0 = 1.0 - (box->x1 * quadMatrix->xx);
     quadMatrix->y0 = 0.0;
+
+    /* drop empty quads, so drawing doesn't need to check for them */
+    gw->nGlowQuads = 0;
+    for (i = 0; i < NUM_GLOWQUADS; i++)
+    {
+	box = &gw->glowQuads[i].box;
+
+	if (box->x1 < box->x2 && box->y1 < box->y2)
+	    gw->glowQuads[gw->nGlowQuads++] = gw->glowQuads[i];
+    }
 }
 
 /*
@@ -790,26 +1090,36 @@ groupDrawWindow (CompWindow           *w,
 	if (mask & PAINT_WINDOW_TRANSFORMED_MASK)
 	    region = &infiniteRegion;
 
-	if (region->numRects)
+	if (region->numRects && gw->nGlowQuads)
 	{
-	    REGION box;
-	    int    i;
+	    REGION     box;
+	    CompMatrix matrix;
+	    int        i, x, y;
 
 	    box.rects = &box.extents;
 	    box.numRects = 1;
 
+	    x = WIN_REAL_X (w);
+	    y = WIN_REAL_Y (w);
+
 	    w->vCount = w->indexCount = 0;
 
-	    for (i = 0; i < NUM_GLOWQUADS; i++)
+	    /* all quads end up in one vertex array which is drawn
+	       by a single drawWindowTexture call below */
+	    for (i = 0; i < gw->nGlowQuads; i++)
 	    {
-		box.extents = gw->glowQuads[i].box;
+		GlowQuad *quad = &gw->glowQuads[i];
 
-		if (box.extents.x1 < box.extents.x2 &&
-		    box.extents.y1 < box.extents.y2)
-		{
-		    (*s->addWindowGeometry) (w, &gw->glowQuads[i].matrix,
-					     1, &box, region);
-		}
+		box.extents.x1 = quad->box.x1 + x;
+		box.extents.y1 = quad->box.y1 + y;
+		box.extents.x2 = quad->box.x2 + x;
+		box.extents.y2 = quad->box.y2 + y;
+
+		matrix = quad->matrix;
+		matrix.x0 -= x * matrix.xx;
+		matrix.y0 -= y * matrix.yy;
+
+		(*s->addWindowGeometry) (w, &matrix, 1, &box, region);
 	    }
 
 	    if (w->vCount)
@@ -844,7 +1154,7 @@ groupDrawWindow (CompWindow           *w,
 
 		/* we use PAINT_WINDOW_TRANSFORMED_MASK here to force
 		   the usage of a good texture filter */
-		(*s->drawWindowTexture) (w, &gs->glowTexture, &fAttrib,
+		(*s->drawWindowTexture) (w, gs->glowTexture, &fAttrib,
 					 mask | PAINT_WINDOW_BLEND_MASK |
 					 PAINT_WINDOW_TRANSLUCENT_MASK |
 					 PAINT_WINDOW_TRANSFORMED_MASK);
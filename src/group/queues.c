@@ -24,6 +24,179 @@
 
 #include "group-internal.h"
 
+/*
+ * queue entry pools
+ *
+ * Entries are taken from a per-screen free list which is backed by a
+ * preallocated block, so enqueuing does not hit the allocator during
+ * normal operation. Each window keeps a pointer to its pending entries,
+ * which lets repeated notifies for the same window be merged in place.
+ */
+
+#define IN_POOL(entry, pool) \
+    ((entry) >= (pool) && (entry) < (pool) + GROUP_QUEUE_POOL_SIZE)
+
+static GroupPendingMoves *
+groupAllocPendingMove (GroupScreen *gs)
+{
+    GroupPendingMoves *move = gs->freeMoves;
+
+    if (move)
+	gs->freeMoves = move->next;
+    else
+	move = malloc (sizeof (GroupPendingMoves));
+
+    return move;
+}
+
+static GroupPendingGrabs *
+groupAllocPendingGrab (GroupScreen *gs)
+{
+    GroupPendingGrabs *grab = gs->freeGrabs;
+
+    if (grab)
+	gs->freeGrabs = grab->next;
+    else
+	grab = malloc (sizeof (GroupPendingGrabs));
+
+    return grab;
+}
+
+static GroupPendingUngrabs *
+groupAllocPendingUngrab (GroupScreen *gs)
+{
+    GroupPendingUngrabs *ungrab = gs->freeUngrabs;
+
+    if (ungrab)
+	gs->freeUngrabs = ungrab->next;
+    else
+	ungrab = malloc (sizeof (GroupPendingUngrabs));
+
+    return ungrab;
+}
+
+void
+groupInitQueues (CompScreen *s)
+{
+    int i;
+
+    GROUP_SCREEN (s);
+
+    gs->pendingMoves   = gs->pendingMovesTail   = NULL;
+    gs->pendingGrabs   = gs->pendingGrabsTail   = NULL;
+    gs->pendingUngrabs = gs->pendingUngrabsTail = NULL;
+
+    gs->freeMoves   = NULL;
+    gs->freeGrabs   = NULL;
+    gs->freeUngrabs = NULL;
+
+    /* failing to preallocate is not fatal, entries are
+       allocated on demand then */
+    gs->movePool   = malloc (GROUP_QUEUE_POOL_SIZE *
+			     sizeof (GroupPendingMoves));
+    gs->grabPool   = malloc (GROUP_QUEUE_POOL_SIZE *
+			     sizeof (GroupPendingGrabs));
+    gs->ungrabPool = malloc (GROUP_QUEUE_POOL_SIZE *
+			     sizeof (GroupPendingUngrabs));
+
+    for (i = GROUP_QUEUE_POOL_SIZE - 1; i >= 0; i--)
+    {
+	if (gs->movePool)
+	{
+	    gs->movePool[i].next = gs->freeMoves;
+	    gs->freeMoves = &gs->movePool[i];
+	}
+	if (gs->grabPool)
+	{
+	    gs->grabPool[i].next = gs->freeGrabs;
+	    gs->freeGrabs = &gs->grabPool[i];
+	}
+	if (gs->ungrabPool)
+	{
+	    gs->ungrabPool[i].next = gs->freeUngrabs;
+	    gs->freeUngrabs = &gs->ungrabPool[i];
+	}
+    }
+}
+
+void
+groupFiniQueues (CompScreen *s)
+{
+    GROUP_SCREEN (s);
+
+    /* hand everything still pending back to the free lists, then
+       release all entries which were allocated outside of the pools */
+    if (gs->pendingMovesTail)
+    {
+	gs->pendingMovesTail->next = gs->freeMoves;
+	gs->freeMoves = gs->pendingMoves;
+    }
+    if (gs->pendingGrabsTail)
+    {
+	gs->pendingGrabsTail->next = gs->freeGrabs;
+	gs->freeGrabs = gs->pendingGrabs;
+    }
+    if (gs->pendingUngrabsTail)
+    {
+	gs->pendingUngrabsTail->next = gs->freeUngrabs;
+	gs->freeUngrabs = gs->pendingUngrabs;
+    }
+
+    while (gs->freeMoves)
+    {
+	GroupPendingMoves *move = gs->freeMoves;
+
+	gs->freeMoves = move->next;
+	if (!IN_POOL (move, gs->movePool))
+	    free (move);
+    }
+    while (gs->freeGrabs)
+    {
+	GroupPendingGrabs *grab = gs->freeGrabs;
+
+	gs->freeGrabs = grab->next;
+	if (!IN_POOL (grab, gs->grabPool))
+	    free (grab);
+    }
+    while (gs->freeUngrabs)
+    {
+	GroupPendingUngrabs *ungrab = gs->freeUngrabs;
+
+	gs->freeUngrabs = ungrab->next;
+	if (!IN_POOL (ungrab, gs->ungrabPool))
+	    free (ungrab);
+    }
+
+    if (gs->movePool)
+	free (gs->movePool);
+    if (gs->grabPool)
+	free (gs->grabPool);
+    if (gs->ungrabPool)
+	free (gs->ungrabPool);
+
+    gs->pendingMoves   = gs->pendingMovesTail   = NULL;
+    gs->pendingGrabs   = gs->pendingGrabsTail   = NULL;
+    gs->pendingUngrabs = gs->pendingUngrabsTail = NULL;
+}
+
+void
+groupRemoveWindowFromQueues (CompWindow *w)
+{
+    GROUP_WINDOW (w);
+
+    /* the entries stay linked and are skipped when dequeuing */
+    if (gw->pendingMove)
+	gw->pendingMove->w = NULL;
+    if (gw->pendingGrab)
+	gw->pendingGrab->w = NULL;
+    if (gw->pendingUngrab)
+	gw->pendingUngrab->w = NULL;
+
+    gw->pendingMove   = NULL;
+    gw->pendingGrab   = NULL;
+    gw->pendingUngrab = NULL;
+}
+
 /*
  * functions enqueuing pending notifies
  *
@@ -42,28 +215,40 @@ groupEnqueueMoveNotify (CompWindow *w,
     GroupPendingMoves *move;
 
     GROUP_SCREEN (w->screen);
+    GROUP_WINDOW (w);
 
-    move = malloc (sizeof (GroupPendingMoves));
-    if (!move)
-	return;
+    move = gw->pendingMove;
+    if (move)
+    {
+	/* merge with the move already queued for this window */
+	move->dx += dx;
+	move->dy += dy;
 
-    move->w  = w;
-    move->dx = dx;
-    move->dy = dy;
+	move->immediate |= immediate;
+	move->sync      |= sync;
+    }
+    else
+    {
+	move = groupAllocPendingMove (gs);
+	if (!move)
+	    return;
 
-    move->immediate = immediate;
-    move->sync      = sync;
-    move->next      = NULL;
+	move->w  = w;
+	move->dx = dx;
+	move->dy = dy;
 
-    if (gs->pendingMoves)
-    {
-	GroupPendingMoves *temp;
-	for (temp = gs->pendingMoves; temp->next; temp = temp->next);
+	move->immediate = immediate;
+	move->sync      = sync;
+	move->next      = NULL;
 
-	temp->next = move;
+	if (gs->pendingMovesTail)
+	    gs->pendingMovesTail->next = move;
+	else
+	    gs->pendingMoves = move;
+
+	gs->pendingMovesTail = move;
+	gw->pendingMove      = move;
     }
-    else
-	gs->pendingMoves = move;
 
     if (!gs->dequeueTimeoutHandle)
     {
@@ -72,62 +257,55 @@ groupEnqueueMoveNotify (CompWindow *w,
     }
 }
 
-static void
-groupDequeueSyncs (GroupPendingSyncs *syncs)
-{
-    GroupPendingSyncs *sync;
-
-    while (syncs)
-    {
-	sync = syncs;
-	syncs = sync->next;
-	
-	GROUP_WINDOW (sync->w);
-	if (gw->needsPosSync)
-	{
-	    syncWindowPosition (sync->w);
-	    gw->needsPosSync = FALSE;
-	}
-
-	free (sync);
-    }
-
-}
-
 void
 groupDequeueMoveNotifies (CompScreen *s)
 {
-    GroupPendingMoves *move;
-    GroupPendingSyncs *syncs = NULL, *sync;
+    GroupPendingMoves *moves, *move, *last = NULL;
 
     GROUP_SCREEN (s);
 
+    if (!gs->pendingMoves)
+	return;
+
+    /* detach the queue so notifies issued from moveWindow
+       start a new one */
+    moves = gs->pendingMoves;
+    gs->pendingMoves = gs->pendingMovesTail = NULL;
+
     gs->queued = TRUE;
 
-    while (gs->pendingMoves)
+    for (move = moves; move; move = move->next)
     {
-	move = gs->pendingMoves;
-	gs->pendingMoves = move->next;
+	if (!move->w)
+	    continue;
+
+	GROUP_WINDOW (move->w);
+	gw->pendingMove = NULL;
+
+	if (move->dx || move->dy)
+	    moveWindow (move->w, move->dx, move->dy, TRUE, move->immediate);
 
-	moveWindow (move->w, move->dx, move->dy, TRUE, move->immediate);
 	if (move->sync)
+	    gw->needsPosSync = TRUE;
+    }
+
+    for (move = moves; move; move = move->next)
+    {
+	last = move;
+
+	if (!move->w || !move->sync)
+	    continue;
+
+	GROUP_WINDOW (move->w);
+	if (gw->needsPosSync)
 	{
-	    sync = malloc (sizeof (GroupPendingSyncs));
-	    if (sync)
-	    {
-		GROUP_WINDOW (move->w);
-
-		gw->needsPosSync = TRUE;
-		sync->w          = move->w;
-		sync->next       = syncs;
-		syncs            = sync;
-	    }
+	    syncWindowPosition (move->w);
+	    gw->needsPosSync = FALSE;
 	}
-	free (move);
     }
 
-    if (syncs)
-	groupDequeueSyncs (syncs);
+    last->next = gs->freeMoves;
+    gs->freeMoves = moves;
 
     gs->queued = FALSE;
 }
@@ -142,28 +320,33 @@ groupEnqueueGrabNotify (CompWindow   *w,
     GroupPendingGrabs *grab;
 
     GROUP_SCREEN (w->screen);
+    GROUP_WINDOW (w);
 
-    grab = malloc (sizeof (GroupPendingGrabs));
+    grab = gw->pendingGrab;
     if (!grab)
-	return;
+    {
+	grab = groupAllocPendingGrab (gs);
+	if (!grab)
+	    return;
+
+	grab->next = NULL;
+
+	if (gs->pendingGrabsTail)
+	    gs->pendingGrabsTail->next = grab;
+	else
+	    gs->pendingGrabs = grab;
 
+	gs->pendingGrabsTail = grab;
+	gw->pendingGrab      = grab;
+    }
+
+    /* only the most recent grab of a window is delivered */
     grab->w = w;
     grab->x = x;
     grab->y = y;
 
     grab->state = state;
     grab->mask  = mask;
-    grab->next  = NULL;
-
-    if (gs->pendingGrabs)
-    {
-	GroupPendingGrabs *temp;
-	for (temp = gs->pendingGrabs; temp->next; temp = temp->next);
-
-	temp->next = grab;
-    }
-    else
-	gs->pendingGrabs = grab;
 
     if (!gs->dequeueTimeoutHandle)
     {
@@ -175,24 +358,36 @@ groupEnqueueGrabNotify (CompWindow   *w,
 static void
 groupDequeueGrabNotifies (CompScreen *s)
 {
-    GroupPendingGrabs *grab;
+    GroupPendingGrabs *grabs, *grab, *last = NULL;
 
     GROUP_SCREEN (s);
 
+    if (!gs->pendingGrabs)
+	return;
+
+    grabs = gs->pendingGrabs;
+    gs->pendingGrabs = gs->pendingGrabsTail = NULL;
+
     gs->queued = TRUE;
 
-    while (gs->pendingGrabs)
+    for (grab = grabs; grab; grab = grab->next)
     {
-	grab = gs->pendingGrabs;
-	gs->pendingGrabs = gs->pendingGrabs->next;
+	last = grab;
+
+	if (!grab->w)
+	    continue;
+
+	GROUP_WINDOW (grab->w);
+	gw->pendingGrab = NULL;
 
 	(*(grab->w)->screen->windowGrabNotify) (grab->w,
 						grab->x, grab->y,
 						grab->state, grab->mask);
-
-	free (grab);
     }
 
+    last->next = gs->freeGrabs;
+    gs->freeGrabs = grabs;
+
     gs->queued = FALSE;
 }
 
@@ -202,24 +397,25 @@ groupEnqueueUngrabNotify (CompWindow *w)
     GroupPendingUngrabs *ungrab;
 
     GROUP_SCREEN (w->screen);
+    GROUP_WINDOW (w);
 
-    ungrab = malloc (sizeof (GroupPendingUngrabs));
-
-    if (!ungrab)
-	return;
+    if (!gw->pendingUngrab)
+    {
+	ungrab = groupAllocPendingUngrab (gs);
+	if (!ungrab)
+	    return;
 
-    ungrab->w    = w;
-    ungrab->next = NULL;
+	ungrab->w    = w;
+	ungrab->next = NULL;
 
-    if (gs->pendingUngrabs)
-    {
-	GroupPendingUngrabs *temp;
-	for (temp = gs->pendingUngrabs; temp->next; temp = temp->next);
+	if (gs->pendingUngrabsTail)
+	    gs->pendingUngrabsTail->next = ungrab;
+	else
+	    gs->pendingUngrabs = ungrab;
 
-	temp->next = ungrab;
+	gs->pendingUngrabsTail = ungrab;
+	gw->pendingUngrab      = ungrab;
     }
-    else
-	gs->pendingUngrabs = ungrab;
 
     if (!gs->dequeueTimeoutHandle)
     {
@@ -231,22 +427,34 @@ groupEnqueueUngrabNotify (CompWindow *w)
 static void
 groupDequeueUngrabNotifies (CompScreen *s)
 {
-    GroupPendingUngrabs *ungrab;
+    GroupPendingUngrabs *ungrabs, *ungrab, *last = NULL;
 
     GROUP_SCREEN (s);
 
+    if (!gs->pendingUngrabs)
+	return;
+
+    ungrabs = gs->pendingUngrabs;
+    gs->pendingUngrabs = gs->pendingUngrabsTail = NULL;
+
     gs->queued = TRUE;
 
-    while (gs->pendingUngrabs)
+    for (ungrab = ungrabs; ungrab; ungrab = ungrab->next)
     {
-	ungrab = gs->pendingUngrabs;
-	gs->pendingUngrabs = gs->pendingUngrabs->next;
+	last = ungrab;
 
-	(*(ungrab->w)->screen->windowUngrabNotify) (ungrab->w);
+	if (!ungrab->w)
+	    continue;
+
+	GROUP_WINDOW (ungrab->w);
+	gw->pendingUngrab = NULL;
 
-	free (ungrab);
+	(*(ungrab->w)->screen->windowUngrabNotify) (ungrab->w);
     }
 
+    last->next = gs->freeUngrabs;
+    gs->freeUngrabs = ungrabs;
+
     gs->queued = FALSE;
 }
 
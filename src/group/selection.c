@@ -33,25 +33,55 @@ groupWindowInRegion (CompWindow *w,
 		     Region     src,
 		     float      precision)
 {
-    Region buf;
-    int    i;
-    int    area = 0;
-    BOX    *box;
+    BOX *wBox = &w->region->extents;
+    int i;
+    int area = 0;
 
-    buf = XCreateRegion ();
-    if (!buf)
+    if (wBox->x2 <= src->extents.x1 || wBox->x1 >= src->extents.x2 ||
+	wBox->y2 <= src->extents.y1 || wBox->y1 >= src->extents.y2)
+    {
 	return FALSE;
+    }
 
-    XIntersectRegion (w->region, src, buf);
-
-    /* buf area */
-    for (i = 0; i < buf->numRects; i++)
+    if (w->region->numRects > 1)
     {
-	box = &buf->rects[i];
-	area += (box->x2 - box->x1) * (box->y2 - box->y1); /* width * height */
+	/* shaped window, do the exact region math */
+	Region buf;
+	BOX    *box;
+
+	buf = XCreateRegion ();
+	if (!buf)
+	    return FALSE;
+
+	XIntersectRegion (w->region, src, buf);
+
+	/* buf area */
+	for (i = 0; i < buf->numRects; i++)
+	{
+	    box = &buf->rects[i];
+	    area += (box->x2 - box->x1) * (box->y2 - box->y1);
+	}
+
+	XDestroyRegion (buf);
     }
+    else
+    {
+	/* rectangular window, the rects of src don't overlap so
+	   the intersection area is just the sum of the pieces */
+	for (i = 0; i < src->numRects; i++)
+	{
+	    BOX *box = &src->rects[i];
+	    int x1, y1, x2, y2;
 
-    XDestroyRegion (buf);
+	    x1 = MAX (box->x1, wBox->x1);
+	    y1 = MAX (box->y1, wBox->y1);
+	    x2 = MIN (box->x2, wBox->x2);
+	    y2 = MIN (box->y2, wBox->y2);
+
+	    if (x1 < x2 && y1 < y2)
+		area += (x2 - x1) * (y2 - y1); /* width * height */
+	}
+    }
 
     if (area >= WIN_WIDTH (w) * WIN_HEIGHT (w) * precision)
     {
@@ -63,26 +93,29 @@ groupWindowInRegion (CompWindow *w,
 }
 
 /*
- * groupFindGroupInWindows
+ * groupInsertSeenGroup
  *
  */
 static Bool
-groupFindGroupInWindows (GroupSelection *group,
-			 CompWindow     **windows,
-			 int            nWins)
+groupInsertSeenGroup (GroupSelection **set,
+		      unsigned int   mask,
+		      GroupSelection *group)
 {
-    int i;
+    unsigned int i;
 
-    for (i = 0; i < nWins; i++)
+    /* open addressing, the set is never more than half full */
+    i = ((unsigned long) group >> 4) & mask;
+    while (set[i])
     {
-	CompWindow *cw = windows[i];
-	GROUP_WINDOW (cw);
+	if (set[i] == group)
+	    return FALSE;
 
-	if (gw->group == group)
-	    return TRUE;
+	i = (i + 1) & mask;
     }
 
-    return FALSE;
+    set[i] = group;
+
+    return TRUE;
 }
 
 /*
@@ -94,10 +127,21 @@ groupFindWindowsInRegion (CompScreen *s,
 			  Region     reg,
 			  int        *c)
 {
-    float      precision = groupGetSelectPrecision (s) / 100.0f;
-    CompWindow **ret = NULL;
-    int        count = 0;
-    CompWindow *w;
+    float          precision = groupGetSelectPrecision (s) / 100.0f;
+    CompWindow     **ret = NULL;
+    int            count = 0, size = 0;
+    GroupSelection **seen = NULL, *group;
+    unsigned int   seenSize = 1;
+    CompWindow     *w;
+
+    GROUP_SCREEN (s);
+
+    /* every window contributes at most one group */
+    for (group = gs->groups; group; group = group->next)
+	seenSize++;
+    while (seenSize & (seenSize - 1))
+	seenSize++;
+    seenSize *= 2;
 
     for (w = s->reverseWindows; w; w = w->prev)
     {
@@ -105,16 +149,41 @@ groupFindWindowsInRegion (CompScreen *s,
 	    groupWindowInRegion (w, reg, precision))
 	{
 	    GROUP_WINDOW (w);
-	    if (gw->group && groupFindGroupInWindows (gw->group, ret, count))
-		continue;
 
-	    ret = realloc (ret, sizeof (CompWindow) * (count + 1));
+	    if (gw->group)
+	    {
+		if (!seen)
+		{
+		    seen = calloc (seenSize, sizeof (GroupSelection *));
+		    if (!seen)
+			break;
+		}
+
+		if (!groupInsertSeenGroup (seen, seenSize - 1, gw->group))
+		    continue;
+	    }
+
+	    if (count == size)
+	    {
+		CompWindow **buf;
+
+		size = size ? size * 2 : 16;
+		buf = realloc (ret, sizeof (CompWindow *) * size);
+		if (!buf)
+		    break;
+
+		ret = buf;
+	    }
+
 	    ret[count] = w;
 
 	    count++;
 	}
     }
 
+    if (seen)
+	free (seen);
+
     (*c) = count;
     return ret;
 }
@@ -944,8 +944,9 @@ void
 groupUpdateTabBars (CompScreen *s,
 		    Window     enteredWin)
 {
-    CompWindow     *w = NULL;
-    GroupSelection *hoveredGroup = NULL;
+    CompWindow           *w = NULL;
+    GroupSelection       *hoveredGroup = NULL;
+    GroupWindowHashEntry *entry;
 
     GROUP_SCREEN (s);
 
@@ -953,11 +954,24 @@ groupUpdateTabBars (CompScreen *s,
        transformed */
     if (!otherScreenGrabExist (s, "group", "group-drag", NULL))
     {
-	/* first check if the entered window is a frame */
-	for (w = s->windows; w; w = w->next)
+	GroupSelection *group;
+	int            i;
+
+	/* first check if the entered window is a frame - only frames
+	   of tabbed windows are interesting, so just look at those */
+	for (group = gs->groups; group && !w; group = group->next)
 	{
-	    if (w->frame == enteredWin)
-		break;
+	    if (!group->tabBar)
+		continue;
+
+	    for (i = 0; i < group->nWins; i++)
+	    {
+		if (group->windows[i]->frame == enteredWin)
+		{
+		    w = group->windows[i];
+		    break;
+		}
+	    }
 	}
     }
 
@@ -997,19 +1011,13 @@ groupUpdateTabBars (CompScreen *s,
        a tab bar (means: input prevention window) */
     if (!hoveredGroup)
     {
-	GroupSelection *group;
+	entry = groupLookupWindowId (s->display, enteredWin);
 
-	for (group = gs->groups; group; group = group->next)
+	/* only accept it if the IPW is mapped */
+	if (entry && !entry->window && entry->group->screen == s &&
+	    entry->group->ipwMapped)
 	{
-	    if (group->inputPrevention == enteredWin)
-	    {
-		/* only accept it if the IPW is mapped */
-		if (group->ipwMapped)
-		{
-		    hoveredGroup = group;
-		    break;
-		}
-	    }
+	    hoveredGroup = entry->group;
 	}
     }
 
@@ -1851,20 +1859,41 @@ groupRecalcTabBarPos (GroupSelection *group,
     bar->leftMsSinceLastMove = 0;
 }
 
+/* we use 20 pixels as damage buffer around the tab bar elements, as
+   there is a 10 pixel wide border around the selected slot which also
+   needs to be damaged properly - however the best way would be if
+   slot->region was sized including the border */
+
+#define DAMAGE_BUFFER 20
+
 void
-groupDamageTabBarRegion (GroupSelection *group)
+groupDamageTabBarSlot (GroupTabBarSlot *slot)
 {
+    int    vx, vy;
     REGION reg;
 
+    groupGetDrawOffsetForSlot (slot, &vx, &vy);
+
     reg.rects = &reg.extents;
     reg.numRects = 1;
 
-    /* we use 15 pixels as damage buffer here, as there is a 10 pixel wide
-       border around the selected slot which also needs to be damaged
-       properly - however the best way would be if slot->region was
-       sized including the border */
+    reg.extents = slot->region->extents;
 
-#define DAMAGE_BUFFER 20
+    reg.extents.x1 += vx - DAMAGE_BUFFER;
+    reg.extents.y1 += vy - DAMAGE_BUFFER;
+    reg.extents.x2 += vx + DAMAGE_BUFFER;
+    reg.extents.y2 += vy + DAMAGE_BUFFER;
+
+    damageScreenRegion (slot->window->screen, &reg);
+}
+
+void
+groupDamageTabBarRegion (GroupSelection *group)
+{
+    REGION reg;
+
+    reg.rects = &reg.extents;
+    reg.numRects = 1;
 
     reg.extents = group->tabBar->region->extents;
 
@@ -1888,6 +1917,63 @@ groupDamageTabBarRegion (GroupSelection *group)
     damageScreenRegion (group->screen, &reg);
 }
 
+/*
+ * groupDamageTabBarBackground
+ *
+ * Damages just the tab bar background, which is all that changes
+ * during a background animation.
+ *
+ */
+void
+groupDamageTabBarBackground (GroupSelection *group)
+{
+    REGION reg;
+
+    reg.rects = &reg.extents;
+    reg.numRects = 1;
+
+    reg.extents = group->tabBar->region->extents;
+
+    damageScreenRegion (group->screen, &reg);
+}
+
+/*
+ * groupDamageTabBarText
+ *
+ * Damages the area the text layer is painted to, see groupPaintTabBar.
+ *
+ */
+void
+groupDamageTabBarText (GroupSelection *group)
+{
+    GroupTabBar *bar = group->tabBar;
+    REGION      reg;
+
+    if (!bar->textLayer)
+	return;
+
+    reg.rects = &reg.extents;
+    reg.numRects = 1;
+
+    reg.extents.x1 = bar->region->extents.x1 + 5;
+    reg.extents.x2 = bar->region->extents.x1 + bar->textLayer->texWidth + 5;
+    reg.extents.y1 = bar->region->extents.y2 - bar->textLayer->texHeight - 5;
+    reg.extents.y2 = bar->region->extents.y2 - 5;
+
+    if (reg.extents.x2 > bar->region->extents.x2)
+	reg.extents.x2 = bar->region->extents.x2;
+
+    if (reg.extents.x1 >= reg.extents.x2 || reg.extents.y1 >= reg.extents.y2)
+	return;
+
+    reg.extents.x1 -= DAMAGE_BUFFER;
+    reg.extents.y1 -= DAMAGE_BUFFER;
+    reg.extents.x2 += DAMAGE_BUFFER;
+    reg.extents.y2 += DAMAGE_BUFFER;
+
+    damageScreenRegion (group->screen, &reg);
+}
+
 void
 groupMoveTabBarRegion (GroupSelection *group,
 		       int            dx,
@@ -2184,6 +2270,8 @@ groupDeleteTabBarSlot (GroupTabBar     *bar,
     if (slot->region)
 	XDestroyRegion (slot->region);
 
+    groupFiniSlotThumb (w->screen, slot);
+
     if (slot == gs->draggedSlot)
     {
 	gs->draggedSlot = NULL;
@@ -2220,6 +2308,13 @@ void groupCreateSlot (GroupSelection *group,
 
     slot->region = XCreateRegion ();
 
+    slot->thumbFbo           = 0;
+    slot->thumbTexture       = 0;
+    slot->thumbWidth         = 0;
+    slot->thumbHeight        = 0;
+    slot->thumbDirty         = TRUE;
+    slot->msSinceThumbUpdate = GROUP_THUMB_UPDATE_INTERVAL;
+
     groupInsertTabBarSlot (group->tabBar, slot);
     gw->slot = slot;
     groupUpdateWindowProperty (w);
@@ -2341,9 +2436,10 @@ groupApplyForces (CompScreen      *s,
 		  GroupTabBar     *bar,
 		  GroupTabBarSlot *draggedSlot)
 {
-    GroupTabBarSlot *slot, *slot2;
+    GroupTabBarSlot *slot;
     int             centerX, centerY;
     int             draggedCenterX, draggedCenterY;
+    int             forceSum;
 
     if (draggedSlot)
     {
@@ -2393,6 +2489,12 @@ groupApplyForces (CompScreen      *s,
 	    bar->rightSpeed += rightForce;
     }
 
+    /* The force the dragged slot puts on a slot is passed on to all
+       slots behind it (seen from the dragged slot), so each slot gets
+       the sum of the forces pushing towards it from either side.
+       Compute that with a prefix sum in each direction instead of
+       walking the rest of the bar for every slot. */
+    forceSum = 0;
     for (slot = bar->slots; slot; slot = slot->next)
     {
 	centerX = (slot->region->extents.x1 + slot->region->extents.x2) / 2;
@@ -2400,35 +2502,35 @@ groupApplyForces (CompScreen      *s,
 
 	slot->speed += groupSpringForce (s, centerX, slot->springX);
 
+	slot->draggedForce = 0;
 	if (draggedSlot && draggedSlot != slot)
 	{
-	    int draggedSlotForce;
-	    draggedSlotForce =
-		groupDraggedSlotForce(s, centerX - draggedCenterX,
-				      abs (centerY - draggedCenterY));
-
-	    slot->speed += draggedSlotForce;
-	    slot2 = NULL;
-
-	    if (draggedSlotForce < 0)
-	    {
-		slot2 = slot->prev;
-		bar->leftSpeed += draggedSlotForce;
-	    }
-	    else if (draggedSlotForce > 0)
-	    {
-		slot2 = slot->next;
-		bar->rightSpeed += draggedSlotForce;
-	    }
+	    slot->draggedForce =
+		groupDraggedSlotForce (s, centerX - draggedCenterX,
+				       abs (centerY - draggedCenterY));
+
+	    /* forces pushing to the right from slots before this one */
+	    slot->speed += forceSum + slot->draggedForce;
+	    if (slot->draggedForce > 0)
+		forceSum += slot->draggedForce;
+	}
+    }
+    bar->rightSpeed += forceSum;
 
-	    while (slot2)
-	    {
-		if (slot2 != draggedSlot)
-		    slot2->speed += draggedSlotForce;
+    if (draggedSlot)
+    {
+	/* forces pushing to the left from slots after this one */
+	forceSum = 0;
+	for (slot = bar->revSlots; slot; slot = slot->prev)
+	{
+	    if (slot == draggedSlot)
+		continue;
 
-		slot2 = (draggedSlotForce < 0) ? slot2->prev : slot2->next;
-	    }
+	    slot->speed += forceSum;
+	    if (slot->draggedForce < 0)
+		forceSum += slot->draggedForce;
 	}
+	bar->leftSpeed += forceSum;
     }
 
     for (slot = bar->slots; slot; slot = slot->next)
@@ -2445,13 +2547,13 @@ groupApplyForces (CompScreen      *s,
 }
 
 /*
- * groupApplySpeeds
+ * groupIntegrateSpeeds
  *
  */
-void
-groupApplySpeeds (CompScreen     *s,
-		  GroupSelection *group,
-		  int            msSinceLastRepaint)
+static void
+groupIntegrateSpeeds (CompScreen     *s,
+		      GroupSelection *group,
+		      int            msSinceLastStep)
 {
     GroupTabBar     *bar = group->tabBar;
     GroupTabBarSlot *slot;
@@ -2464,8 +2566,8 @@ groupApplySpeeds (CompScreen     *s,
     box.width = bar->region->extents.x2 - bar->region->extents.x1;
     box.height = bar->region->extents.y2 - bar->region->extents.y1;
 
-    bar->leftMsSinceLastMove += msSinceLastRepaint;
-    bar->rightMsSinceLastMove += msSinceLastRepaint;
+    bar->leftMsSinceLastMove += msSinceLastStep;
+    bar->rightMsSinceLastMove += msSinceLastStep;
 
     /* Left */
     move = bar->leftSpeed * bar->leftMsSinceLastMove / 1000;
@@ -2509,9 +2611,9 @@ groupApplySpeeds (CompScreen     *s,
     {
 	/* Friction is preventing from the right border to get
 	   to its original position. */
-	box.width += bar->leftSpringX - bar->region->extents.x1;
+	box.width += bar->rightSpringX - bar->region->extents.x2;
 
-	bar->leftMsSinceLastMove = 0;
+	bar->rightMsSinceLastMove = 0;
 	updateTabBar = TRUE;
     }
     else if (bar->rightSpeed == 0)
@@ -2524,14 +2626,16 @@ groupApplySpeeds (CompScreen     *s,
     {
 	int slotCenter;
 
-	slot->msSinceLastMove += msSinceLastRepaint;
+	slot->msSinceLastMove += msSinceLastStep;
 	move = slot->speed * slot->msSinceLastMove / 1000;
 	slotCenter = (slot->region->extents.x1 +
 		      slot->region->extents.x2) / 2;
 
 	if (move)
 	{
+	    groupDamageTabBarSlot (slot);
 	    XOffsetRegion (slot->region, move, 0);
+	    groupDamageTabBarSlot (slot);
 	    slot->msSinceLastMove = 0;
 	}
 	else if (slot->speed == 0 &&
@@ -2541,7 +2645,9 @@ groupApplySpeeds (CompScreen     *s,
 	    /* Friction is preventing from the slot to get
 	       to its original position. */
 
+	    groupDamageTabBarSlot (slot);
 	    XOffsetRegion (slot->region, slot->springX - slotCenter, 0);
+	    groupDamageTabBarSlot (slot);
 	    slot->msSinceLastMove = 0;
 	}
 	else if (slot->speed == 0)
@@ -2549,6 +2655,48 @@ groupApplySpeeds (CompScreen     *s,
     }
 }
 
+/*
+ * groupApplySpeeds
+ *
+ */
+void
+groupApplySpeeds (CompScreen     *s,
+		  GroupSelection *group,
+		  int            msSinceLastRepaint)
+{
+    GroupTabBar     *bar = group->tabBar;
+    GroupTabBarSlot *draggedSlot;
+
+    GROUP_SCREEN (s);
+
+    draggedSlot = gs->dragged ? gs->draggedSlot : NULL;
+
+    /* Forces and friction are applied once per step, so the simulation
+       is independent of the repaint rate. The slots are still moved by
+       the time actually passed, a partial step at a time, so that repaint
+       rates above the step rate don't move them in visible jumps. Long
+       stalls are clamped rather than simulated in full. */
+    msSinceLastRepaint = MIN (msSinceLastRepaint,
+			      GROUP_PHYSICS_MAX_STEPS * GROUP_PHYSICS_STEP);
+
+    while (msSinceLastRepaint > 0)
+    {
+	int ms;
+
+	if (!bar->msSinceLastStep)
+	    groupApplyForces (s, bar, draggedSlot);
+
+	ms = MIN (msSinceLastRepaint,
+		  GROUP_PHYSICS_STEP - bar->msSinceLastStep);
+	groupIntegrateSpeeds (s, group, ms);
+
+	msSinceLastRepaint   -= ms;
+	bar->msSinceLastStep += ms;
+	if (bar->msSinceLastStep >= GROUP_PHYSICS_STEP)
+	    bar->msSinceLastStep = 0;
+    }
+}
+
 /*
  * groupInitTabBar
  *
@@ -2580,6 +2728,7 @@ groupInitTabBar (GroupSelection *group,
     bar->hoveredSlot = NULL;
     bar->textSlot = NULL;
     bar->oldWidth = 0;
+    bar->msSinceLastStep = 0;
     group->tabBar = bar;
 
     bar->region = XCreateRegion ();
@@ -2678,7 +2827,7 @@ groupChangeTabLeft (CompDisplay     *d,
     CompWindow *w, *topTab;
 
     xid = getIntOptionNamed (option, nOption, "window", 0);
-    w   = topTab = findWindowAtDisplay (d, xid);
+    w   = topTab = groupFindGroupedWindow (d, xid);
     if (!w)
 	return TRUE;
 
@@ -2720,7 +2869,7 @@ groupChangeTabRight (CompDisplay     *d,
     CompWindow *w, *topTab;
 
     xid = getIntOptionNamed (option, nOption, "window", 0);
-    w   = topTab = findWindowAtDisplay (d, xid);
+    w   = topTab = groupFindGroupedWindow (d, xid);
     if (!w)
 	return TRUE;
 
@@ -2789,6 +2938,9 @@ groupCreateInputPreventionWindow (GroupSelection *group)
 			   CopyFromParent, InputOnly,
 			   CopyFromParent, CWOverrideRedirect, &attrib);
 	group->ipwMapped = FALSE;
+
+	groupHashWindowId (group->screen->display,
+			   group->inputPrevention, NULL, group);
     }
 }
 
@@ -2801,6 +2953,8 @@ groupDestroyInputPreventionWindow (GroupSelection *group)
 {
     if (group->inputPrevention)
     {
+	groupUnhashWindowId (group->screen->display, group->inputPrevention);
+
 	XDestroyWindow (group->screen->display->display,
 			group->inputPrevention);
 
@@ -22,6 +22,7 @@
 #include <math.h>
 
 #include <compiz-core.h>
+#include <compiz-renderbuffer.h>
 
 #include "mblur_options.h"
 
@@ -60,6 +61,18 @@ typedef struct _MblurScreen
     Bool activated;
 
     GLuint texture;
+
+    /* framebuffer object mode, each frame is painted into fboTexture[fboCurrent]
+       and the previous result in the other texture is blended over it */
+    GLuint fbo;
+    GLuint fboTexture[2];
+    GLuint fboDepth;
+    int    fboCurrent;
+    int    fboWidth, fboHeight;
+    int    fboTexWidth, fboTexHeight;
+    Bool   noFbo;
+
+    CompRenderbufferProcs rb;
 }
 MblurScreen;
 
@@ -130,18 +143,279 @@ mblurPreparePaintScreen (CompScreen * s,
 }
 
 
+static void
+mblurFiniFbo (CompScreen *s)
+{
+    MBLUR_SCREEN (s);
+
+    if (ms->fbo)
+	(*s->deleteFramebuffers) (1, &ms->fbo);
+    if (ms->fboTexture[0])
+	glDeleteTextures (2, ms->fboTexture);
+    if (ms->fboDepth)
+	(*ms->rb.deleteRenderbuffers) (1, &ms->fboDepth);
+
+    ms->fbo           = 0;
+    ms->fboTexture[0] = 0;
+    ms->fboTexture[1] = 0;
+    ms->fboDepth      = 0;
+}
+
+/*
+ * Create the two screen sized textures and the depth buffer for the
+ * framebuffer object mode, or resize them to the current screen size
+ */
+static Bool
+mblurInitFbo (CompScreen *s)
+{
+    int    i, texWidth, texHeight;
+    GLint  oldFbo;
+    GLenum status = GL_FRAMEBUFFER_COMPLETE_EXT;
+
+    MBLUR_SCREEN (s);
+
+    if (!s->fbo || ms->noFbo)
+	return FALSE;
+
+    /* everything painted by core and the other plugins ends up in the
+       framebuffer object, so it needs depth and stencil buffers too */
+    if (!renderbufferProcsInit (s, &ms->rb))
+    {
+	compLogMessage ("mblur", CompLogLevelWarn,
+			"No renderbuffer support, "
+			"falling back to texture copy");
+
+	ms->noFbo = TRUE;
+	return FALSE;
+    }
+
+    if (ms->fbo && ms->fboWidth == s->width && ms->fboHeight == s->height)
+	return TRUE;
+
+    texWidth  = s->width;
+    texHeight = s->height;
+
+    if (!s->textureNonPowerOfTwo)
+    {
+	for (texWidth = 1; texWidth < s->width; texWidth <<= 1);
+	for (texHeight = 1; texHeight < s->height; texHeight <<= 1);
+    }
+
+    if (!ms->fboTexture[0])
+	glGenTextures (2, ms->fboTexture);
+    if (!ms->fboDepth)
+	(*ms->rb.genRenderbuffers) (1, &ms->fboDepth);
+    if (!ms->fbo)
+	(*s->genFramebuffers) (1, &ms->fbo);
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &oldFbo);
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, ms->fbo);
+
+    renderbufferAttachDepth (&ms->rb, ms->fboDepth, texWidth, texHeight);
+
+    for (i = 0; i < 2 && status == GL_FRAMEBUFFER_COMPLETE_EXT; i++)
+    {
+	glBindTexture (GL_TEXTURE_2D, ms->fboTexture[i]);
+	glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, texWidth, texHeight, 0,
+		      GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture (GL_TEXTURE_2D, 0);
+
+	(*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				    GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+				    ms->fboTexture[i], 0);
+	status = (*s->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
+    }
+
+    /* the new buffers have undefined contents */
+    if (status == GL_FRAMEBUFFER_COMPLETE_EXT)
+	glClear (GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, oldFbo);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+	compLogMessage ("mblur", CompLogLevelWarn,
+			"Framebuffer object incomplete, "
+			"falling back to texture copy");
+
+	mblurFiniFbo (s);
+	ms->noFbo = TRUE;
+	return FALSE;
+    }
+
+    ms->fboWidth     = s->width;
+    ms->fboHeight    = s->height;
+    ms->fboTexWidth  = texWidth;
+    ms->fboTexHeight = texHeight;
+    ms->update       = TRUE;
+
+    return TRUE;
+}
+
+/*
+ * Redirect painting of the screen into the current texture, returns
+ * the previously bound framebuffer
+ */
+static GLint
+mblurBeginFbo (CompScreen *s)
+{
+    GLint oldFbo;
+
+    MBLUR_SCREEN (s);
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &oldFbo);
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, ms->fbo);
+    (*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+				ms->fboTexture[ms->fboCurrent], 0);
+
+    return oldFbo;
+}
+
+/* draws the area of an output with the matching part of the bound texture */
+static void
+mblurDrawOutputRect (CompScreen *s,
+		     CompOutput *output)
+{
+    BoxPtr box = &output->region.extents;
+    float  tx1, tx2, ty1, ty2;
+
+    MBLUR_SCREEN (s);
+
+    /* textures are bottom up, screen coordinates top down */
+    tx1 = (float) box->x1 / ms->fboTexWidth;
+    tx2 = (float) box->x2 / ms->fboTexWidth;
+    ty1 = (float) (s->height - box->y1) / ms->fboTexHeight;
+    ty2 = (float) (s->height - box->y2) / ms->fboTexHeight;
+
+    glBegin (GL_QUADS);
+    glTexCoord2f (tx1, ty1);
+    glVertex2i (box->x1, box->y1);
+    glTexCoord2f (tx1, ty2);
+    glVertex2i (box->x1, box->y2);
+    glTexCoord2f (tx2, ty2);
+    glVertex2i (box->x2, box->y2);
+    glTexCoord2f (tx2, ty1);
+    glVertex2i (box->x2, box->y1);
+    glEnd ();
+}
+
+static Bool
+mblurOutputPainted (CompOutput *output,
+		    CompOutput *outputs,
+		    int        numOutput)
+{
+    int i;
+
+    for (i = 0; i < numOutput; i++)
+	if (&outputs[i] == output)
+	    return TRUE;
+
+    return FALSE;
+}
+
+/*
+ * Blend the previous result into the freshly painted frame, output by
+ * output, and show it. The blended frame stays in the current texture
+ * and is the previous result of the next frame, so nothing is ever
+ * copied from the framebuffer.
+ */
+static void
+mblurEndFbo (CompScreen *s,
+	     GLint      oldFbo,
+	     CompOutput *outputs,
+	     int        numOutput)
+{
+    int i;
+
+    MBLUR_SCREEN (s);
+
+    glPushAttrib (GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT | GL_VIEWPORT_BIT);
+    glPushMatrix ();
+    glLoadIdentity ();
+
+    glViewport (0, 0, s->width, s->height);
+    glTranslatef (-0.5f, -0.5f, -DEFAULT_Z_CAMERA);
+    glScalef (1.0f / s->width, -1.0f / s->height, 1.0f);
+    glTranslatef (0.0f, -s->height, 0.0f);
+
+    glEnable (GL_TEXTURE_2D);
+    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    if (!ms->update)
+    {
+	ms->alpha = (ms->timer / 500.0) *
+		    ms->alpha + (1.0 - (ms->timer / 500.0) ) * 0.5;
+
+	glBindTexture (GL_TEXTURE_2D, ms->fboTexture[!ms->fboCurrent]);
+
+	glEnable (GL_BLEND);
+	glBlendFunc (GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+	glColor4f (1, 1, 1, ms->alpha);
+
+	for (i = 0; i < numOutput; i++)
+	    mblurDrawOutputRect (s, &outputs[i]);
+
+	/* outputs that were not painted keep their previous result */
+	if (outputs != &s->fullscreenOutput)
+	{
+	    glDisable (GL_BLEND);
+	    glColor4f (1, 1, 1, 1);
+
+	    for (i = 0; i < s->nOutputDev; i++)
+		if (!mblurOutputPainted (&s->outputDev[i], outputs, numOutput))
+		    mblurDrawOutputRect (s, &s->outputDev[i]);
+	}
+    }
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, oldFbo);
+
+    glDisable (GL_BLEND);
+    glColor4f (1, 1, 1, 1);
+    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glBindTexture (GL_TEXTURE_2D, ms->fboTexture[ms->fboCurrent]);
+
+    for (i = 0; i < numOutput; i++)
+	mblurDrawOutputRect (s, &outputs[i]);
+
+    glBindTexture (GL_TEXTURE_2D, 0);
+    glDisable (GL_TEXTURE_2D);
+
+    glColor4usv (defaultColor);
+    glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    glPopMatrix ();
+    glPopAttrib ();
+
+    ms->fboCurrent = !ms->fboCurrent;
+    ms->update     = FALSE;
+}
+
 static void
 mblurPaintScreen (CompScreen   *s,
 		  CompOutput   *outputs,
 		  int          numOutput,
 		  unsigned int mask)
 {
+    int   mode;
+    GLint oldFbo = 0;
 
     MBLUR_SCREEN (s);
 
     if (!ms->active)
 	ms->update = TRUE;
 
+    mode = mblurGetMode (s);
+    if (mode == ModeFramebufferObject && !(ms->active && mblurInitFbo (s)))
+	mode = ModeTextureCopy;
+
+    if (ms->active && mode == ModeFramebufferObject)
+	oldFbo = mblurBeginFbo (s);
 
     UNWRAP (ms, s, paintScreen);
     (*s->paintScreen) (s, outputs, numOutput, mask);
@@ -155,7 +429,13 @@ mblurPaintScreen (CompScreen   *s,
 	enable_scissor = TRUE;
     }
 
-    if (ms->active && mblurGetMode (s) == ModeTextureCopy)
+    if (ms->active && mode == ModeFramebufferObject)
+    {
+	mblurEndFbo (s, oldFbo, outputs, numOutput);
+	damageScreen (s);
+    }
+
+    if (ms->active && mode == ModeTextureCopy)
     {
 
 	float tx, ty;
@@ -251,7 +531,7 @@ mblurPaintScreen (CompScreen   *s,
 	damageScreen (s);
     }
 
-    if (ms->active && mblurGetMode (s) == ModeAccumulationBuffer)
+    if (ms->active && mode == ModeAccumulationBuffer)
     {
 
 	// create motion blur effect using accumulation buffer
@@ -401,6 +681,8 @@ mblurFiniScreen (CompPlugin *p,
     if (ms->texture)
 	glDeleteTextures (1, &ms->texture);
 
+    mblurFiniFbo (s);
+
     /* restore the original function */
     UNWRAP (ms, s, paintScreen);
     UNWRAP (ms, s, preparePaintScreen);
@@ -41,6 +41,7 @@
 #define SHOWMOUSE_SCREEN(s)                                                      \
     ShowmouseScreen *ss = GET_SHOWMOUSE_SCREEN (s, GET_SHOWMOUSE_DISPLAY (s->display))
 
+#define MAX_EMITERS 10
 
 typedef struct _Particle
 {
@@ -66,8 +67,15 @@ typedef struct _Particle
     float xo;			// orginal X position
     float yo;			// orginal Y position
     float zo;			// orginal Z position
+    int   e;			// emiter the particle was spawned from
 } Particle;
 
+// screen area covered by the particles of one emiter, empty if x1 > x2
+typedef struct _ParticleBounds
+{
+    float x1, y1, x2, y2;
+} ParticleBounds;
+
 typedef struct _ParticleSystem
 {
     int      numParticles;
@@ -88,8 +96,28 @@ typedef struct _ParticleSystem
     int     color_cache_count;
     GLfloat *dcolors_cache;
     int     dcolors_cache_count;
+
+    // point sprite path, 0 if not supported
+    GLuint  vertexProgram;
+    GLfloat maxPointSize;
+
+    // kept up to date by updateParticles and genNewParticles
+    ParticleBounds bounds[MAX_EMITERS];
 } ParticleSystem;
 
+// passes the sprite size in texture coordinate 0 through to the point size,
+// as fixed function point sizes can not be set per vertex
+static const char *particleVertexProgram =
+    "!!ARBvp1.0"
+    "PARAM mvp[4] = { state.matrix.mvp };"
+    "DP4 result.position.x, mvp[0], vertex.position;"
+    "DP4 result.position.y, mvp[1], vertex.position;"
+    "DP4 result.position.z, mvp[2], vertex.position;"
+    "DP4 result.position.w, mvp[3], vertex.position;"
+    "MOV result.color, vertex.color;"
+    "MOV result.pointsize.x, vertex.texcoord[0].x;"
+    "END";
+
 
 static int displayPrivateIndex = 0;
 
@@ -120,6 +148,45 @@ typedef struct _ShowmouseScreen
 }
 ShowmouseScreen;
 
+static void
+resetParticleBounds (ParticleSystem * ps)
+{
+    int i;
+
+    for (i = 0; i < MAX_EMITERS; i++)
+    {
+	ps->bounds[i].x1 = ps->bounds[i].y1 = 0;
+	ps->bounds[i].x2 = ps->bounds[i].y2 = -1;
+    }
+}
+
+static void
+addParticleBounds (ParticleSystem * ps, Particle * part)
+{
+    ParticleBounds *b = &ps->bounds[part->e];
+
+    float w = part->width / 2;
+    float h = part->height / 2;
+
+    w += (w * part->w_mod) * part->life;
+    h += (h * part->h_mod) * part->life;
+
+    if (b->x1 > b->x2)
+    {
+	b->x1 = part->x - w;
+	b->x2 = part->x + w;
+	b->y1 = part->y - h;
+	b->y2 = part->y + h;
+    }
+    else
+    {
+	b->x1 = MIN (b->x1, part->x - w);
+	b->x2 = MAX (b->x2, part->x + w);
+	b->y1 = MIN (b->y1, part->y - h);
+	b->y2 = MAX (b->y2, part->y + h);
+    }
+}
+
 static void
 initParticles (int numParticles, ParticleSystem * ps)
 {
@@ -141,6 +208,11 @@ initParticles (int numParticles, ParticleSystem * ps)
     ps->coords_cache_count  = 0;
     ps->dcolors_cache_count = 0;
 
+    ps->vertexProgram = 0;
+    ps->maxPointSize  = 0.0f;
+
+    resetParticleBounds (ps);
+
     Particle *part = ps->particles;
     int i;
     for (i = 0; i < numParticles; i++, part++)
@@ -148,54 +220,144 @@ initParticles (int numParticles, ParticleSystem * ps)
 }
 
 static void
-drawParticles (CompScreen * s, ParticleSystem * ps)
+initParticleSprites (CompScreen * s, ParticleSystem * ps)
 {
-    glPushMatrix();
+    const char *extensions;
+    GLfloat    range[2];
+    GLint      errorPos;
 
-    glEnable(GL_BLEND);
-    if (ps->tex)
-    {
-	glBindTexture(GL_TEXTURE_2D, ps->tex);
-	glEnable(GL_TEXTURE_2D);
-    }
-    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    ps->vertexProgram = 0;
 
-    /* Check that the cache is big enough */
-    if (ps->numParticles > ps->vertex_cache_count)
-    {
-	ps->vertices_cache =
-	    realloc(ps->vertices_cache,
-		    ps->numParticles * 4 * 3 * sizeof(GLfloat));
-	ps->vertex_cache_count = ps->numParticles;
-    }
+    // core only loads the ARB program entry points together
+    // with fragment program support
+    if (!s->fragmentProgram)
+	return;
 
-    if (ps->numParticles > ps->coords_cache_count)
+    extensions = (const char *) glGetString(GL_EXTENSIONS);
+    if (!extensions ||
+	!strstr(extensions, "GL_ARB_point_sprite") ||
+	!strstr(extensions, "GL_ARB_vertex_program"))
+	return;
+
+    glGetFloatv(GL_ALIASED_POINT_SIZE_RANGE, range);
+    ps->maxPointSize = range[1];
+
+    glGetError();
+
+    (*s->genPrograms) (1, &ps->vertexProgram);
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, ps->vertexProgram);
+    (*s->programString) (GL_VERTEX_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB,
+			 strlen(particleVertexProgram),
+			 particleVertexProgram);
+
+    glGetIntegerv(GL_PROGRAM_ERROR_POSITION_ARB, &errorPos);
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, 0);
+
+    if (glGetError() != GL_NO_ERROR || errorPos != -1)
     {
-	ps->coords_cache =
-	    realloc(ps->coords_cache,
-		    ps->numParticles * 4 * 2 * sizeof(GLfloat));
-	ps->coords_cache_count = ps->numParticles;
+	compLogMessage ("showmouse", CompLogLevelWarn,
+			"Failed to load particle vertex program, "
+			"falling back to quads");
+
+	(*s->deletePrograms) (1, &ps->vertexProgram);
+	ps->vertexProgram = 0;
     }
+}
 
-    if (ps->numParticles > ps->color_cache_count)
+// submits one point per particle, returns FALSE without drawing when
+// a particle is larger than the biggest supported point size
+static Bool
+drawParticleSprites (CompScreen * s, ParticleSystem * ps)
+{
+    GLfloat *dcolors  = ps->dcolors_cache;
+    GLfloat *vertices = ps->vertices_cache;
+    GLfloat *sizes    = ps->coords_cache;
+    GLfloat *colors   = ps->colors_cache;
+
+    int numActive = 0;
+
+    Particle *part = ps->particles;
+    int i;
+    for (i = 0; i < ps->numParticles; i++, part++)
     {
-	ps->colors_cache =
-	    realloc(ps->colors_cache,
-		    ps->numParticles * 4 * 4 * sizeof(GLfloat));
-	ps->color_cache_count = ps->numParticles;
+	if (part->life > 0.0f)
+	{
+	    float w = part->width;
+	    float h = part->height;
+
+	    w += (w * part->w_mod) * part->life;
+	    h += (h * part->h_mod) * part->life;
+
+	    // sprites are square, cover the whole particle
+	    sizes[0] = MAX (w, h);
+	    if (sizes[0] > ps->maxPointSize)
+		return FALSE;
+
+	    vertices[0] = part->x;
+	    vertices[1] = part->y;
+	    vertices[2] = part->z;
+
+	    colors[0] = part->r;
+	    colors[1] = part->g;
+	    colors[2] = part->b;
+	    colors[3] = part->life * part->a;
+
+	    if (ps->darken > 0)
+	    {
+		dcolors[0] = part->r;
+		dcolors[1] = part->g;
+		dcolors[2] = part->b;
+		dcolors[3] = part->life * part->a * ps->darken;
+		dcolors += 4;
+	    }
+
+	    vertices += 3;
+	    sizes    += 1;
+	    colors   += 4;
+
+	    numActive++;
+	}
     }
 
+    glEnable(GL_POINT_SPRITE_ARB);
+    glTexEnvi(GL_POINT_SPRITE_ARB, GL_COORD_REPLACE_ARB, GL_TRUE);
+    glEnable(GL_VERTEX_PROGRAM_POINT_SIZE_ARB);
+    glEnable(GL_VERTEX_PROGRAM_ARB);
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, ps->vertexProgram);
+
+    glEnableClientState(GL_COLOR_ARRAY);
+
+    glTexCoordPointer(1, GL_FLOAT, sizeof(GLfloat), ps->coords_cache);
+    glVertexPointer(3, GL_FLOAT, 3 * sizeof(GLfloat), ps->vertices_cache);
+
+    // darken the background
     if (ps->darken > 0)
     {
-	if (ps->dcolors_cache_count < ps->numParticles)
-	{
-	    ps->dcolors_cache =
-		realloc(ps->dcolors_cache,
-			ps->numParticles * 4 * 4 * sizeof(GLfloat));
-	    ps->dcolors_cache_count = ps->numParticles;
-	}
+	glBlendFunc(GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	glColorPointer(4, GL_FLOAT, 4 * sizeof(GLfloat), ps->dcolors_cache);
+	glDrawArrays(GL_POINTS, 0, numActive);
     }
+    // draw particles
+    glBlendFunc(GL_SRC_ALPHA, ps->blendMode);
+
+    glColorPointer(4, GL_FLOAT, 4 * sizeof(GLfloat), ps->colors_cache);
+
+    glDrawArrays(GL_POINTS, 0, numActive);
+
+    glDisableClientState(GL_COLOR_ARRAY);
 
+    (*s->bindProgram) (GL_VERTEX_PROGRAM_ARB, 0);
+    glDisable(GL_VERTEX_PROGRAM_ARB);
+    glDisable(GL_VERTEX_PROGRAM_POINT_SIZE_ARB);
+    glTexEnvi(GL_POINT_SPRITE_ARB, GL_COORD_REPLACE_ARB, GL_FALSE);
+    glDisable(GL_POINT_SPRITE_ARB);
+
+    return TRUE;
+}
+
+static void
+drawParticleQuads (ParticleSystem * ps)
+{
     GLfloat *dcolors  = ps->dcolors_cache;
     GLfloat *vertices = ps->vertices_cache;
     GLfloat *coords   = ps->coords_cache;
@@ -292,6 +454,59 @@ drawParticles (CompScreen * s, ParticleSystem * ps)
     glDrawArrays(GL_QUADS, 0, numActive);
 
     glDisableClientState(GL_COLOR_ARRAY);
+}
+
+static void
+drawParticles (CompScreen * s, ParticleSystem * ps)
+{
+    glPushMatrix();
+
+    glEnable(GL_BLEND);
+    if (ps->tex)
+    {
+	glBindTexture(GL_TEXTURE_2D, ps->tex);
+	glEnable(GL_TEXTURE_2D);
+    }
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    /* Check that the cache is big enough */
+    if (ps->numParticles > ps->vertex_cache_count)
+    {
+	ps->vertices_cache =
+	    realloc(ps->vertices_cache,
+		    ps->numParticles * 4 * 3 * sizeof(GLfloat));
+	ps->vertex_cache_count = ps->numParticles;
+    }
+
+    if (ps->numParticles > ps->coords_cache_count)
+    {
+	ps->coords_cache =
+	    realloc(ps->coords_cache,
+		    ps->numParticles * 4 * 2 * sizeof(GLfloat));
+	ps->coords_cache_count = ps->numParticles;
+    }
+
+    if (ps->numParticles > ps->color_cache_count)
+    {
+	ps->colors_cache =
+	    realloc(ps->colors_cache,
+		    ps->numParticles * 4 * 4 * sizeof(GLfloat));
+	ps->color_cache_count = ps->numParticles;
+    }
+
+    if (ps->darken > 0)
+    {
+	if (ps->dcolors_cache_count < ps->numParticles)
+	{
+	    ps->dcolors_cache =
+		realloc(ps->dcolors_cache,
+			ps->numParticles * 4 * 4 * sizeof(GLfloat));
+	    ps->dcolors_cache_count = ps->numParticles;
+	}
+    }
+
+    if (!ps->vertexProgram || !drawParticleSprites (s, ps))
+	drawParticleQuads (ps);
 
     glPopMatrix();
     glColor4usv(defaultColor);
@@ -311,6 +526,8 @@ updateParticles (ParticleSystem * ps, float time)
 
     ps->active = FALSE;
 
+    resetParticleBounds (ps);
+
     part = ps->particles;
 
     for (i = 0; i < ps->numParticles; i++, part++)
@@ -330,16 +547,21 @@ updateParticles (ParticleSystem * ps, float time)
 	    // modify life
 	    part->life -= part->fade * speed;
 	    ps->active  = TRUE;
+
+	    if (part->life > 0.0f)
+		addParticleBounds (ps, part);
 	}
     }
 }
 
 static void
-finiParticles (ParticleSystem * ps)
+finiParticles (CompScreen * s, ParticleSystem * ps)
 {
     free(ps->particles);
     if (ps->tex)
 	glDeleteTextures(1, &ps->tex);
+    if (ps->vertexProgram)
+	(*s->deletePrograms) (1, &ps->vertexProgram);
 
     if (ps->vertices_cache)
 	free(ps->vertices_cache);
@@ -381,8 +603,8 @@ genNewParticles(CompScreen     *s,
     Particle *part = ps->particles;
     int i, j;
 
-    float pos[10][2];
-    int nE       = MIN (10, showmouseGetEmiters (s));
+    float pos[MAX_EMITERS][2];
+    int nE       = MIN (MAX_EMITERS, showmouseGetEmiters (s));
     float rA     = (2 * M_PI) / nE;
     int radius   = showmouseGetRadius (s);
     for (i = 0; i < nE; i++)
@@ -411,6 +633,7 @@ genNewParticles(CompScreen     *s,
 	    // choose random position
 
 	    j        = random() % nE;
+	    part->e  = j;
 	    part->x  = pos[j][0];
 	    part->y  = pos[j][1];
 	    part->z  = 0.0;
@@ -450,6 +673,8 @@ genNewParticles(CompScreen     *s,
 	    part->yg = 0.0f;
 	    part->zg = 0.0f;
 
+	    addParticleBounds (ps, part);
+
 	    ps->active = TRUE;
 	    max_new   -= 1;
 	}
@@ -457,49 +682,38 @@ genNewParticles(CompScreen     *s,
 }
 
 
+// damages one rectangle per emiter, the particles of different emiters
+// are usually far apart and one box around all of them would mostly
+// cover untouched screen
 static void
 damageRegion (CompScreen *s)
 {
-    REGION   r;
-    int      i;
-    Particle *p;
-    float    w, h, x1, x2, y1, y2;
+    REGION         r;
+    ParticleBounds *b;
+    int            i;
 
     SHOWMOUSE_SCREEN (s);
 
     if (!ss->ps)
 	return;
 
-    x1 = s->width;
-    x2 = 0;
-    y1 = s->height;
-    y2 = 0;
-
-    p = ss->ps->particles;
+    r.rects = &r.extents;
+    r.numRects = r.size = 1;
 
-    for (i = 0; i < ss->ps->numParticles; i++, p++)
+    for (i = 0; i < MAX_EMITERS; i++)
     {
-	w = p->width / 2;
-	h = p->height / 2;
-
-	w += (w * p->w_mod) * p->life;
-	h += (h * p->h_mod) * p->life;
-	
-	x1 = MIN (x1, p->x - w);
-	x2 = MAX (x2, p->x + w);
-	y1 = MIN (y1, p->y - h);
-	y2 = MAX (y2, p->y + h);
-    }
+	b = &ss->ps->bounds[i];
 
-    r.rects = &r.extents;
-    r.numRects = r.size = 1;
+	if (b->x1 > b->x2)
+	    continue;
 
-    r.extents.x1 = floor (x1);
-    r.extents.x2 = ceil (x2);
-    r.extents.y1 = floor (y1);
-    r.extents.y2 = ceil (y2);
+	r.extents.x1 = floor (b->x1);
+	r.extents.x2 = ceil (b->x2);
+	r.extents.y1 = floor (b->y1);
+	r.extents.y2 = ceil (b->y2);
 
-    damageScreenRegion (s, &r);
+	damageScreenRegion (s, &r);
+    }
 }
 
 static void
@@ -521,6 +735,15 @@ showmousePreparePaintScreen (CompScreen *s,
     SHOWMOUSE_SCREEN (s);
     SHOWMOUSE_DISPLAY (s->display);
 
+    // nothing to simulate once the effect is off and all particles died
+    if (!ss->active && !ss->ps)
+    {
+	UNWRAP (ss, s, preparePaintScreen);
+	(*s->preparePaintScreen) (s, time);
+	WRAP (ss, s, preparePaintScreen, showmousePreparePaintScreen);
+	return;
+    }
+
     if (ss->active && !ss->pollHandle)
     {
 	(*sd->mpFunc->getCurrentPosition) (s, &ss->posX, &ss->posY);
@@ -553,6 +776,8 @@ showmousePreparePaintScreen (CompScreen *s,
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 32, 0,
 			GL_RGBA, GL_UNSIGNED_BYTE, starTex);
 	glBindTexture(GL_TEXTURE_2D, 0);
+
+	initParticleSprites (s, ss->ps);
     }
 
     if (ss->active)
@@ -560,14 +785,15 @@ showmousePreparePaintScreen (CompScreen *s,
 			showmouseGetRotationSpeed (s)), 2 * M_PI);
 
     if (ss->ps && ss->ps->active)
-    {
 	updateParticles (ss->ps, time);
-	damageRegion (s);
-    }
 
     if (ss->ps && ss->active)
 	genNewParticles (s, ss->ps, time);
 
+    // damage after spawning, so that new particles are covered as well
+    if (ss->ps && ss->ps->active)
+	damageRegion (s);
+
     UNWRAP (ss, s, preparePaintScreen);
     (*s->preparePaintScreen) (s, time);
     WRAP (ss, s, preparePaintScreen, showmousePreparePaintScreen);
@@ -590,7 +816,7 @@ showmouseDonePaintScreen (CompScreen *s)
 
     if (!ss->active && ss->ps && !ss->ps->active)
     {
-	finiParticles (ss->ps);
+	finiParticles (s, ss->ps);
 	free (ss->ps);
 	ss->ps = NULL;
     }